@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "audio_dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+namespace {
+
+    // largest float that is less than 2^31, so +1.0 maps to a valid int32
+    constexpr float full_scale = 2147483520.0f;
+
+    const std::string stereo_preset("Stereo (1-2)");
+    const std::string stereo_pairs_preset("Stereo (1-2, 3-4, 5-6, 7-8)");
+    const std::string surround_preset("5.1 (1-6) + Stereo Fold-down (7-8)");
+
+} // namespace
+
+AudioRoutingMatrix::AudioRoutingMatrix(const int in, const int out)
+    : in_channels(in),
+      out_channels(out),
+      padded_out_channels(((out + 3) / 4) * 4),
+      gains(in * padded_out_channels, 0.0f) {}
+
+std::vector<std::string> audio_routing_preset_names() {
+    return std::vector<std::string>({stereo_preset, stereo_pairs_preset, surround_preset});
+}
+
+AudioRoutingMatrix audio_routing_preset(const std::string &name) {
+
+    if (name == stereo_preset) {
+
+        AudioRoutingMatrix m(2, 2);
+        m.set_gain(0, 0, 1.0f);
+        m.set_gain(1, 1, 1.0f);
+        return m;
+
+    } else if (name == stereo_pairs_preset) {
+
+        // same stereo pair on every pair of SDI channels, for embedders or
+        // monitors that listen to a pair other than 1-2
+        AudioRoutingMatrix m(2, 8);
+        for (int pair = 0; pair < 4; ++pair) {
+            m.set_gain(0, pair * 2, 1.0f);
+            m.set_gain(1, pair * 2 + 1, 1.0f);
+        }
+        return m;
+
+    } else if (name == surround_preset) {
+
+        // xstudio 5.1 order is L, R, C, LFE, Ls, Rs. These go straight to SDI
+        // channels 1-6. Channels 7-8 carry an ITU-R BS.775 Lo/Ro fold-down,
+        // normalised so that it can't clip. LFE is not folded down.
+        AudioRoutingMatrix m(6, 8);
+        for (int c = 0; c < 6; ++c) {
+            m.set_gain(c, c, 1.0f);
+        }
+        const float norm   = 1.0f / (1.0f + 2.0f * float(M_SQRT1_2));
+        const float centre = float(M_SQRT1_2) * norm;
+        m.set_gain(0, 6, norm);
+        m.set_gain(1, 7, norm);
+        m.set_gain(2, 6, centre);
+        m.set_gain(2, 7, centre);
+        m.set_gain(4, 6, centre);
+        m.set_gain(5, 7, centre);
+        return m;
+    }
+
+    throw std::runtime_error("Unknown audio routing: " + name);
+}
+
+void convert_and_route_samples(
+    SDIAudioSample *dst,
+    const float *src,
+    const size_t num_frames,
+    const AudioRoutingMatrix &matrix,
+    AudioLevels *levels) {
+
+    const int in_ch  = matrix.in_channels;
+    const int out_ch = matrix.out_channels;
+    const int padded = matrix.padded_out_channels;
+    const float *gains = matrix.gains.data();
+
+#if defined(__SSE2__)
+
+    // For each frame we accumulate the output channels four at a time: every
+    // input sample is broadcast and multiplied by the matching column of the
+    // matrix. Then clamp, scale to 32 bit and convert. Metering is a couple
+    // more ops on values that are already in registers.
+    const __m128 one     = _mm_set1_ps(1.0f);
+    const __m128 neg_one = _mm_set1_ps(-1.0f);
+    const __m128 scale   = _mm_set1_ps(full_scale);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    alignas(16) int32_t tmp[4];
+
+    constexpr int max_blocks = AudioLevels::max_channels / 4;
+    __m128 peak[max_blocks];
+    __m128 sum_squares[max_blocks];
+    for (int b = 0; b < max_blocks; ++b) {
+        peak[b]        = _mm_setzero_ps();
+        sum_squares[b] = _mm_setzero_ps();
+    }
+
+    for (size_t f = 0; f < num_frames; ++f) {
+
+        for (int o = 0; o < padded; o += 4) {
+
+            __m128 acc = _mm_setzero_ps();
+            for (int i = 0; i < in_ch; ++i) {
+                acc = _mm_add_ps(
+                    acc,
+                    _mm_mul_ps(_mm_set1_ps(src[i]), _mm_loadu_ps(gains + i * padded + o)));
+            }
+            acc = _mm_min_ps(_mm_max_ps(acc, neg_one), one);
+            const __m128i result = _mm_cvtps_epi32(_mm_mul_ps(acc, scale));
+
+            if (levels) {
+                peak[o / 4] = _mm_max_ps(peak[o / 4], _mm_and_ps(acc, abs_mask));
+                sum_squares[o / 4] = _mm_add_ps(sum_squares[o / 4], _mm_mul_ps(acc, acc));
+            }
+
+            if (o + 4 <= out_ch) {
+                _mm_storeu_si128((__m128i *)(dst + o), result);
+            } else {
+                _mm_store_si128((__m128i *)tmp, result);
+                for (int k = 0; k < out_ch - o; ++k)
+                    dst[o + k] = tmp[k];
+            }
+        }
+        src += in_ch;
+        dst += out_ch;
+    }
+
+    if (levels) {
+        for (int o = 0; o < padded && o < AudioLevels::max_channels; o += 4) {
+            _mm_store_ps(
+                levels->peak.data() + o,
+                _mm_max_ps(_mm_load_ps(levels->peak.data() + o), peak[o / 4]));
+            _mm_store_ps(
+                levels->sum_squares.data() + o,
+                _mm_add_ps(_mm_load_ps(levels->sum_squares.data() + o), sum_squares[o / 4]));
+        }
+    }
+
+#else
+
+    for (size_t f = 0; f < num_frames; ++f) {
+        for (int o = 0; o < out_ch; ++o) {
+            float acc = 0.0f;
+            for (int i = 0; i < in_ch; ++i) {
+                acc += src[i] * gains[i * padded + o];
+            }
+            acc    = std::clamp(acc, -1.0f, 1.0f);
+            dst[o] = SDIAudioSample(std::lrint(acc * full_scale));
+            if (levels && o < AudioLevels::max_channels) {
+                levels->peak[o] = std::max(levels->peak[o], std::fabs(acc));
+                levels->sum_squares[o] += acc * acc;
+            }
+        }
+        src += in_ch;
+        dst += out_ch;
+    }
+
+#endif
+}
+
+void AudioMeter::accumulate(
+    const AudioLevels &levels, const size_t num_frames, const int num_channels) {
+
+    // Only the audio thread writes, but take() may reset values between our
+    // load and store, hence the compare-exchange loops
+    const int n = std::min(num_channels, AudioLevels::max_channels);
+    for (int c = 0; c < n; ++c) {
+        float p = peak_[c].load(std::memory_order_relaxed);
+        while (levels.peak[c] > p &&
+               !peak_[c].compare_exchange_weak(p, levels.peak[c], std::memory_order_relaxed)) {
+        }
+        double s = sum_squares_[c].load(std::memory_order_relaxed);
+        while (!sum_squares_[c].compare_exchange_weak(
+            s, s + double(levels.sum_squares[c]), std::memory_order_relaxed)) {
+        }
+    }
+    num_channels_.store(n, std::memory_order_relaxed);
+    num_frames_.fetch_add(num_frames, std::memory_order_release);
+}
+
+size_t AudioMeter::take(AudioLevels &levels, int &num_channels) {
+
+    const size_t num_frames = num_frames_.exchange(0, std::memory_order_acquire);
+    num_channels            = num_channels_.load(std::memory_order_relaxed);
+    for (int c = 0; c < num_channels; ++c) {
+        levels.peak[c]        = peak_[c].exchange(0.0f, std::memory_order_relaxed);
+        levels.sum_squares[c] = float(sum_squares_[c].exchange(0.0, std::memory_order_relaxed));
+    }
+    return num_frames;
+}
+
+void make_crossfade_gains(float *gains, const size_t num_frames, const int num_channels) {
+
+    for (size_t f = 0; f < num_frames; ++f) {
+        const float g = float(f + 1) / float(num_frames + 1);
+        for (int c = 0; c < num_channels; ++c) {
+            *(gains++) = g;
+        }
+    }
+}
+
+void crossfade_samples(
+    SDIAudioSample *dst,
+    const SDIAudioSample *fade_out,
+    const SDIAudioSample *fade_in,
+    const float *gains,
+    const size_t num_samples) {
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // 4 samples at a time. The result of mixing two in-range values with a
+    // 0-1 gain is always in range so the conversion back can't overflow.
+    for (; i + 4 <= num_samples; i += 4) {
+
+        const __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(fade_out + i)));
+        const __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(fade_in + i)));
+        const __m128 g = _mm_loadu_ps(gains + i);
+        const __m128 r = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), g));
+        _mm_storeu_si128(
+            (__m128i *)(dst + i),
+            _mm_cvtps_epi32(_mm_min_ps(r, _mm_set1_ps(full_scale))));
+    }
+#endif
+
+    for (; i < num_samples; ++i) {
+        const double a = fade_out[i];
+        const double b = fade_in[i];
+        dst[i]         = SDIAudioSample(std::lrint(a + (b - a) * gains[i]));
+    }
+}
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
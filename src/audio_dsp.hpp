@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+/* Small set of helpers for processing the interleaved audio samples that
+pass through the plugin on their way to the Decklink card. These run on the
+Decklink driver audio thread and the xstudio audio thread so they must not
+allocate.
+*/
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    // The sample type we send over SDI (bmdAudioSampleType32bitInteger)
+    typedef int32_t SDIAudioSample;
+
+    /**
+     *  @brief Routing/downmix matrix from the channels that xstudio gives us
+     *  to the SDI embedded audio channels.
+     *
+     *  @details
+     *   gains are stored per input channel, each holding padded_out_channels
+     *   values (out_channels rounded up to a multiple of 4, padding is zero) so
+     *   that a whole column can be applied with SIMD multiply-adds.
+     */
+    struct AudioRoutingMatrix {
+
+        AudioRoutingMatrix() = default;
+        AudioRoutingMatrix(const int in, const int out);
+
+        void set_gain(const int in, const int out, const float gain) {
+            gains[in * padded_out_channels + out] = gain;
+        }
+
+        int in_channels         = {2};
+        int out_channels        = {2};
+        int padded_out_channels = {4};
+        std::vector<float> gains;
+    };
+
+    // Per channel peak and sum of squares (of normalised, -1 to 1, samples)
+    // accumulated over some number of frames
+    struct AudioLevels {
+
+        static constexpr int max_channels = 32;
+
+        void reset() {
+            peak.fill(0.0f);
+            sum_squares.fill(0.0f);
+        }
+
+        alignas(16) std::array<float, max_channels> peak        = {};
+        alignas(16) std::array<float, max_channels> sum_squares = {};
+    };
+
+    /**
+     *  @brief Lock-free accumulator for audio meter levels.
+     *
+     *  @details
+     *   The audio thread adds the levels measured for each block of samples with
+     *   accumulate(), a low rate publisher thread periodically calls take() to
+     *   read the levels so far and reset. Neither side blocks.
+     */
+    class AudioMeter {
+      public:
+        void accumulate(const AudioLevels &levels, const size_t num_frames, const int num_channels);
+
+        // Returns the number of frames that the levels were measured over
+        size_t take(AudioLevels &levels, int &num_channels);
+
+      private:
+        std::array<std::atomic<float>, AudioLevels::max_channels> peak_        = {};
+        std::array<std::atomic<double>, AudioLevels::max_channels> sum_squares_ = {};
+        std::atomic<uint64_t> num_frames_ = {0};
+        std::atomic<int> num_channels_    = {0};
+    };
+
+    // Names of the routing presets offered in the UI
+    std::vector<std::string> audio_routing_preset_names();
+
+    // Build one of the routing presets. Throws std::runtime_error if the
+    // name isn't known.
+    AudioRoutingMatrix audio_routing_preset(const std::string &name);
+
+    // Convert num_frames frames of interleaved float samples (matrix.in_channels
+    // per frame) into interleaved SDI samples (matrix.out_channels per frame),
+    // applying the routing matrix and clamping to full scale in one pass.
+    // If levels is not null the peak and sum of squares of each output
+    // channel are added to it as we go.
+    void convert_and_route_samples(
+        SDIAudioSample *dst,
+        const float *src,
+        const size_t num_frames,
+        const AudioRoutingMatrix &matrix,
+        AudioLevels *levels = nullptr);
+
+    // Build a linear ramp (0 to 1) over num_frames frames of interleaved
+    // audio, one gain value per sample, for use with crossfade_samples
+    void make_crossfade_gains(float *gains, const size_t num_frames, const int num_channels);
+
+    // dst = fade_out + (fade_in - fade_out) * gain, per sample. Any of the
+    // buffers may alias dst.
+    void crossfade_samples(
+        SDIAudioSample *dst,
+        const SDIAudioSample *fade_out,
+        const SDIAudioSample *fade_in,
+        const float *gains,
+        const size_t num_samples);
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief Single producer / single consumer ring buffer of interleaved
+     *  audio sample frames.
+     *
+     *  @details
+     *   The xstudio audio output thread writes into the buffer and the Decklink
+     *   driver audio thread reads from it. Neither side takes a lock or touches
+     *   the heap - storage is allocated once when the buffer is constructed or
+     *   re-sized (which must only happen while neither side is active).
+     *   The consumer can read directly from the ring memory via read_region()
+     *   so samples can be handed to ScheduleAudioSamples without another copy.
+     */
+    template <typename SampleType> class AudioRingBuffer {
+      public:
+        AudioRingBuffer(const size_t capacity_frames, const int num_channels) {
+            resize(capacity_frames, num_channels);
+        }
+
+        // Not thread safe, call only when no producer/consumer is running
+        void resize(const size_t capacity_frames, const int num_channels) {
+            num_channels_ = num_channels;
+            // round up to power of 2 so we can wrap indices with a mask
+            capacity_ = 1;
+            while (capacity_ < capacity_frames)
+                capacity_ <<= 1;
+            mask_ = capacity_ - 1;
+            buffer_.assign(capacity_ * num_channels_, SampleType(0));
+            read_index_  = 0;
+            write_index_ = 0;
+        }
+
+        [[nodiscard]] size_t capacity() const { return capacity_; }
+        [[nodiscard]] int num_channels() const { return num_channels_; }
+
+        // number of frames waiting to be read
+        [[nodiscard]] size_t frames_available() const {
+            return write_index_.load(std::memory_order_acquire) -
+                   read_index_.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] size_t frames_free() const { return capacity_ - frames_available(); }
+
+        // Producer side. Returns the number of frames actually written, which
+        // is less than num_frames if the ring is full.
+        size_t write(const SampleType *samples, const size_t num_frames) {
+
+            const size_t w = write_index_.load(std::memory_order_relaxed);
+            const size_t r = read_index_.load(std::memory_order_acquire);
+            const size_t n = std::min(num_frames, capacity_ - (w - r));
+
+            const size_t offset = w & mask_;
+            const size_t first  = std::min(n, capacity_ - offset);
+            memcpy(
+                buffer_.data() + offset * num_channels_,
+                samples,
+                first * num_channels_ * sizeof(SampleType));
+            if (n > first) {
+                memcpy(
+                    buffer_.data(),
+                    samples + first * num_channels_,
+                    (n - first) * num_channels_ * sizeof(SampleType));
+            }
+
+            write_index_.store(w + n, std::memory_order_release);
+            return n;
+        }
+
+        // Producer side. Returns a pointer to the next contiguous block of
+        // free frames and the number of frames in that block, so that samples
+        // can be generated straight into the ring. Call commit() when done.
+        [[nodiscard]] std::pair<SampleType *, size_t> write_region() {
+            const size_t w      = write_index_.load(std::memory_order_relaxed);
+            const size_t r      = read_index_.load(std::memory_order_acquire);
+            const size_t offset = w & mask_;
+            return std::make_pair(
+                buffer_.data() + offset * num_channels_,
+                std::min(capacity_ - (w - r), capacity_ - offset));
+        }
+
+        void commit(const size_t num_frames) {
+            write_index_.store(
+                write_index_.load(std::memory_order_relaxed) + num_frames,
+                std::memory_order_release);
+        }
+
+        // Consumer side. Returns a pointer to the next contiguous block of
+        // readable frames and the number of frames in that block. Call
+        // consume() once the frames have been used.
+        [[nodiscard]] std::pair<const SampleType *, size_t> read_region() const {
+            const size_t r      = read_index_.load(std::memory_order_relaxed);
+            const size_t w      = write_index_.load(std::memory_order_acquire);
+            const size_t offset = r & mask_;
+            return std::make_pair(
+                buffer_.data() + offset * num_channels_, std::min(w - r, capacity_ - offset));
+        }
+
+        void consume(const size_t num_frames) {
+            read_index_.store(
+                read_index_.load(std::memory_order_relaxed) + num_frames,
+                std::memory_order_release);
+        }
+
+        // Consumer side. Copy up to num_frames frames out of the ring and
+        // consume them, returns the number of frames copied.
+        size_t read(SampleType *dst, const size_t num_frames) {
+            size_t done = 0;
+            for (int i = 0; i < 2 && done < num_frames; ++i) {
+                const auto region = read_region();
+                const size_t n    = std::min(region.second, num_frames - done);
+                if (!n)
+                    break;
+                memcpy(
+                    dst + done * num_channels_,
+                    region.first,
+                    n * num_channels_ * sizeof(SampleType));
+                consume(n);
+                done += n;
+            }
+            return done;
+        }
+
+        // How many frames have been written in all, for consume_to. Can be
+        // called from any thread.
+        [[nodiscard]] size_t write_position() const {
+            return write_index_.load(std::memory_order_acquire);
+        }
+
+        // Consumer side - discard everything written before write_position
+        // returned position. Does nothing if that has already been read, or
+        // if the ring has been reset since.
+        void consume_to(const size_t position) {
+            const size_t r = read_index_.load(std::memory_order_relaxed);
+            const size_t w = write_index_.load(std::memory_order_acquire);
+            if (position - r <= w - r)
+                read_index_.store(position, std::memory_order_release);
+        }
+
+        // Consumer side - discard everything that has been written so far
+        void clear() {
+            read_index_.store(write_index_.load(std::memory_order_acquire), std::memory_order_release);
+        }
+
+      private:
+        std::vector<SampleType> buffer_;
+        size_t capacity_ = {0};
+        size_t mask_     = {0};
+        int num_channels_ = {2};
+        std::atomic<size_t> read_index_  = {0};
+        std::atomic<size_t> write_index_ = {0};
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
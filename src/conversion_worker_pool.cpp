@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "conversion_worker_pool.hpp"
+
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+ConversionWorkerPool::ConversionWorkerPool(const int n_threads) {
+
+    for (int i = 1; i < n_threads; ++i) {
+        threads_.emplace_back(&ConversionWorkerPool::worker_loop, this);
+    }
+}
+
+ConversionWorkerPool::~ConversionWorkerPool() {
+
+    {
+        std::lock_guard l(mutex_);
+        exit_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &t : threads_) {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+std::vector<std::thread::native_handle_type> ConversionWorkerPool::native_handles() {
+
+    std::vector<std::thread::native_handle_type> handles;
+    for (auto &t : threads_) {
+        handles.push_back(t.native_handle());
+    }
+    return handles;
+}
+
+void ConversionWorkerPool::run_jobs(const int n_jobs, JobFunc func, void *ctx) {
+
+    if (n_jobs <= 0)
+        return;
+
+    std::lock_guard run_lock(run_mutex_);
+
+    {
+        // a worker that woke up late for the previous run could still be
+        // looking at its jobs, so wait for it before we replace them
+        std::unique_lock lk(mutex_);
+        done_cv_.wait(lk, [=] { return active_workers_ == 0; });
+        job_func_  = func;
+        job_ctx_   = ctx;
+        n_jobs_    = n_jobs;
+        next_job_  = 0;
+        jobs_done_ = 0;
+        generation_++;
+    }
+    work_cv_.notify_all();
+
+    const int done = do_jobs(func, ctx, n_jobs);
+
+    std::unique_lock lk(mutex_);
+    jobs_done_ += done;
+    done_cv_.wait(lk, [=] { return jobs_done_ == n_jobs_ && active_workers_ == 0; });
+}
+
+int ConversionWorkerPool::do_jobs(JobFunc func, void *ctx, const int n_jobs) {
+
+    int done = 0;
+    int i;
+    while ((i = next_job_++) < n_jobs) {
+        func(ctx, i);
+        done++;
+    }
+    return done;
+}
+
+void ConversionWorkerPool::worker_loop() {
+
+    uint64_t seen_generation = 0;
+
+    std::unique_lock lk(mutex_);
+    while (true) {
+
+        work_cv_.wait(lk, [&] { return exit_ || generation_ != seen_generation; });
+        if (exit_)
+            break;
+
+        seen_generation   = generation_;
+        JobFunc func      = job_func_;
+        void *ctx         = job_ctx_;
+        const int n_jobs  = n_jobs_;
+        active_workers_++;
+        lk.unlock();
+
+        const int done = do_jobs(func, ctx, n_jobs);
+
+        lk.lock();
+        active_workers_--;
+        jobs_done_ += done;
+        if (active_workers_ == 0)
+            done_cv_.notify_all();
+    }
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief ConversionWorkerPool class. A fixed set of threads that we split
+     *  pixel conversion (and copying) of each video frame across.
+     *
+     *  @details
+     *   The threads are started once and then wait for work, rather than
+     *   spawning new threads for every frame. run() hands out jobs 0 to
+     *   n_jobs-1 to the workers (the calling thread does jobs as well) and
+     *   returns when all of them are done. Only one run() can be in progress
+     *   at a time. Nothing here allocates once the pool has been constructed,
+     *   so it is fine to call from the Decklink frame callback.
+     */
+    class ConversionWorkerPool {
+
+      public:
+        explicit ConversionWorkerPool(const int n_threads);
+        ~ConversionWorkerPool();
+
+        ConversionWorkerPool(const ConversionWorkerPool &)            = delete;
+        ConversionWorkerPool &operator=(const ConversionWorkerPool &) = delete;
+
+        // number of threads doing jobs, including the caller of run()
+        [[nodiscard]] int size() const { return int(threads_.size()) + 1; }
+
+        // the worker threads, for setting their priority and affinity
+        [[nodiscard]] std::vector<std::thread::native_handle_type> native_handles();
+
+        // Calls job(i) for each i in [0, n_jobs), in parallel, and waits
+        template <typename F> void run(const int n_jobs, F &&job) {
+            using Job = std::remove_reference_t<F>;
+            run_jobs(
+                n_jobs, [](void *ctx, const int i) { (*static_cast<Job *>(ctx))(i); }, &job);
+        }
+
+      private:
+        using JobFunc = void (*)(void *, int);
+
+        void run_jobs(const int n_jobs, JobFunc func, void *ctx);
+        int do_jobs(JobFunc func, void *ctx, const int n_jobs);
+        void worker_loop();
+
+        std::vector<std::thread> threads_;
+        std::mutex run_mutex_;
+        std::mutex mutex_;
+        std::condition_variable work_cv_;
+        std::condition_variable done_cv_;
+
+        JobFunc job_func_ = {nullptr};
+        void *job_ctx_    = {nullptr};
+        int n_jobs_       = {0};
+        std::atomic<int> next_job_ = {0};
+        int jobs_done_             = {0};
+        int active_workers_        = {0};
+        uint64_t generation_       = {0};
+        bool exit_                 = {false};
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
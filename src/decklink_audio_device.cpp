@@ -9,7 +9,12 @@ using namespace xstudio::bm_decklink_plugin_1_0;
 using namespace xstudio::global_store;
 
 DecklinkAudioOutputDevice::DecklinkAudioOutputDevice(const utility::JsonStore &prefs, DecklinkOutput * bmd_output)
-    : prefs_(prefs), bmd_output_(bmd_output) {}
+    : prefs_(prefs), bmd_output_(bmd_output) {
+    // xstudio gives us float samples in the channel layout that the audio
+    // routing expects, the DecklinkOutput converts them to 32 bit integer
+    // SDI samples and maps them onto the SDI channels
+    num_channels_ = bmd_output_->audio_device_channels();
+}
 
 DecklinkAudioOutputDevice::~DecklinkAudioOutputDevice() { 
     disconnect_from_soundcard(); 
@@ -25,8 +30,9 @@ void DecklinkAudioOutputDevice::connect_to_soundcard() {
 
 long DecklinkAudioOutputDevice::desired_samples() { 
     // this sets the minumum chunk of samples that xstudio gives us to transfer
-    // to the BMD audio buffer.
-    return 2048; 
+    // to the BMD audio buffer. It is tuned at runtime by the DecklinkOutput
+    // according to the audio buffering profile.
+    return bmd_output_->audio_chunk_samples(); 
 }
 
 long DecklinkAudioOutputDevice::latency_microseconds() {
@@ -34,6 +40,6 @@ long DecklinkAudioOutputDevice::latency_microseconds() {
 }
 
 bool DecklinkAudioOutputDevice::push_samples(const void *sample_data, const long num_samples) {
-    bmd_output_->receive_samples_from_xstudio((int16_t *)sample_data, num_samples);
+    bmd_output_->receive_samples_from_xstudio((const float *)sample_data, num_samples);
     return true;
 }
\ No newline at end of file
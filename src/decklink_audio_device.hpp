@@ -50,7 +50,7 @@ namespace bm_decklink_plugin_1_0 {
       private:
         long sample_rate_           = {48000};
         int num_channels_           = {2};
-        audio::SampleFormat sample_format_ = {audio::SampleFormat::INT16};
+        audio::SampleFormat sample_format_ = {audio::SampleFormat::FLOAT32};
         const utility::JsonStore config_;
         const utility::JsonStore prefs_;
         DecklinkOutput * bmd_output_;
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "decklink_device_discovery.hpp"
+#include "xstudio/utility/logging.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace xstudio;
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+namespace {
+
+// On Linux strings returned by the Decklink API are malloc'd and must be
+// freed by the caller
+std::string take_string(const char *str) {
+    std::string result(str ? str : "");
+    free((void *)str);
+    return result;
+}
+
+} // namespace
+
+DecklinkDeviceDiscovery::DecklinkDeviceDiscovery(std::function<void()> devices_changed)
+    : devices_changed_(std::move(devices_changed)) {}
+
+DecklinkDeviceDiscovery::~DecklinkDeviceDiscovery() {
+    for (auto &d : devices_) {
+        d.device->Release();
+    }
+}
+
+void DecklinkDeviceDiscovery::start() {
+
+    discovery_ = CreateDeckLinkDiscoveryInstance();
+    if (discovery_ == NULL) {
+        throw std::runtime_error("This plugin requires the DeckLink drivers installed. Please install the Blackmagic DeckLink drivers to use the features of this plugin.");
+    }
+
+    // DeckLinkDeviceArrived will now be called for each device already present
+    if (discovery_->InstallDeviceNotifications(this) != S_OK) {
+        discovery_->Release();
+        discovery_ = NULL;
+        throw std::runtime_error("Failed to install Decklink device notifications.");
+    }
+}
+
+void DecklinkDeviceDiscovery::stop() {
+
+    if (discovery_ != NULL) {
+        discovery_->UninstallDeviceNotifications();
+        discovery_->Release();
+        discovery_ = NULL;
+    }
+}
+
+std::vector<std::string> DecklinkDeviceDiscovery::device_names() const {
+
+    std::lock_guard l(mutex_);
+    std::vector<std::string> result;
+    for (const auto &d : devices_) {
+        result.push_back(d.name);
+    }
+    return result;
+}
+
+utility::JsonStore DecklinkDeviceDiscovery::device_info() const {
+
+    std::lock_guard l(mutex_);
+    utility::JsonStore result;
+    for (const auto &d : devices_) {
+        utility::JsonStore j;
+        j["name"] = d.name;
+        j["model_name"] = d.model_name;
+        j["persistent_id"] = d.persistent_id;
+        j["sub_device_index"] = d.sub_device_index;
+        result[d.name] = j;
+    }
+    return result;
+}
+
+IDeckLink *DecklinkDeviceDiscovery::acquire_device(const std::string &name) const {
+
+    std::lock_guard l(mutex_);
+    for (const auto &d : devices_) {
+        if (d.name == name) {
+            d.device->AddRef();
+            return d.device;
+        }
+    }
+    return nullptr;
+}
+
+bool DecklinkDeviceDiscovery::has_device(const IDeckLink *device) const {
+
+    std::lock_guard l(mutex_);
+    return std::find_if(devices_.begin(), devices_.end(), [=](const DecklinkDeviceInfo &d) {
+               return d.device == device;
+           }) != devices_.end();
+}
+
+HRESULT DecklinkDeviceDiscovery::DeckLinkDeviceArrived(IDeckLink *device) {
+
+    DecklinkDeviceInfo info;
+
+    IDeckLinkProfileAttributes *attributes = NULL;
+    if (device->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&attributes) == S_OK) {
+
+        // we're only interested in devices that can output video
+        int64_t io_support = 0;
+        if (attributes->GetInt(BMDDeckLinkVideoIOSupport, &io_support) != S_OK ||
+            !(io_support & bmdDeviceSupportsPlayback)) {
+            attributes->Release();
+            return S_OK;
+        }
+
+        // these aren't supported by all devices, in which case they stay 0
+        attributes->GetInt(BMDDeckLinkPersistentID, &info.persistent_id);
+        attributes->GetInt(BMDDeckLinkSubDeviceIndex, &info.sub_device_index);
+        attributes->Release();
+    }
+
+    const char *str = NULL;
+    if (device->GetModelName(&str) == S_OK) {
+        info.model_name = take_string(str);
+    }
+    str = NULL;
+    if (device->GetDisplayName(&str) == S_OK) {
+        info.name = take_string(str);
+    }
+    if (info.name.empty())
+        info.name = info.model_name;
+
+    device->AddRef();
+    info.device = device;
+
+    {
+        std::lock_guard l(mutex_);
+        // display names should be unique (they include an index for identical
+        // cards) but make sure, as we use them to identify the device
+        for (const auto &d : devices_) {
+            if (d.name == info.name) {
+                info.name = fmt::format("{} [{:x}]", info.name, info.persistent_id);
+                break;
+            }
+        }
+        devices_.push_back(info);
+    }
+
+    spdlog::info(
+        "Decklink device arrived: {} (model {}, persistent ID {:x}, sub-device {})",
+        info.name,
+        info.model_name,
+        info.persistent_id,
+        info.sub_device_index);
+
+    devices_changed_();
+    return S_OK;
+}
+
+HRESULT DecklinkDeviceDiscovery::DeckLinkDeviceRemoved(IDeckLink *device) {
+
+    {
+        std::lock_guard l(mutex_);
+        auto p = std::find_if(devices_.begin(), devices_.end(), [=](const DecklinkDeviceInfo &d) {
+            return d.device == device;
+        });
+        if (p == devices_.end())
+            return S_OK;
+
+        spdlog::info("Decklink device removed: {}", p->name);
+        p->device->Release();
+        devices_.erase(p);
+    }
+
+    devices_changed_();
+    return S_OK;
+}
+
+HRESULT DecklinkDeviceDiscovery::QueryInterface(REFIID /*iid*/, LPVOID *ppv) {
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+ULONG DecklinkDeviceDiscovery::AddRef() { return ++ref_count_; }
+
+ULONG DecklinkDeviceDiscovery::Release() {
+    ULONG new_ref_count = --ref_count_;
+    if (new_ref_count == 0)
+        delete this;
+    return new_ref_count;
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "extern/DeckLinkAPI.h"
+#include "xstudio/utility/json_store.hpp"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    // Description of a Decklink device (or sub-device) that can do playback
+    struct DecklinkDeviceInfo {
+
+        // unique name shown in the UI and stored in the preferences
+        std::string name;
+        std::string model_name;
+        int64_t persistent_id    = {0};
+        int64_t sub_device_index = {0};
+        IDeckLink *device        = {nullptr};
+    };
+
+    /**
+     *  @brief DecklinkDeviceDiscovery class. Keeps track of the Decklink devices
+     *  attached to the system using IDeckLinkDiscovery.
+     *
+     *  @details
+     *   The Decklink driver calls DeckLinkDeviceArrived for every device
+     *   present when notifications are installed and then again whenever a
+     *   device is plugged in (e.g. a Thunderbolt UltraStudio), and
+     *   DeckLinkDeviceRemoved when one goes away. Both are called on a driver
+     *   thread. We keep a reference to each device that can do playback and
+     *   run the devices_changed callback (on the driver thread) after any change.
+     */
+    class DecklinkDeviceDiscovery : public IDeckLinkDeviceNotificationCallback {
+
+      public:
+        DecklinkDeviceDiscovery(std::function<void()> devices_changed);
+
+        // Throws if the Decklink drivers aren't installed
+        void start();
+        void stop();
+
+        [[nodiscard]] std::vector<std::string> device_names() const;
+
+        // Device info as json, for display in the UI
+        [[nodiscard]] utility::JsonStore device_info() const;
+
+        // Returns the named device with a reference added (caller must Release
+        // it) or nullptr if there is no such device
+        IDeckLink *acquire_device(const std::string &name) const;
+
+        [[nodiscard]] bool has_device(const IDeckLink *device) const;
+
+        // IDeckLinkDeviceNotificationCallback
+        HRESULT DeckLinkDeviceArrived(IDeckLink *device) override;
+        HRESULT DeckLinkDeviceRemoved(IDeckLink *device) override;
+
+        // IUnknown
+        HRESULT QueryInterface(REFIID iid, LPVOID *ppv) override;
+        ULONG AddRef() override;
+        ULONG Release() override;
+
+      private:
+        ~DecklinkDeviceDiscovery() override;
+
+        std::function<void()> devices_changed_;
+        IDeckLinkDiscovery *discovery_ = {nullptr};
+        std::vector<DecklinkDeviceInfo> devices_;
+        mutable std::mutex mutex_;
+        std::atomic<ULONG> ref_count_ = {1};
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
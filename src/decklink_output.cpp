@@ -1,13 +1,65 @@
 #include "decklink_output.hpp"
-#include "decklink_plugin.hpp"
+#include "numa_topology.hpp"
 #include "xstudio/utility/logging.hpp"
 #include "xstudio/utility/chrono.hpp"
 #include "xstudio/enums.hpp"
 #include <iostream>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <limits>
 #include <half.h>
 
 using namespace xstudio::bm_decklink_plugin_1_0;
 
+namespace {
+
+    // the pixel formats that the plugin offers, see bmd_pixel_formats in
+    // decklink_plugin.cpp
+    const std::vector<BMDPixelFormat> offered_pixel_formats(
+        {
+            bmdFormat8BitYUV,
+            bmdFormat10BitYUV,
+            bmdFormat8BitARGB,
+            bmdFormat8BitBGRA,
+            bmdFormat10BitRGB,
+            bmdFormat12BitRGB,
+            bmdFormat12BitRGBLE,
+            bmdFormat10BitRGBX,
+            bmdFormat10BitRGBXLE
+        });
+
+    // (Re)allocates f unless it is already the given size
+    void make_intermediate_frame(RGB10BitVideoFrame *& f, const long width, const long height, const BMDFrameFlags flags)
+    {
+        if (!f || f->GetWidth() != width || f->GetHeight() != height) {
+            if (f) f->Release();
+            f = new RGB10BitVideoFrame(width, height, flags);
+        }
+    }
+
+    // local time to the millisecond, for matching our log against the
+    // facility's when sync goes wrong
+    std::string wall_clock_time()
+    {
+        const auto now = std::chrono::system_clock::now();
+        const std::time_t t = std::chrono::system_clock::to_time_t(now);
+        const int ms = int(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+        std::tm local{};
+        localtime_r(&t, &local);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+        return fmt::format("{}.{:03d}", buf, ms);
+    }
+
+    std::string reference_status_name(const BMDReferenceStatus status)
+    {
+        if (status & bmdReferenceNotSupportedByHardware) return "Not Supported";
+        return status & bmdReferenceLocked ? "Locked" : "Not Locked";
+    }
+
+}
+
 /* RGB10BitVideoFrame class */
 
 // Adapted from example provided by BMD SDK
@@ -69,36 +121,70 @@ ULONG STDMETHODCALLTYPE RGB10BitVideoFrame::Release(void)
 	return newRefValue;
 }
 
-DecklinkOutput::DecklinkOutput(BMDecklinkPlugin * decklink_xstudio_plugin)
+DecklinkOutput::DecklinkOutput(DecklinkOutputHost * decklink_xstudio_plugin)
 	: pFrameBuf(NULL), decklink_interface_(NULL), decklink_output_interface_(NULL), decklink_xstudio_plugin_(decklink_xstudio_plugin)
 {
 
-    init_decklink();
+    audio_routing_ = audio_routing_preset(audio_routing_preset_names().front());
+    pending_audio_routing_ = audio_routing_;
+    audio_input_channels_ = audio_routing_.in_channels;
+    configure_audio_buffers();
+
+    // N.B. init_decklink() is called by the plugin once it has told us which
+    // device to use
+
+    metrics_thread_ = std::thread(&DecklinkOutput::metrics_publisher_loop, this);
+    sem_init(&output_events_wake_, 0, 0);
+    output_event_thread_ = std::thread(&DecklinkOutput::output_event_loop, this);
     
 }
 
 DecklinkOutput::~DecklinkOutput()
 {
 
-	if (decklink_output_interface_ != NULL)
-	{
+    // devices may still be arriving
+    if (init_thread_.joinable()) init_thread_.join();
+
+    {
+        std::lock_guard l(metrics_mutex_);
+        exit_metrics_thread_ = true;
+    }
+    metrics_cv_.notify_one();
+    if (metrics_thread_.joinable()) metrics_thread_.join();
+
+    if (device_discovery_) {
+        // no more device arrived/removed callbacks after this
+        device_discovery_->stop();
+    }
 
+    {
+        std::lock_guard l(device_mutex_);
+        running_ = false;
+        output_enabled_ = false;
         spdlog::info("Stopping Decklink output loop.");
+        close_device(std::string());
+        mirror_config_.clear();
+        update_mirrors();
+        preview_config_ = PreviewOutputConfig();
+        update_preview();
+    }
 
-    	decklink_output_interface_->StopScheduledPlayback(0, NULL, 0);
-	    decklink_output_interface_->DisableVideoOutput();
-	    decklink_output_interface_->DisableAudioOutput();
+    // the callbacks have stopped, so nothing more will be posted
+    exit_output_event_thread_ = true;
+    sem_post(&output_events_wake_);
+    if (output_event_thread_.joinable()) output_event_thread_.join();
+    sem_destroy(&output_events_wake_);
 
-		decklink_output_interface_->Release();
-	}
-	if (decklink_interface_ != NULL)
-	{
-		decklink_interface_->Release();
-	}
-	if (output_callback_ != NULL)
-	{
-		output_callback_->Release();
-	}
+    if (device_discovery_) {
+        device_discovery_->Release();
+        device_discovery_ = nullptr;
+    }
+
+    if (profile_manager_) {
+        profile_manager_->close();
+        profile_manager_->Release();
+        profile_manager_ = nullptr;
+    }
 
     if (frame_converter_ != NULL)
 	{
@@ -110,376 +196,1588 @@ DecklinkOutput::~DecklinkOutput()
 
 void DecklinkOutput::set_preroll()
 {
-	IDeckLinkMutableVideoFrame* decklink_video_frame = NULL;
+	// Set video_preroll_frames_ frame preroll. We preroll with the last image xstudio gave us, so
+	// the output comes up on a real picture, or with black if there isn't one.
+	// Each pixel format is converted once and the same frame goes in every
+	// preroll slot, on every output that uses its pixel format. It is also
+	// our last frame, so fill_decklink_video_frame re-sends it until xstudio
+	// renders something new.
+    frames_mutex_.lock();
+    media_reader::ImageBufPtr the_frame = current_frame_;
+    frames_mutex_.unlock();
 
-	// Set 3 frame preroll
-    try {
-        for (uint32_t i=0; i < 3; i++)
-        {
+    std::lock_guard l(mutex_);
 
-            int32_t rowBytes;
-            switch (current_pix_format_) {
-                case bmdFormat12BitRGB:
-                case bmdFormat12BitRGBLE:
-                    rowBytes = (frame_width_*9)/2;
-                    break;
-                default:
-                    rowBytes = frame_width_*4;
+    try {
+        const char * error = nullptr;
+        bool intermediate_ready = false;
+        const SourceImage & source = source_image(the_frame);
+
+        std::vector<DecklinkVideoFrame *> frames;
+        for (const auto pix_fmt: output_pixel_formats_) {
+            if (DecklinkVideoFrame * frame = output_frame(pix_fmt, the_frame, source, intermediate_ready, error)) {
+                frames.push_back(frame);
             }
+        }
+        DecklinkVideoFrame * preview_frame = preview_.running ? make_preview_frame(the_frame, source) : nullptr;
 
-            // Flip frame vertical, because OpenGL rendering starts from left bottom corner
-            if (decklink_output_interface_->CreateVideoFrame(frame_width_, frame_height_, rowBytes, current_pix_format_, bmdFrameFlagFlipVertical, &decklink_video_frame) != S_OK)
-                throw std::runtime_error("Failed on CreateVideoFrame");
-
-            if (decklink_output_interface_->ScheduleVideoFrame(decklink_video_frame, (uiTotalFrames * frame_duration_), frame_duration_, frame_timescale_) != S_OK)
-                throw std::runtime_error("Failed on CreateVideoFrame");
-
-            /* The local reference to the IDeckLinkVideoFrame is released here, as the ownership has now been passed to
-            *  the DeckLinkAPI via ScheduleVideoFrame.
-            *
-            * After the API has finished with the frame, it is returned to the application via ScheduledFrameCompleted.
-            * In ScheduledFrameCompleted, this application updates the video frame and passes it to ScheduleVideoFrame,
-            * returning ownership to the DeckLink API.
-            */
-            decklink_video_frame->Release();
-            decklink_video_frame = NULL;
-
+        for (uint32_t i=0; i < video_preroll_frames_ && !error; i++)
+        {
+            for (auto frame: frames) {
+                if (!schedule_video_frame(frame))
+                    error = "Failed to schedule preroll frame.";
+            }
+            if (preview_frame && preview_.running) schedule_preview_frame(preview_frame);
             uiTotalFrames++;
         }
+
+        /* ScheduleVideoFrame adds its own reference to the frame for
+        *  each output, so we release ours. When all the outputs have
+        *  finished with the frame it goes back to the pool.
+        */
+        for (auto frame: frames) frame->Release();
+        if (preview_frame) preview_frame->Release();
+
+        if (error) throw std::runtime_error(error);
+
     } catch (std::exception & e) {
+        report_error(e.what());
+    }
+}
 
-        if (decklink_video_frame)
-        {
-            decklink_video_frame->Release();
-            decklink_video_frame = NULL;
+bool DecklinkOutput::schedule_video_frame(DecklinkVideoFrame * frame)
+{
+    const BMDPixelFormat pix_fmt = frame->GetPixelFormat();
+    bool result = true;
+    if (pix_fmt == current_pix_format_) {
+        result = decklink_output_interface_->ScheduleVideoFrame(frame, (uiTotalFrames * frame_duration_), frame_duration_, frame_timescale_) == S_OK;
+    }
+
+    for (size_t i = 0; i < mirrors_.size(); ++i) {
+        auto & m = mirrors_[i];
+        if (!m.running || m.pixel_format != pix_fmt) continue;
+        // frame locked outputs share the main output's stream time so that
+        // they all show the same frame on the same refresh
+        if (m.frame_locked) m.frames_scheduled = uiTotalFrames;
+        if (m.output->ScheduleVideoFrame(frame, (m.frames_scheduled * frame_duration_), frame_duration_, frame_timescale_) != S_OK) {
+            // drop this output rather than stopping everything
+            post_output_event(OutputEvent::MirrorScheduleFailed, int(i));
+            m.running = false;
+            continue;
         }
-        report_error(e.what());
+        m.frames_scheduled++;
     }
+    return result;
 }
 
-bool DecklinkOutput::init_decklink()
+void DecklinkOutput::make_frame_pools()
 {
-	bool bSuccess = false;
+    // One pool of frames per pixel format in use. Pools are kept between
+    // start/stop if the frame size and pixel format haven't changed.
+    // This is done before the mirrors are started, so we go by the format
+    // each one asks for.
+    output_pixel_formats_ = {current_pix_format_};
+    for (const auto & m: mirrors_) {
+        const BMDPixelFormat pix_fmt = m.requested_pixel_format ? m.requested_pixel_format : current_pix_format_;
+        if (std::find(output_pixel_formats_.begin(), output_pixel_formats_.end(), pix_fmt) == output_pixel_formats_.end()) {
+            output_pixel_formats_.push_back(pix_fmt);
+        }
+    }
 
-    IDeckLinkIterator* decklink_iterator = NULL;
+    // New frames are zeroed by our conversion threads so that their memory
+    // is local to the threads that are going to be writing into it
+    auto first_touch = [this](uint8_t * buffer, const size_t size) {
+        pixel_swizzler_.clear(buffer, size);
+    };
+
+    // frames on another NUMA node (the card or the preference changed)
+    // are no use to us, they go when the card has finished with them
+    const bool same_node = frame_pools_numa_node_ == numa_node_;
+    auto reusable = [this, same_node](const std::shared_ptr<VideoFramePool> & pool) {
+        return same_node && pool->width() == long(frame_width_) && pool->height() == long(frame_height_);
+    };
+
+    // Pools that we can't keep hand their frame buffers on to the new ones,
+    // so after a change of raster we only allocate if the new frames are
+    // bigger
+    std::vector<std::shared_ptr<VideoFramePool>> spare_pools;
+    for (const auto & p: frame_pools_) {
+        if (same_node && (!reusable(p.second) || std::find(output_pixel_formats_.begin(), output_pixel_formats_.end(), p.first) == output_pixel_formats_.end())) {
+            spare_pools.push_back(p.second);
+        }
+    }
 
-    try {
+    std::map<BMDPixelFormat, std::shared_ptr<VideoFramePool>> pools;
+    for (const auto pix_fmt: output_pixel_formats_) {
+        auto p = frame_pools_.find(pix_fmt);
+        if (p != frame_pools_.end() && reusable(p->second)) {
+            pools[pix_fmt] = p->second;
+        } else {
+            // Flip frame vertical, because OpenGL rendering starts from left bottom corner
+            pools[pix_fmt] = VideoFramePool::create(frame_width_, frame_height_, pix_fmt, bmdFrameFlagFlipVertical, video_frame_pool_size_, first_touch, spare_pools);
+        }
+    }
+    frame_pools_ = pools;
+    frame_pools_numa_node_ = numa_node_;
+
+    // so that the frame callback doesn't allocate these on the first frame
+    for (const auto pix_fmt: output_pixel_formats_) last_frames_.emplace(pix_fmt, nullptr);
+    if (!same_node) {
+        if (intermediate_frame_) intermediate_frame_->Release();
+        intermediate_frame_ = nullptr;
+    }
+    make_intermediate_frame(intermediate_frame_, frame_width_, frame_height_, bmdFrameFlagFlipVertical);
+}
 
-        decklink_iterator = CreateDeckLinkIteratorInstance();
-        if (decklink_iterator == NULL)
-        {
-            throw std::runtime_error("This plugin requires the DeckLink drivers installed. Please install the Blackmagic DeckLink drivers to use the features of this plugin.");
+void DecklinkOutput::warm_up()
+{
+    // Called by start_sdi_output with mutex_ held, before playback starts.
+    // Otherwise the first few frames are late: the conversion threads are
+    // asleep, the conversion code and tables aren't in cache and recycled
+    // frame buffers may have been paged out.
+    conversion_workers_.run(conversion_workers_.size(), [](const int) {});
+
+    // what we convert from doesn't matter, only that it's big enough.
+    // geometry_adapter_ was configured for this raster by start_sdi_output.
+    uint8_t * src = geometry_adapter_.buffer();
+    const size_t src_size = geometry_adapter_.capacity();
+    if (!src || src_size < size_t(frame_width_)*size_t(frame_height_)*8) return;
+
+    for (const auto pix_fmt: output_pixel_formats_) {
+
+        // every frame in the pool
+        std::vector<DecklinkVideoFrame *> frames;
+        while (DecklinkVideoFrame * f = frame_pools_[pix_fmt]->try_acquire()) frames.push_back(f);
+
+        // and each conversion into this format that xstudio's images might
+        // need
+        if (!frames.empty()) {
+            for (const int xstudio_pixel_format: {int(ui::viewport::RGBA_16), int(ui::viewport::RGBA_10_10_10_2)}) {
+                bool intermediate_ready = false;
+                convert_video_frame(src, src_size, xstudio_pixel_format, frames[0], intermediate_frame_, intermediate_ready);
+            }
         }
 
-        if (decklink_iterator->Next(&decklink_interface_) != S_OK)
-        {
-            throw std::runtime_error("This plugin requires a DeckLink device. You will not be able to use the features of this plugin until a DeckLink device is installed.");
+        // the pool hands out frames as they are, so they go back black
+        for (auto f: frames) {
+            pixel_swizzler_.clear(f->bytes(), f->size());
+            f->Release();
         }
-        
-        if (decklink_interface_->QueryInterface(IID_IDeckLinkOutput, (void**)&decklink_output_interface_) != S_OK) {
-           throw std::runtime_error("QueryInterface failed.");
+    }
+
+    if (preview_.running) {
+        std::vector<DecklinkVideoFrame *> frames;
+        while (DecklinkVideoFrame * f = preview_.frame_pool->try_acquire()) frames.push_back(f);
+        const size_t scaled_pixels = downscaler_.width()*downscaler_.height();
+        if (!frames.empty()) {
+            bool intermediate_ready = false;
+            downscaler_.downscale_16bitRGBA(preview_.scaled_image.data(), src);
+            convert_video_frame(preview_.scaled_image.data(), scaled_pixels*8, ui::viewport::RGBA_16, frames[0], preview_.intermediate_frame, intermediate_ready);
+            intermediate_ready = false;
+            downscaler_.downscale_10bitRGB(preview_.scaled_image.data(), src);
+            convert_video_frame(preview_.scaled_image.data(), scaled_pixels*4, ui::viewport::RGBA_10_10_10_2, frames[0], preview_.intermediate_frame, intermediate_ready);
         }
-        
-        output_callback_ = new AVOutputCallback(this);
-        if (output_callback_ == NULL)
-            throw std::runtime_error("Failed to create Video Output Callback.");
-        
-        if (decklink_output_interface_->SetScheduledFrameCompletionCallback(output_callback_) != S_OK)
-            throw std::runtime_error("SetScheduledFrameCompletionCallback failed.");
-        
-        if (decklink_output_interface_->SetAudioCallback(output_callback_) != S_OK)
-            throw std::runtime_error("SetAudioCallback failed.");
+        for (auto f: frames) {
+            pixel_swizzler_.clear(f->bytes(), f->size());
+            f->Release();
+        }
+    }
+}
 
-        bSuccess = true;
+void DecklinkOutput::release_last_frames()
+{
+    // called with mutex_ held. The entries stay in the map, as the frame
+    // callback only looks them up.
+    for (auto & p: last_frames_) {
+        if (p.second) p.second->Release();
+        p.second = nullptr;
+    }
+}
 
-        query_display_modes();
+bool DecklinkOutput::init_decklink()
+{
+    // Loading the driver library and finding the devices can take a while
+    // (or a long while, when the driver isn't installed properly) so it
+    // happens in the background and we report progress as we go. The plugin
+    // fills in its settings as the reports come in.
+    report_status("Loading Decklink driver.", false);
+    init_thread_ = std::thread(&DecklinkOutput::initialise_driver, this);
+    return true;
+}
 
-    } catch (std::exception & e) {
+void DecklinkOutput::initialise_driver()
+{
+    try {
 
-        report_error(e.what());
+        // the first call into the API loads the driver library
+        IDeckLinkVideoConversion * frame_converter = CreateVideoConversionInstance();
+        if (!frame_converter) {
+            throw std::runtime_error("This plugin requires the DeckLink drivers installed. Please install the Blackmagic DeckLink drivers to use the features of this plugin.");
+        }
 
-        if (decklink_output_interface_ != NULL)
         {
-            decklink_output_interface_->Release();
-            decklink_output_interface_ = NULL;
+            std::lock_guard l(device_mutex_);
+            frame_converter_ = frame_converter;
+            profile_manager_ = new DecklinkProfileManager(
+                [this](const bool streams_will_stop) { profile_changing(streams_will_stop); },
+                [this]() { profile_activated(); });
         }
-        if (decklink_interface_ != NULL)
+
+        report_status("Looking for Decklink devices.", false);
+
+        // We don't open a device here. The driver calls us back (on its own
+        // thread) with every device that is present and then again whenever a
+        // device is plugged in or removed, and we open the selected device as
+        // soon as it turns up. Those callbacks take device_mutex_, so we
+        // mustn't hold it while we start discovery.
+        DecklinkDeviceDiscovery * discovery = new DecklinkDeviceDiscovery([this]() { devices_changed(); });
         {
-            decklink_interface_->Release();
-            decklink_interface_ = NULL;
+            std::lock_guard l(device_mutex_);
+            device_discovery_ = discovery;
         }
-        if (output_callback_ != NULL)
+        discovery->start();
+
         {
-            output_callback_->Release();
-            output_callback_ = NULL;
+            // The devices that were already present have been reported now,
+            // so the plugin can auto start. If none of them was the one we
+            // want we keep waiting for it.
+            std::lock_guard l(device_mutex_);
+            discovery_complete_ = true;
+            if (!decklink_interface_) open_selected_device();
+            report_devices();
         }
 
-        if (decklink_iterator != NULL)
-        {
-            decklink_iterator->Release();
-            decklink_iterator = NULL;
+    } catch (std::exception & e) {
+
+        report_error(e.what());
+
+        std::lock_guard l(device_mutex_);
+        if (device_discovery_) {
+            device_discovery_->Release();
+            device_discovery_ = nullptr;
         }
 
     }
+}
 
-    frame_converter_ = CreateVideoConversionInstance();
-	
-	return bSuccess;
+DecklinkDeviceDiscovery * DecklinkOutput::init_without_driver(IDeckLinkVideoConversion * frame_converter)
+{
+    std::lock_guard l(device_mutex_);
+    frame_converter->AddRef();
+    frame_converter_ = frame_converter;
+    device_discovery_ = new DecklinkDeviceDiscovery([this]() { devices_changed(); });
+    discovery_complete_ = true;
+    report_devices();
+    return device_discovery_;
 }
 
-void DecklinkOutput::query_display_modes() {
+void DecklinkOutput::set_device(const std::string & device_name)
+{
+    {
+        std::lock_guard l(device_mutex_);
+        selected_device_name_ = device_name;
 
-    IDeckLinkDisplayModeIterator*		display_mode_iterator = NULL;
-    IDeckLinkDisplayMode*				display_mode = NULL;
+        if (!device_discovery_) return;
 
-    try {
-        
-        // Get first avaliable video mode for Output
-        if (decklink_output_interface_->GetDisplayModeIterator(&display_mode_iterator) == S_OK)
-        {
-            while (display_mode_iterator->Next(&display_mode) == S_OK) {
-                char *buf = new char [4096];
-                memset(buf,0,4096);
-                display_mode->GetName((const char **)&buf);
-                display_mode->GetFrameRate(&frame_duration_, &frame_timescale_);
-
-                // only names with 'i' in are interalaced as far as I can tell                
-                const bool interlaced = std::string(buf).find("i") != std::string::npos;
-
-                // I've decided that support for interlaced modes is not useful!
-                if (interlaced) continue;
-
-                const std::string resolution_string = fmt::format("{} x {}", display_mode->GetWidth(), display_mode->GetHeight());
-                std::string refresh_rate = fmt::format("{:.3f}", double(frame_timescale_)/double(frame_duration_));
-                // erase all but the last trailing zero
-                while (refresh_rate.back() == '0' && refresh_rate.rfind(".0") != (refresh_rate.size()-2)) {
-                    refresh_rate.pop_back();
-                }
+        if (!current_device_name_.empty() &&
+            (current_device_name_ == device_name || device_name == first_available_device)) {
+            // already using it
+            return;
+        }
+
+        close_device("SDI Output stopped to switch Decklink device.");
+        open_selected_device();
+        update_mirrors();
+        update_preview();
+        report_devices();
+    }
+    apply_device_profile();
+}
 
-                refresh_rate_per_output_resolution_[resolution_string].push_back(refresh_rate);
-                display_modes_[std::make_pair(resolution_string, refresh_rate)] = display_mode->GetDisplayMode();
+void DecklinkOutput::devices_changed()
+{
+    // called from a Decklink driver thread when a device arrives or goes away
+    {
+        std::lock_guard l(device_mutex_);
 
-            }
+        if (decklink_interface_ && !device_discovery_->has_device(decklink_interface_)) {
+            close_device(fmt::format("Decklink device {} was disconnected.", current_device_name_));
         }
-    } catch (std::exception & e) {
 
-        report_error(e.what());
-        
-    }        
-   
-    if (display_mode)
+        if (!decklink_interface_) {
+            open_selected_device();
+        }
+
+        update_mirrors();
+        update_preview();
+        report_devices();
+    }
+    apply_device_profile();
+}
+
+void DecklinkOutput::set_device_profile(const std::string & profile_name)
+{
     {
-        display_mode->Release();
-        display_mode = NULL;
+        std::lock_guard l(device_mutex_);
+        requested_profile_ = profile_name;
     }
+    apply_device_profile();
+}
 
-    if (display_mode_iterator)
+void DecklinkOutput::apply_device_profile()
+{
+    // N.B. called without device_mutex_ held, because while the profile is
+    // switched the driver calls profile_changing and profile_activated on
+    // its own thread and they need the lock.
+    IDeckLinkProfile * profile = nullptr;
+    std::string profile_name;
     {
-        display_mode_iterator->Release();
-        display_mode_iterator = NULL;
-    }        
+        std::lock_guard l(device_mutex_);
+        if (!profile_manager_ || !decklink_interface_ || requested_profile_ == unchanged_profile) return;
+        profile = profile_manager_->acquire_inactive_profile(requested_profile_);
+        profile_name = requested_profile_;
+    }
+    if (!profile) return;
 
+    spdlog::info("Activating Decklink profile {}", profile_name);
+    const HRESULT result = profile->SetActive();
+    profile->Release();
 
+    if (result != S_OK) {
+        report_error(fmt::format("Failed to activate Decklink profile {}.", profile_name));
+    }
 }
 
-std::vector<std::string> DecklinkOutput::get_available_refresh_rates(const std::string & output_resolution) const
+void DecklinkOutput::profile_changing(const bool streams_will_stop)
 {
-    auto p = refresh_rate_per_output_resolution_.find(output_resolution);
-    if (p != refresh_rate_per_output_resolution_.end()) {
-        return p->second;
+    // Called by the driver before the device switches profile. If our
+    // streams are going to be stopped anyway we stop cleanly now, and start
+    // again in profile_activated.
+    std::lock_guard l(device_mutex_);
+    if (streams_will_stop && (running_ || output_enabled_)) {
+        restart_after_profile_change_ = true;
+        stop_sdi_output();
+        report_status("SDI Output stopped for Decklink profile change.", false);
     }
-    return std::vector<std::string>({"Bad Resolution"});
 }
 
-void DecklinkOutput::set_display_mode(
-    const std::string & resolution,
-    const std::string  &refresh_rate,
-    const BMDPixelFormat pix_format) 
+void DecklinkOutput::profile_activated()
 {
+    // The new profile can change which display modes the device supports
+    std::lock_guard l(device_mutex_);
+    if (!decklink_interface_) return;
 
-    auto p = display_modes_.find(std::make_pair(resolution, refresh_rate));
-    if (p == display_modes_.end()) {
-        throw std::runtime_error(fmt::format("Failed to find a display mode for {} @ {}", resolution, refresh_rate));
+    query_display_modes();
+    report_devices();
+
+    if (restart_after_profile_change_) {
+        restart_after_profile_change_ = false;
+        if (display_mode_index_.find(requested_display_mode_)) {
+            start_sdi_output();
+        } else {
+            report_error(fmt::format("Display mode {} is not available in the new Decklink profile.", display_mode_name_));
+        }
     }
-    current_pix_format_ = pix_format;
-    current_display_mode_ = p->second;
 }
 
-
-bool DecklinkOutput::start_sdi_output()
+void DecklinkOutput::open_selected_device()
 {
+    const auto names = device_discovery_->device_names();
+    std::string name = selected_device_name_;
+    if (name == first_available_device) {
+        if (names.empty()) {
+            report_error("No Decklink devices found. You will not be able to use the features of this plugin until a DeckLink device is installed.");
+            return;
+        }
+        name = names.front();
+    }
 
-	bool								bSuccess = false;
+    // if the selected device isn't here (yet) we wait for it to arrive
+    IDeckLink * device = device_discovery_->acquire_device(name);
+    if (!device) {
+        report_error(fmt::format("Decklink device {} not found.", name));
+        return;
+    }
 
-    IDeckLinkDisplayModeIterator*		display_mode_iterator = NULL;
-    IDeckLinkDisplayMode*				display_mode = NULL;
+    if (open_device(device, name)) {
+        report_status(fmt::format("Using {}.", name), false);
+    }
+    device->Release();
+}
 
-    try {
-        
-        bool mode_matched = false;
-        // Get first avaliable video mode for Output
-        if (decklink_output_interface_->GetDisplayModeIterator(&display_mode_iterator) == S_OK)
-        {
-            while (display_mode_iterator->Next(&display_mode) == S_OK) {
-                if (display_mode->GetDisplayMode() == current_display_mode_) {
-
-                    mode_matched = true;
-                    {
-                        // get the name of the display mode, for display only
-                        char *buf = new char [4096];
-                        memset(buf,0,4096);
-                        display_mode->GetName((const char **)&buf);
-                        display_mode_name_ = buf;
-                    }
-
-                    report_status(fmt::format("Starting Decklink output loop in mode {}.", display_mode_name_), false);
-
-                    frame_width_ = display_mode->GetWidth();
-                    frame_height_ = display_mode->GetHeight();
-                    display_mode->GetFrameRate(&frame_duration_, &frame_timescale_);
-                    
-                    uiFPS = ((frame_timescale_ + (frame_duration_-1))  /  frame_duration_);
-                    
-                    if (decklink_output_interface_->EnableVideoOutput(display_mode->GetDisplayMode(), bmdVideoOutputFlagDefault) != S_OK) {
-                        throw std::runtime_error("EnableVideoOutput call failed.");
-                    }
+bool DecklinkOutput::open_device(IDeckLink * device, const std::string & device_name)
+{
+	bool bSuccess = false;
 
+    try {
 
-                }
-            }
-        }
+        decklink_interface_ = device;
+        decklink_interface_->AddRef();
 
-        if (!mode_matched) {
-            throw std::runtime_error("Failed to find display mode.");
+        if (decklink_interface_->QueryInterface(IID_IDeckLinkOutput, (void**)&decklink_output_interface_) != S_OK) {
+           throw std::runtime_error("QueryInterface failed.");
         }
-
-        uiTotalFrames = 0;
         
-        // Set the audio output mode
-        if (decklink_output_interface_->EnableAudioOutput(
-            bmdAudioSampleRate48kHz,
-            16, // channel bitdepth
-            2, // num channels
-            bmdAudioOutputStreamTimestamped) != S_OK) 
-        {
-            throw std::runtime_error("Failed to enable audio output.");
-        }
+        output_callback_ = new AVOutputCallback(this);
+        if (output_callback_ == NULL)
+            throw std::runtime_error("Failed to create Video Output Callback.");
+        
+        if (decklink_output_interface_->SetScheduledFrameCompletionCallback(output_callback_) != S_OK)
+            throw std::runtime_error("SetScheduledFrameCompletionCallback failed.");
+        
+        if (decklink_output_interface_->SetAudioCallback(output_callback_) != S_OK)
+            throw std::runtime_error("SetAudioCallback failed.");
 
+        current_device_name_ = device_name;
+        bSuccess = true;
 
-        set_preroll();
+        query_display_modes();
 
-        samples_delivered_ = 0;
+        // keep our conversion threads and frames next to the card
+        device_numa_node_ = decklink_numa_node(decklink_interface_);
+        if (device_numa_node_ >= 0) spdlog::info("Decklink device {} is on NUMA node {}.", device_name, device_numa_node_);
+        place_conversion_threads();
 
-        if (decklink_output_interface_->BeginAudioPreroll() != S_OK) {
-            throw std::runtime_error("Failed to pre-roll audio output.");
-        }
+        apply_reference_timing_offset();
+        pcie_max_link_width_ = decklink_pcie_max_link_width(decklink_interface_);
 
-        decklink_output_interface_->StartScheduledPlayback(0, 100, 1.0);
-        
-        bSuccess = true;
+        // not all devices have profiles to choose from
+        if (profile_manager_) profile_manager_->open(decklink_interface_);
 
     } catch (std::exception & e) {
 
-
         report_error(e.what());
+        close_device(std::string());
 
     }
 
-    if (display_mode)
-    {
-        display_mode->Release();
-        display_mode = NULL;
-    }
-
-    if (display_mode_iterator)
-    {
-        display_mode_iterator->Release();
-        display_mode_iterator = NULL;
-    }        
-
 	return bSuccess;
 }
 
-bool DecklinkOutput::stop_sdi_output(const std::string &error_message)
+void DecklinkOutput::close_device(const std::string & reason)
 {
+    if (running_ || output_enabled_) stop_sdi_output(reason);
+    if (profile_manager_) profile_manager_->close();
+    restart_after_profile_change_ = false;
 
-    running_ = false;
-    decklink_xstudio_plugin_->stop();
+	if (decklink_output_interface_ != NULL)
+	{
+    	decklink_output_interface_->StopScheduledPlayback(0, NULL, 0);
+	    decklink_output_interface_->DisableVideoOutput();
+	    decklink_output_interface_->DisableAudioOutput();
+        decklink_output_interface_->SetScheduledFrameCompletionCallback(NULL);
+        decklink_output_interface_->SetAudioCallback(NULL);
+		decklink_output_interface_->Release();
+        decklink_output_interface_ = NULL;
+	}
+	if (decklink_interface_ != NULL)
+	{
+		decklink_interface_->Release();
+        decklink_interface_ = NULL;
+	}
+	if (output_callback_ != NULL)
+	{
+		output_callback_->Release();
+        output_callback_ = NULL;
+	}
 
-    if (!error_message.empty()) {
-        report_error(error_message);
-    } else {
-        report_status("SDI Output Paused.", false);
+    display_mode_index_.clear();
+    current_device_name_.clear();
+}
+
+void DecklinkOutput::set_mirror_outputs(const std::vector<MirrorOutputConfig> & mirrors)
+{
+    std::lock_guard l(device_mutex_);
+    mirror_config_ = mirrors;
+    // mirrors that are added while we are running start with the next
+    // start_sdi_output, ones that are removed stop now
+    update_mirrors();
+}
+
+void DecklinkOutput::update_mirrors()
+{
+    // called with device_mutex_ held
+    if (!device_discovery_) return;
+
+    std::lock_guard l(mutex_);
+
+    // close mirrors that aren't wanted any more, whose device has gone or
+    // that are now the main output
+    for (auto m = mirrors_.begin(); m != mirrors_.end();) {
+        const bool wanted = std::find_if(mirror_config_.begin(), mirror_config_.end(), [&](const MirrorOutputConfig & c) {
+            return c.device_name == m->device_name;
+        }) != mirror_config_.end();
+        if (!wanted || m->device_name == current_device_name_ || !device_discovery_->has_device(m->device)) {
+            close_mirror(*m);
+            m = mirrors_.erase(m);
+        } else {
+            m++;
+        }
     }
 
-    spdlog::info("Stopping Decklink output loop. {}", error_message);
+    for (const auto & c: mirror_config_) {
 
-	decklink_output_interface_->StopScheduledPlayback(0, NULL, 0);
-	decklink_output_interface_->DisableVideoOutput();
-	decklink_output_interface_->DisableAudioOutput();
+        if (c.device_name == current_device_name_) continue;
+        if (std::find_if(mirrors_.begin(), mirrors_.end(), [&](const MirrorOutput & m) {
+            return m.device_name == c.device_name;
+        }) != mirrors_.end()) continue;
 
-	mutex_.lock();
-	
-	free(pFrameBuf);
-	pFrameBuf = NULL;
+        IDeckLink * device = device_discovery_->acquire_device(c.device_name);
+        if (!device) continue;
+
+        MirrorOutput m;
+        m.device_name = c.device_name;
+        m.requested_pixel_format = c.pixel_format;
+        m.device = device;
+        if (device->QueryInterface(IID_IDeckLinkOutput, (void**)&m.output) != S_OK) {
+            spdlog::warn("Failed to open Decklink device {} for output.", c.device_name);
+            device->Release();
+            continue;
+        }
+        mirrors_.push_back(m);
+    }
+}
+
+void DecklinkOutput::start_mirrors()
+{
+    // called with mutex_ held, after the main output has been enabled
+    for (auto & m: mirrors_) {
+
+        m.pixel_format = m.requested_pixel_format ? m.requested_pixel_format : current_pix_format_;
+        m.frames_scheduled = 0;
+
+        bool supported = false;
+        if (m.output->DoesSupportVideoMode(bmdVideoConnectionUnspecified, current_display_mode_, m.pixel_format, bmdNoVideoOutputConversion, bmdSupportedVideoModeDefault, NULL, &supported) != S_OK || !supported) {
+            spdlog::warn("Decklink device {} does not support mode {} in the requested pixel format.", m.device_name, display_mode_name_);
+            continue;
+        }
+
+        m.frame_locked = frame_locked_ && join_playback_group(m.device, true);
+        if (frame_locked_ && !m.frame_locked) {
+            spdlog::warn("Decklink device {} can't be frame locked to the main output.", m.device_name);
+        }
+
+        const BMDVideoOutputFlags output_flags = m.frame_locked ? bmdVideoOutputSynchronizeToPlaybackGroup : bmdVideoOutputFlagDefault;
+
+        if (m.output->EnableVideoOutput(current_display_mode_, output_flags) != S_OK) {
+            spdlog::warn("EnableVideoOutput failed on Decklink device {}.", m.device_name);
+            if (m.frame_locked) join_playback_group(m.device, false);
+            m.frame_locked = false;
+            continue;
+        }
+        m.running = true;
+    }
+}
+
+void DecklinkOutput::configure_sdi_link()
+{
+    // Called before EnableVideoOutput on the main output. With quad link the
+    // card sends a quarter of each frame down each of four SDI links, which
+    // is how 8K (and 4K over 3G links) gets out of the card.
+    const SDILinkConfiguration link = sdi_link_configuration_;
+    const bool quad_link = link == SDILinkConfiguration::QuadLinkSquareDivision || link == SDILinkConfiguration::QuadLinkSampleInterleave;
+
+    IDeckLinkConfiguration * config = NULL;
+    if (decklink_interface_->QueryInterface(IID_IDeckLinkConfiguration, (void**)&config) != S_OK) {
+        if (link == SDILinkConfiguration::Auto) return;
+        throw std::runtime_error("Failed to get Decklink configuration interface.");
+    }
+
+    ConversionSplit split = ConversionSplit::Strips;
+
+    try {
+
+        if (link == SDILinkConfiguration::Auto) {
+
+            // leave the card as it is but split up our conversion to match
+            int64_t link_config = 0;
+            bool square_division = false;
+            if (config->GetInt(bmdDeckLinkConfigSDIOutputLinkConfiguration, &link_config) == S_OK && link_config == bmdLinkConfigurationQuadLink) {
+                config->GetFlag(bmdDeckLinkConfigQuadLinkSDIVideoOutputSquareDivisionSplit, &square_division);
+                split = square_division ? ConversionSplit::Quadrants : ConversionSplit::SampleInterleave;
+            }
+
+        } else {
+
+            if (quad_link) {
+                bool supported = false;
+                IDeckLinkProfileAttributes * attributes = NULL;
+                if (decklink_interface_->QueryInterface(IID_IDeckLinkProfileAttributes, (void**)&attributes) == S_OK) {
+                    if (attributes->GetFlag(BMDDeckLinkSupportsQuadLinkSDI, &supported) != S_OK) supported = false;
+                    attributes->Release();
+                }
+                if (!supported) {
+                    throw std::runtime_error(fmt::format("Decklink device {} does not support quad link SDI.", current_device_name_));
+                }
+            }
+
+            const int64_t link_config = quad_link ? bmdLinkConfigurationQuadLink :
+                link == SDILinkConfiguration::DualLink ? bmdLinkConfigurationDualLink : bmdLinkConfigurationSingleLink;
+            HRESULT result = config->SetInt(bmdDeckLinkConfigSDIOutputLinkConfiguration, link_config);
+            if (result == S_OK && quad_link) {
+                result = config->SetFlag(bmdDeckLinkConfigQuadLinkSDIVideoOutputSquareDivisionSplit, link == SDILinkConfiguration::QuadLinkSquareDivision);
+            }
+            if (result != S_OK) {
+                throw std::runtime_error("Failed to set the SDI link configuration.");
+            }
+
+            // check that the mode can go out over the links we've asked for
+            const BMDSupportedVideoModeFlags mode_flags = quad_link ? bmdSupportedVideoModeSDIQuadLink :
+                link == SDILinkConfiguration::DualLink ? bmdSupportedVideoModeSDIDualLink : bmdSupportedVideoModeSDISingleLink;
+            bool supported = false;
+            if (decklink_output_interface_->DoesSupportVideoMode(bmdVideoConnectionSDI, current_display_mode_, current_pix_format_, bmdNoVideoOutputConversion, mode_flags, NULL, &supported) != S_OK || !supported) {
+                throw std::runtime_error(fmt::format("Mode {} is not supported with the selected SDI link configuration.", display_mode_name_));
+            }
+
+            if (link == SDILinkConfiguration::QuadLinkSquareDivision) split = ConversionSplit::Quadrants;
+            else if (link == SDILinkConfiguration::QuadLinkSampleInterleave) split = ConversionSplit::SampleInterleave;
+        }
+
+    } catch (...) {
+        config->Release();
+        throw;
+    }
+    config->Release();
+
+    std::lock_guard l(mutex_);
+    pixel_swizzler_.set_split(split);
+}
+
+bool DecklinkOutput::join_playback_group(IDeckLink * device, const bool join)
+{
+    // Outputs in the same playback group start together when
+    // StartScheduledPlayback is called on any one of them and then stay
+    // locked to each other, frame for frame
+    bool supported = false;
+    IDeckLinkProfileAttributes * attributes = NULL;
+    if (device->QueryInterface(IID_IDeckLinkProfileAttributes, (void**)&attributes) == S_OK) {
+        if (attributes->GetFlag(BMDDeckLinkSupportsSynchronizeToPlaybackGroup, &supported) != S_OK) supported = false;
+        attributes->Release();
+    }
+    if (!supported) return false;
+
+    bool result = false;
+    IDeckLinkConfiguration * config = NULL;
+    if (device->QueryInterface(IID_IDeckLinkConfiguration, (void**)&config) == S_OK) {
+        result = config->SetInt(bmdDeckLinkConfigPlaybackGroup, join ? playback_group_id_ : 0) == S_OK;
+        config->Release();
+    }
+    return result && join;
+}
+
+void DecklinkOutput::stop_mirrors()
+{
+    // called with mutex_ held
+    for (auto & m: mirrors_) {
+        if (m.running) {
+            m.output->StopScheduledPlayback(0, NULL, 0);
+            m.output->DisableVideoOutput();
+            m.running = false;
+        }
+        if (m.frame_locked) {
+            join_playback_group(m.device, false);
+            m.frame_locked = false;
+        }
+    }
+}
+
+void DecklinkOutput::close_mirror(MirrorOutput & m)
+{
+    if (m.running) {
+        m.output->StopScheduledPlayback(0, NULL, 0);
+        m.output->DisableVideoOutput();
+        m.running = false;
+    }
+    if (m.frame_locked) {
+        join_playback_group(m.device, false);
+        m.frame_locked = false;
+    }
+    m.output->Release();
+    m.device->Release();
+    m.output = nullptr;
+    m.device = nullptr;
+}
+
+void DecklinkOutput::set_preview_output(const PreviewOutputConfig & preview)
+{
+    std::lock_guard l(device_mutex_);
+    preview_config_ = preview;
+    update_preview();
+}
+
+void DecklinkOutput::update_preview()
+{
+    // called with device_mutex_ held
+    if (!device_discovery_) return;
+
+    std::lock_guard l(mutex_);
+
+    if (preview_.device && (preview_.device_name != preview_config_.device_name ||
+        preview_.device_name == current_device_name_ || !device_discovery_->has_device(preview_.device))) {
+        close_preview();
+    }
+
+    if (preview_.device || preview_config_.device_name.empty() || preview_config_.device_name == current_device_name_) return;
+
+    IDeckLink * device = device_discovery_->acquire_device(preview_config_.device_name);
+    if (!device) return;
+
+    if (device->QueryInterface(IID_IDeckLinkOutput, (void**)&preview_.output) != S_OK) {
+        spdlog::warn("Failed to open Decklink device {} for preview output.", preview_config_.device_name);
+        preview_.output = nullptr;
+        device->Release();
+        return;
+    }
+    preview_.device = device;
+    preview_.device_name = preview_config_.device_name;
+}
+
+void DecklinkOutput::start_preview()
+{
+    // called with mutex_ held, after the main output has been enabled
+    if (!preview_.output) return;
+
+    preview_.frames_scheduled = 0;
+    preview_.frame_locked = false;
+
+    // we need the mode at the preview resolution with the same frame rate
+    // as the main output
+    long width = 0, height = 0;
+    preview_.display_mode = bmdModeUnknown;
+    IDeckLinkDisplayModeIterator * display_mode_iterator = NULL;
+    if (preview_.output->GetDisplayModeIterator(&display_mode_iterator) == S_OK) {
+        IDeckLinkDisplayMode * display_mode = NULL;
+        while (display_mode_iterator->Next(&display_mode) == S_OK) {
+            BMDTimeValue duration;
+            BMDTimeScale timescale;
+            display_mode->GetFrameRate(&duration, &timescale);
+            if (preview_.display_mode == bmdModeUnknown &&
+                duration*frame_timescale_ == frame_duration_*timescale &&
+                display_mode->GetFieldDominance() != bmdLowerFieldFirst &&
+                display_mode->GetFieldDominance() != bmdUpperFieldFirst &&
+                fmt::format("{} x {}", display_mode->GetWidth(), display_mode->GetHeight()) == preview_config_.resolution) {
+                preview_.display_mode = display_mode->GetDisplayMode();
+                width = display_mode->GetWidth();
+                height = display_mode->GetHeight();
+            }
+            display_mode->Release();
+        }
+        display_mode_iterator->Release();
+    }
+
+    if (preview_.display_mode == bmdModeUnknown) {
+        spdlog::warn("Decklink device {} has no {} mode at the main output's frame rate, preview output disabled.", preview_.device_name, preview_config_.resolution);
+        return;
+    }
+    if (width > long(frame_width_) || height > long(frame_height_)) {
+        spdlog::warn("Preview resolution {} is bigger than the main output, preview output disabled.", preview_config_.resolution);
+        return;
+    }
+
+    bool supported = false;
+    if (preview_.output->DoesSupportVideoMode(bmdVideoConnectionUnspecified, preview_.display_mode, current_pix_format_, bmdNoVideoOutputConversion, bmdSupportedVideoModeDefault, NULL, &supported) != S_OK || !supported) {
+        spdlog::warn("Decklink device {} does not support the preview mode in the main output's pixel format.", preview_.device_name);
+        return;
+    }
+
+    if (!preview_.frame_pool || preview_.frame_pool->width() != width || preview_.frame_pool->height() != height || preview_.frame_pool->pixel_format() != current_pix_format_) {
+        std::vector<std::shared_ptr<VideoFramePool>> spare_pools;
+        if (preview_.frame_pool) spare_pools.push_back(preview_.frame_pool);
+        preview_.frame_pool = VideoFramePool::create(width, height, current_pix_format_, bmdFrameFlagFlipVertical, video_frame_pool_size_,
+            [this](uint8_t * buffer, const size_t size) { pixel_swizzler_.clear(buffer, size); }, spare_pools);
+    }
+
+    // The scaled image is big enough for 16 bit RGBA, the biggest format
+    // xstudio sends.
+    downscaler_.configure(frame_width_, frame_height_, width, height);
+    preview_.scaled_image.resize(size_t(width)*size_t(height)*8);
+    make_intermediate_frame(preview_.intermediate_frame, width, height, bmdFrameFlagFlipVertical);
+
+    preview_.frame_locked = frame_locked_ && join_playback_group(preview_.device, true);
+    if (frame_locked_ && !preview_.frame_locked) {
+        spdlog::warn("Decklink device {} can't be frame locked to the main output.", preview_.device_name);
+    }
+
+    if (preview_.output->EnableVideoOutput(preview_.display_mode, preview_.frame_locked ? bmdVideoOutputSynchronizeToPlaybackGroup : bmdVideoOutputFlagDefault) != S_OK) {
+        spdlog::warn("EnableVideoOutput failed on Decklink device {}.", preview_.device_name);
+        if (preview_.frame_locked) join_playback_group(preview_.device, false);
+        preview_.frame_locked = false;
+        return;
+    }
+    preview_.running = true;
+}
+
+void DecklinkOutput::stop_preview()
+{
+    // called with mutex_ held
+    if (preview_.running) {
+        preview_.output->StopScheduledPlayback(0, NULL, 0);
+        preview_.output->DisableVideoOutput();
+        preview_.running = false;
+    }
+    if (preview_.frame_locked) {
+        join_playback_group(preview_.device, false);
+        preview_.frame_locked = false;
+    }
+    if (preview_.last_frame) {
+        preview_.last_frame->Release();
+        preview_.last_frame = nullptr;
+    }
+}
+
+void DecklinkOutput::close_preview()
+{
+    stop_preview();
+    preview_.output->Release();
+    preview_.device->Release();
+    preview_.output = nullptr;
+    preview_.device = nullptr;
+    preview_.device_name.clear();
+}
+
+void DecklinkOutput::schedule_preview_frame(DecklinkVideoFrame * frame)
+{
+    // the preview runs on the main output's clock
+    if (preview_.frame_locked) preview_.frames_scheduled = uiTotalFrames;
+    if (preview_.output->ScheduleVideoFrame(frame, (preview_.frames_scheduled * frame_duration_), frame_duration_, frame_timescale_) != S_OK) {
+        // drop the preview rather than stopping everything
+        post_output_event(OutputEvent::PreviewScheduleFailed);
+        preview_.running = false;
+        return;
+    }
+    preview_.frames_scheduled++;
+}
+
+DecklinkVideoFrame * DecklinkOutput::make_preview_frame(const media_reader::ImageBufPtr & the_frame, const SourceImage & source)
+{
+    // called with mutex_ held. Returns a frame with a reference for the
+    // caller, or nullptr if there's nothing to send.
+    DecklinkVideoFrame * frame = nullptr;
+    if (preview_.last_frame && (!the_frame || preview_.last_frame->source_image() == the_frame.get())) {
+
+        frame = preview_.last_frame;
+        frame->AddRef();
+
+    } else {
+
+        frame = preview_.frame_pool->try_acquire();
+        if (!frame) {
+            post_output_event(OutputEvent::FramePoolExhausted);
+            if (preview_.last_frame) preview_.last_frame->AddRef();
+            return preview_.last_frame;
+        }
+
+        // the source is always our raster size, see source_image
+        const size_t bytes_per_pixel = FrameGeometryAdapter::bytes_per_pixel(source.pixel_format);
+        const size_t scaled_size = downscaler_.width()*downscaler_.height()*bytes_per_pixel;
+
+        if (source.buffer && bytes_per_pixel) {
+
+            if (source.pixel_format == ui::viewport::RGBA_16) {
+                downscaler_.downscale_16bitRGBA(preview_.scaled_image.data(), source.buffer);
+            } else {
+                downscaler_.downscale_10bitRGB(preview_.scaled_image.data(), source.buffer);
+            }
+
+            bool intermediate_ready = false;
+            if (!convert_video_frame(preview_.scaled_image.data(), scaled_size, source.pixel_format, frame, preview_.intermediate_frame, intermediate_ready)) {
+                post_output_event(OutputEvent::PreviewConversionFailed);
+            }
+        } else {
+            pixel_swizzler_.clear(frame->bytes(), frame->size());
+        }
+        frame->set_source_image(the_frame.get());
+        if (preview_.last_frame) preview_.last_frame->Release();
+        preview_.last_frame = frame;
+        preview_.last_frame->AddRef();
+
+    }
+    return frame;
+}
+
+void DecklinkOutput::report_devices()
+{
+    // The plugin updates the device list in the UI and, when a device has
+    // been opened, fills in the display modes that it supports
+    utility::JsonStore j;
+    j["decklink_devices"] = device_discovery_->device_names();
+    j["decklink_device_info"] = device_discovery_->device_info();
+    j["decklink_device_ready"] = current_device_name_;
+    j["decklink_discovery_complete"] = discovery_complete_;
+    j["decklink_profiles"] = profile_manager_ ? profile_manager_->profile_names() : std::vector<std::string>();
+    j["decklink_profile"] = profile_manager_ ? profile_manager_->active_profile_name() : std::string();
+    decklink_xstudio_plugin_->send_output_status(j);
+}
+
+void DecklinkOutput::query_display_modes() {
+
+    // called with device_mutex_ held, on the driver's thread
+    display_mode_index_.build(decklink_interface_, decklink_output_interface_, offered_pixel_formats);
+}
+
+std::vector<std::string> DecklinkOutput::get_available_refresh_rates(const std::string & output_resolution) const
+{
+    std::lock_guard l(device_mutex_);
+    auto rates = display_mode_index_.refresh_rates(output_resolution);
+    if (rates.empty()) rates.push_back("Bad Resolution");
+    return rates;
+}
+
+std::vector<std::string> DecklinkOutput::output_resolution_names() const
+{
+    std::lock_guard l(device_mutex_);
+    return display_mode_index_.resolutions();
+}
+
+std::vector<BMDPixelFormat> DecklinkOutput::get_available_pixel_formats(const std::string & output_resolution, const std::string & refresh_rate) const
+{
+    std::lock_guard l(device_mutex_);
+    return display_mode_index_.pixel_formats(output_resolution, refresh_rate);
+}
+
+void DecklinkOutput::set_display_mode(
+    const std::string & resolution,
+    const std::string  &refresh_rate,
+    const BMDPixelFormat pix_format) 
+{
+    std::lock_guard l(device_mutex_);
+
+    const auto * mode = display_mode_index_.find(resolution, refresh_rate);
+    if (!mode) {
+        throw std::runtime_error(fmt::format("Failed to find a display mode for {} @ {}", resolution, refresh_rate));
+    }
+    requested_pix_format_ = pix_format;
+    requested_display_mode_ = mode->mode;
+
+    // on standby with warm standby this happens when we come back, see
+    // leave_standby
+    if (output_enabled_) reconfigure_output();
+}
+
+void DecklinkOutput::reconfigure_output()
+{
+    // called with device_mutex_ held, while output is enabled. We only do
+    // as much as the change needs.
+    if (requested_display_mode_ == current_display_mode_ && requested_pix_format_ == current_pix_format_) return;
+
+    // a new pixel format doesn't need the card to stop
+    if (requested_display_mode_ == current_display_mode_ && switch_pixel_format()) return;
+
+    // A new raster means re-enabling video output. The frame pools are
+    // rebuilt with the old frame buffers (see make_frame_pools) so this
+    // comes down to a refresh or two. If we're on standby we stay there.
+    const bool standby = standby_;
+    stop_sdi_output();
+    standby_ = standby;
+    if (!start_sdi_output()) standby_ = false;
+}
+
+bool DecklinkOutput::switch_pixel_format()
+{
+    // called with device_mutex_ held. The card carries on in the same
+    // display mode and from the next frame callback we send it frames in the
+    // new pixel format, the ones already scheduled play out as they are.
+    // The conversion for each frame goes by the frame's pixel format so
+    // swapping the frame pools switches that over too.
+    const BMDPixelFormat pix_fmt = requested_pix_format_;
+
+    const auto * display_mode = display_mode_index_.find(current_display_mode_);
+    if (!display_mode || !display_mode->supports(pix_fmt)) {
+        return false;
+    }
+    bool supported = false;
+
+    ScopedThreadAffinity on_card_node(numa_cores_);
+
+    long preview_width = 0, preview_height = 0;
+    std::vector<bool> mirror_running;
+    {
+        std::lock_guard l(mutex_);
+        for (const auto & m: mirrors_) mirror_running.push_back(m.running);
+        if (preview_.running) {
+            preview_width = preview_.frame_pool->width();
+            preview_height = preview_.frame_pool->height();
+        }
+    }
+
+    // Mirrors that follow the main output's format switch with it if they
+    // can, otherwise they stay as they are
+    std::vector<BMDPixelFormat> formats = {pix_fmt};
+    std::vector<BMDPixelFormat> mirror_formats;
+    for (size_t i = 0; i < mirrors_.size(); ++i) {
+        const auto & m = mirrors_[i];
+        BMDPixelFormat mirror_fmt = m.pixel_format;
+        if (mirror_running[i] && !m.requested_pixel_format) {
+            if (m.output->DoesSupportVideoMode(bmdVideoConnectionUnspecified, current_display_mode_, pix_fmt, bmdNoVideoOutputConversion, bmdSupportedVideoModeDefault, NULL, &supported) == S_OK && supported) {
+                mirror_fmt = pix_fmt;
+            } else {
+                spdlog::warn("Decklink device {} does not support the new pixel format, it will stay in the old one.", m.device_name);
+            }
+        }
+        mirror_formats.push_back(mirror_fmt);
+        if (mirror_running[i] && std::find(formats.begin(), formats.end(), mirror_fmt) == formats.end()) {
+            formats.push_back(mirror_fmt);
+        }
+    }
+
+    // The new pools are made (and their frames faulted in) before we take
+    // the lock so that the frame callback isn't held up
+    auto first_touch = [this](uint8_t * buffer, const size_t size) {
+        pixel_swizzler_.clear(buffer, size);
+    };
+    std::map<BMDPixelFormat, std::shared_ptr<VideoFramePool>> pools;
+    for (const auto fmt: formats) {
+        auto p = frame_pools_.find(fmt);
+        pools[fmt] = p != frame_pools_.end() ? p->second :
+            VideoFramePool::create(frame_width_, frame_height_, fmt, bmdFrameFlagFlipVertical, video_frame_pool_size_, first_touch);
+    }
+    std::shared_ptr<VideoFramePool> preview_pool;
+    if (preview_width && preview_.output->DoesSupportVideoMode(bmdVideoConnectionUnspecified, preview_.display_mode, pix_fmt, bmdNoVideoOutputConversion, bmdSupportedVideoModeDefault, NULL, &supported) == S_OK && supported) {
+        preview_pool = VideoFramePool::create(preview_width, preview_height, pix_fmt, bmdFrameFlagFlipVertical, video_frame_pool_size_, first_touch);
+    }
+
+    {
+        // mutex_ is held by the frame callback, so this is a frame boundary
+        std::lock_guard l(mutex_);
+        current_pix_format_ = pix_fmt;
+        for (size_t i = 0; i < mirrors_.size(); ++i) {
+            mirrors_[i].pixel_format = mirror_formats[i];
+        }
+        output_pixel_formats_ = formats;
+
+        // The next frame callback converts the current image again into the
+        // new pools. Frames of the old pools that are still scheduled go
+        // when the card has finished with them.
+        release_last_frames();
+        for (const auto fmt: formats) last_frames_.emplace(fmt, nullptr);
+        frame_pools_ = pools;
+
+        if (preview_pool) {
+            if (preview_.last_frame) {
+                preview_.last_frame->Release();
+                preview_.last_frame = nullptr;
+            }
+            preview_.frame_pool = preview_pool;
+        }
+    }
+
+    spdlog::info("Decklink output switched pixel format in mode {}.", display_mode_name_);
+    return true;
+}
+
+
+bool DecklinkOutput::start_sdi_output()
+{
+
+	bool								bSuccess = false;
+
+    try {
+
+        if (!decklink_output_interface_) {
+            throw std::runtime_error("No Decklink device available.");
+        }
+
+        // whatever we allocate from here on goes on the card's NUMA node
+        ScopedThreadAffinity on_card_node(numa_cores_);
+
+        {
+            std::lock_guard l(mutex_);
+            current_display_mode_ = requested_display_mode_;
+            current_pix_format_ = requested_pix_format_;
+            // events still queued from the last run are ignored
+            output_generation_++;
+            // in case the driver uses new threads for this run
+            video_thread_priority_.generation = 0;
+            audio_thread_priority_.generation = 0;
+            startup_frames_ = 0;
+            startup_frame_time_total_us_ = 0;
+            startup_frame_time_max_us_ = 0;
+            startup_late_frames_ = 0;
+            startup_dropped_frames_ = 0;
+            warm_up_us_ = 0;
+            reanchor_video_ = false;
+            reanchor_audio_ = false;
+        }
+        
+        const DisplayModeIndex::Mode * display_mode = display_mode_index_.find(current_display_mode_);
+        if (!display_mode) {
+            throw std::runtime_error("Failed to find display mode.");
+        }
+        display_mode_name_ = display_mode->name;
+        if (!display_mode->supports(current_pix_format_)) {
+            throw std::runtime_error(fmt::format("Decklink device {} does not support mode {} in the selected pixel format.", current_device_name_, display_mode_name_));
+        }
+
+        report_status(fmt::format("Starting Decklink output loop in mode {}.", display_mode_name_), false);
+
+        frame_width_ = display_mode->width;
+        frame_height_ = display_mode->height;
+        display_mode->handle->GetFrameRate(&frame_duration_, &frame_timescale_);
+        
+        uiFPS = ((frame_timescale_ + (frame_duration_-1))  /  frame_duration_);
+        
+        // if we are frame locking our outputs the main output
+        // has to be in the playback group too
+        const bool other_outputs = !mirrors_.empty() || preview_.output;
+        frame_locked_ = frame_lock_outputs_ && other_outputs && join_playback_group(decklink_interface_, true);
+        if (!frame_locked_) join_playback_group(decklink_interface_, false);
+        if (frame_lock_outputs_ && other_outputs && !frame_locked_) {
+            spdlog::warn("Decklink device {} does not support playback groups, outputs will not be frame locked.", current_device_name_);
+        }
+
+        configure_sdi_link();
+
+        // Allocate (and fault in) the frames that we are going to
+        // need before enabling output, so that once the card is
+        // running nothing stands between it and the first picture
+        {
+            std::lock_guard l(mutex_);
+            make_frame_pools();
+            geometry_adapter_.configure(frame_width_, frame_height_);
+            source_frame_ = nullptr;
+        }
+
+        if (decklink_output_interface_->EnableVideoOutput(display_mode->mode, frame_locked_ ? bmdVideoOutputSynchronizeToPlaybackGroup : bmdVideoOutputFlagDefault) != S_OK) {
+            throw std::runtime_error("EnableVideoOutput call failed.");
+        }
+
+        uiTotalFrames = 0;
+
+        {
+            std::lock_guard l(mutex_);
+            start_mirrors();
+            start_preview();
+
+            // drop the formats of mirrors that failed to start
+            output_pixel_formats_.erase(std::remove_if(output_pixel_formats_.begin(), output_pixel_formats_.end(), [&](const BMDPixelFormat pix_fmt) {
+                return pix_fmt != current_pix_format_ && std::none_of(mirrors_.begin(), mirrors_.end(), [&](const MirrorOutput & m) {
+                    return m.running && m.pixel_format == pix_fmt;
+                });
+            }), output_pixel_formats_.end());
+
+            const auto warm_up_start = utility::clock::now();
+            warm_up();
+            warm_up_us_ = std::chrono::duration_cast<std::chrono::microseconds>(utility::clock::now() - warm_up_start).count();
+        }
+        
+        configure_audio_buffers();
+
+        // Set the audio output mode
+        if (decklink_output_interface_->EnableAudioOutput(
+            bmdAudioSampleRate48kHz,
+            bmdAudioSampleType32bitInteger,
+            sdi_audio_channels_,
+            bmdAudioOutputStreamTimestamped) != S_OK) 
+        {
+            throw std::runtime_error("Failed to enable audio output.");
+        }
+
+
+        set_preroll();
+
+        samples_delivered_ = 0;
+        // xstudio hasn't sent any audio yet, so this isn't an underrun
+        audio_stream_state_ = AudioStreamState::Underrun;
+        last_audio_callback_time_ = utility::time_point();
+        audio_ring_.clear();
+        audio_flush_requested_ = false;
+        fade_in_pending_ = false;
+
+        if (decklink_output_interface_->BeginAudioPreroll() != S_OK) {
+            throw std::runtime_error("Failed to pre-roll audio output.");
+        }
+
+        // Frame locked outputs are started along with the main output, at the
+        // same start time
+        for (auto & m: mirrors_) {
+            if (m.running && !m.frame_locked) m.output->StartScheduledPlayback(0, 100, 1.0);
+        }
+        if (preview_.running && !preview_.frame_locked) preview_.output->StartScheduledPlayback(0, 100, 1.0);
+        decklink_output_interface_->StartScheduledPlayback(0, 100, 1.0);
+        
+        output_enabled_ = true;
+        bSuccess = true;
+
+    } catch (std::exception & e) {
+
+        unwind_failed_start();
+        report_error(e.what());
+
+    }
+
+	return bSuccess;
+}
+
+void DecklinkOutput::unwind_failed_start()
+{
+    // Called with device_mutex_ held when start_sdi_output fails part way.
+    // Anything it got as far as enabling is switched off again, otherwise
+    // the next start fails on outputs that are still enabled. Undoing what
+    // wasn't done does no harm.
+    if (!decklink_output_interface_) return;
+
+    decklink_output_interface_->StopScheduledPlayback(0, NULL, 0);
+    decklink_output_interface_->DisableAudioOutput();
+    decklink_output_interface_->DisableVideoOutput();
+
+    std::lock_guard l(mutex_);
+    stop_mirrors();
+    stop_preview();
+    join_playback_group(decklink_interface_, false);
+    frame_locked_ = false;
+    release_last_frames();
+}
+
+bool DecklinkOutput::stop_sdi_output(const std::string &error_message)
+{
+
+    running_ = false;
+    output_enabled_ = false;
+    standby_ = false;
+    decklink_xstudio_plugin_->stop_rendering();
+
+    if (!error_message.empty()) {
+        report_error(error_message);
+    } else {
+        report_status("SDI Output Paused.", false);
+    }
+
+    spdlog::info("Stopping Decklink output loop. {}", error_message);
+
+	decklink_output_interface_->StopScheduledPlayback(0, NULL, 0);
+	decklink_output_interface_->DisableVideoOutput();
+	decklink_output_interface_->DisableAudioOutput();
+
+	mutex_.lock();
+
+    stop_mirrors();
+    stop_preview();
+    if (frame_locked_) {
+        join_playback_group(decklink_interface_, false);
+        frame_locked_ = false;
+    }
+
+    release_last_frames();
+	
+	free(pFrameBuf);
+	pFrameBuf = NULL;
 
 	mutex_.unlock();
 
-    spdlog::info("Stopping Decklink output loop done. {}", error_message);
+    spdlog::info("Stopping Decklink output loop done. {}", error_message);
+
+	return true;
+}
+
+void DecklinkOutput::StartStop() {
+    std::lock_guard l(device_mutex_);
+    if (standby_) leave_standby();
+    else if (!running_ && !output_enabled_) start_sdi_output();
+    else if (warm_standby_) enter_standby();
+    else stop_sdi_output();
+}
+
+void DecklinkOutput::set_warm_standby(const bool warm_standby)
+{
+    std::lock_guard l(device_mutex_);
+    warm_standby_ = warm_standby;
+    if (!warm_standby && standby_) stop_sdi_output();
+}
+
+void DecklinkOutput::set_thread_scheduling(const ThreadPriority & requested, const std::string & conversion_cores)
+{
+    const std::vector<int> cores = parse_core_list(conversion_cores);
+
+    // the driver's threads pick this up on their next callback
+    requested_thread_policy_ = int(requested.policy);
+    requested_thread_priority_ = requested.priority;
+    thread_priority_generation_++;
+
+    // output_event_thread_ passes the frame requests on to xstudio, so it
+    // gets the same priority
+    set_thread_priority(output_event_thread_.native_handle(), requested);
+
+    std::lock_guard l(device_mutex_);
+    conversion_priority_ = requested;
+    conversion_cores_ = cores;
+    place_conversion_threads();
+}
+
+void DecklinkOutput::set_numa_node(const int node)
+{
+    std::lock_guard l(device_mutex_);
+    requested_numa_node_ = node;
+    place_conversion_threads();
+}
+
+void DecklinkOutput::set_reference_timing_offset(const int offset)
+{
+    std::lock_guard l(device_mutex_);
+    reference_timing_offset_ = offset;
+    apply_reference_timing_offset();
+}
+
+void DecklinkOutput::apply_reference_timing_offset()
+{
+    // Called with device_mutex_ held. The card takes the new offset while
+    // running. What it actually uses (it may clamp to the range it
+    // supports) is reported by poll_reference_status.
+    if (!decklink_interface_) return;
+    IDeckLinkConfiguration * config = NULL;
+    if (decklink_interface_->QueryInterface(IID_IDeckLinkConfiguration, (void**)&config) != S_OK) return;
+    if (config->SetInt(bmdDeckLinkConfigReferenceInputTimingOffset, reference_timing_offset_) != S_OK) {
+        spdlog::warn("Decklink device {} did not accept reference timing offset {}.", current_device_name_, reference_timing_offset_);
+    }
+    config->Release();
+}
+
+void DecklinkOutput::poll_reference_status()
+{
+    // Called by the metrics thread with metrics_mutex_ held, so we mustn't
+    // wait for device_mutex_ (set_thread_scheduling takes them the other
+    // way round). If the device is busy we'll look next time.
+    std::unique_lock l(device_mutex_, std::try_to_lock);
+    if (!l.owns_lock()) return;
+
+    ReferenceState state = reference_state_;
+    if (!decklink_output_interface_) {
+        state.status = "No Device";
+        state.timing_offset = 0;
+    } else {
+        BMDReferenceStatus status = bmdReferenceNotSupportedByHardware;
+        if (decklink_output_interface_->GetReferenceStatus(&status) != S_OK) status = bmdReferenceNotSupportedByHardware;
+        state.status = reference_status_name(status);
+
+        IDeckLinkConfiguration * config = NULL;
+        if (decklink_interface_->QueryInterface(IID_IDeckLinkConfiguration, (void**)&config) == S_OK) {
+            if (config->GetInt(bmdDeckLinkConfigReferenceInputTimingOffset, &state.timing_offset) != S_OK) state.timing_offset = 0;
+            config->Release();
+        }
+    }
+    const bool output_on = output_enabled_;
+    l.unlock();
+
+    state.reanchored_frames = reanchored_frame_count_;
+    if (state.status != reference_state_.status) {
+
+        state.changed_at = wall_clock_time();
+        if (reference_state_.status == "Locked" && state.status == "Not Locked") {
+            state.losses++;
+            spdlog::warn("Decklink reference lost at {} ({}).", state.changed_at, state.status);
+        } else if (state.status == "Locked") {
+            spdlog::info("Decklink reference locked at {}.", state.changed_at);
+        }
+
+        // The card's clock follows the reference when there is one, and
+        // free runs when there isn't, so it can jump either way when lock
+        // changes. Frames scheduled against the old timeline would then go
+        // out late.
+        if (output_on && !reference_state_.status.empty() &&
+            (state.status == "Locked" || reference_state_.status == "Locked")) {
+            reanchor_video_ = true;
+            reanchor_audio_ = true;
+        }
+    }
+
+    if (reference_state_sent_ && state.status == reference_state_.status && state.timing_offset == reference_state_.timing_offset &&
+        state.losses == reference_state_.losses && state.reanchored_frames == reference_state_.reanchored_frames) return;
+
+    reference_state_ = state;
+    reference_state_sent_ = true;
+    utility::JsonStore j;
+    j["reference_status"]["status"] = state.status;
+    j["reference_status"]["changed_at"] = state.changed_at;
+    j["reference_status"]["timing_offset"] = state.timing_offset;
+    j["reference_status"]["losses"] = state.losses;
+    j["reference_status"]["reanchored_frames"] = state.reanchored_frames;
+    decklink_xstudio_plugin_->send_output_status(j);
+}
+
+void DecklinkOutput::poll_device_telemetry()
+{
+    // Called by the metrics thread with metrics_mutex_ held, see
+    // poll_reference_status
+    std::unique_lock l(device_mutex_, std::try_to_lock);
+    if (!l.owns_lock()) return;
+
+    DeviceTelemetry telemetry;
+    if (decklink_output_interface_) {
+        telemetry = read_device_telemetry(decklink_interface_, decklink_output_interface_);
+        telemetry.device_name = current_device_name_;
+        telemetry.pcie_max_link_width = pcie_max_link_width_;
+    }
+    l.unlock();
+
+    if (device_telemetry_sent_ && telemetry == device_telemetry_) return;
+
+    if (telemetry.pcie_link_degraded() &&
+        (!device_telemetry_.pcie_link_degraded() || telemetry.device_name != device_telemetry_.device_name)) {
+        spdlog::warn("Decklink device {} is running on {} PCIe lanes out of {}, it may not have the bandwidth for large frames at high frame rates. Check which slot it is in.",
+            telemetry.device_name, telemetry.pcie_link_width, telemetry.pcie_max_link_width);
+    }
+
+    device_telemetry_ = telemetry;
+    device_telemetry_sent_ = true;
+    utility::JsonStore j;
+    j["device_telemetry"] = device_telemetry_json(telemetry);
+    decklink_xstudio_plugin_->send_output_status(j);
+}
+
+void DecklinkOutput::place_conversion_threads()
+{
+    // Called with device_mutex_ held. Cores given in the preferences win
+    // over the card's NUMA node. New frame buffers are zeroed by these
+    // threads, so they follow them onto the node.
+    numa_node_ = requested_numa_node_ == numa_node_auto ? device_numa_node_ :
+        requested_numa_node_ == numa_node_off ? -1 : requested_numa_node_;
+    numa_cores_ = numa_node_cores(numa_node_);
+    if (numa_node_ >= 0 && numa_cores_.empty()) {
+        spdlog::warn("NUMA node {} not found, Decklink conversion threads can run on any node.", numa_node_);
+        numa_node_ = -1;
+    }
+    const std::vector<int> & cores = conversion_cores_.empty() ? numa_cores_ : conversion_cores_;
+
+    // The callback thread does a share of each conversion itself and then
+    // waits for the workers, so they need the same priority too
+    ThreadPriority workers = conversion_priority_;
+    bool pinned = true;
+    for (auto thread: conversion_workers_.native_handles()) {
+        workers = set_thread_priority(thread, conversion_priority_);
+        pinned &= set_thread_affinity(thread, cores);
+    }
+
+    std::string status = fmt::format("Conversion threads: {}", describe_thread_priority(conversion_priority_, workers));
+    if (!pinned) {
+        status += fmt::format(", could not be put on cores {}.", core_list_string(cores));
+    } else if (!conversion_cores_.empty()) {
+        status += fmt::format(", on cores {}.", core_list_string(cores));
+    } else if (numa_node_ >= 0) {
+        status += fmt::format(", on NUMA node {} (cores {}).", numa_node_, core_list_string(cores));
+    } else {
+        status += ".";
+    }
+    spdlog::info("Decklink {}", status);
 
-	return true;
+    std::lock_guard m(metrics_mutex_);
+    conversion_thread_scheduling_ = status;
 }
 
-void DecklinkOutput::StartStop() {
-    if (!running_) start_sdi_output();
-    else stop_sdi_output();
+void DecklinkOutput::apply_callback_thread_priority(CallbackThreadPriority & applied)
+{
+    // Called on the driver's threads. Only system calls, no allocation.
+    const uint32_t generation = thread_priority_generation_;
+    if (applied.generation == generation) return;
+    applied.generation = generation;
+
+    const pthread_t self = pthread_self();
+    if (!applied.raised || !pthread_equal(applied.thread, self)) {
+        applied.thread = self;
+        applied.raised = false;
+        applied.driver_priority = get_thread_priority(self);
+    }
+
+    const ThreadPriority requested{ThreadPolicy(requested_thread_policy_.load()), requested_thread_priority_};
+    ThreadPriority effective = applied.driver_priority;
+    if (requested.policy != ThreadPolicy::Normal) {
+        effective = set_thread_priority(self, requested);
+        applied.raised = true;
+    } else if (applied.raised) {
+        effective = set_thread_priority(self, applied.driver_priority);
+        applied.raised = false;
+    }
+    output_thread_policy_ = int(effective.policy);
+    output_thread_priority_ = effective.priority;
 }
 
-void DecklinkOutput::incoming_frame(const media_reader::ImageBufPtr &incoming) {
+void DecklinkOutput::enter_standby()
+{
+    // called with device_mutex_ held. The card carries on running (so the
+    // monitor keeps sync) but we stop xstudio rendering for us and send black.
+    {
+        std::lock_guard l(mutex_);
+        standby_ = true;
+        running_ = false;
 
-    // this is called from xstudio managed thread, which is independent of
-    // the decklink output thread control
-	frames_mutex_.lock();
-    current_frame_ = incoming;
-	frames_mutex_.unlock();
+        // the black frames are converted once, on the next frame callback,
+        // and then re-sent every refresh
+        release_last_frames();
+        if (preview_.last_frame) {
+            preview_.last_frame->Release();
+            preview_.last_frame = nullptr;
+        }
+    }
+    {
+        // and we don't want to show a stale image when we come back
+        std::lock_guard l(frames_mutex_);
+        current_frame_ = media_reader::ImageBufPtr();
+    }
 
+    decklink_xstudio_plugin_->stop_rendering();
+    report_status("SDI Output on standby.", false);
+    spdlog::info("Decklink output on standby.");
 }
 
-namespace {
-    void multithreadMemCopy(
-        void * _dst,
-        void * _src,
-        size_t buf_size,
-        const int n_threads) 
-    {
+void DecklinkOutput::leave_standby()
+{
+    // called with device_mutex_ held. If the output settings were changed
+    // while we were on standby we have to start again, otherwise we are
+    // back on the next frame callback.
+    if (requested_display_mode_ != current_display_mode_ || requested_pix_format_ != current_pix_format_) {
+        stop_sdi_output();
+        start_sdi_output();
+        return;
+    }
 
-        // Note: my instinct tells me that spawning threads for
-        // every copy operation (which might happen 60 times a second)
-        // is not efficient but it seems that having a threadpool doesn't
-        // make any real difference, the overhead of thread creation
-        // is tiny.
-        std::vector<std::thread> memcpy_threads;
-        size_t step = ((buf_size / n_threads) / 4096) * 4096;
+    {
+        // fade audio back in when it arrives
+        std::lock_guard l(bmd_mutex_);
+        fade_in_pending_ = true;
+    }
+    standby_ = false;
+}
 
-        uint8_t *dst = (uint8_t *)_dst;
-        uint8_t *src = (uint8_t *)_src;
+void DecklinkOutput::incoming_frame(const media_reader::ImageBufPtr &incoming) {
 
-        for (int i = 0; i < n_threads; ++i) {
-            memcpy_threads.emplace_back(memcpy, dst, src, std::min(buf_size, step));
-            dst += step;
-            src += step;
-            buf_size -= step;
-        }
+    // this is called from xstudio managed thread, which is independent of
+    // the decklink output thread control
+	frames_mutex_.lock();
+    current_frame_ = incoming;
+	frames_mutex_.unlock();
 
-        // ensure any threads still running to copy data to this texture are done
-        for (auto &t : memcpy_threads) {
-            if (t.joinable())
-                t.join();
+    // If the playhead has jumped (seek, scrub, loop) the audio that we have
+    // queued up is for the wrong position. Ask the audio callback to flush it.
+    // Playing forwards or backwards, at any speed, moves the timestamp on at
+    // a steady rate, so a jump is a break from the rate we saw last time.
+    // We go by the time between frames because xstudio doesn't necessarily
+    // send one every refresh.
+    if (incoming && flush_audio_on_seek_) {
+        const auto timestamp = incoming.timeline_timestamp();
+        const auto now = utility::clock::now();
+        if (have_last_frame_timestamp_) {
+            const double elapsed = std::chrono::duration<double>(now - last_frame_time_).count();
+            const double step = std::chrono::duration<double>(timestamp - last_frame_timestamp_).count();
+            const double expected_step = timeline_rate_*elapsed;
+            if (std::abs(step - expected_step) > std::max(0.25, std::abs(expected_step))) {
+                request_audio_flush();
+                timeline_rate_ = 0.0; // we don't know the rate after a jump
+            } else if (elapsed > 0.0) {
+                timeline_rate_ = step/elapsed;
+            }
         }
+        last_frame_timestamp_ = timestamp;
+        last_frame_time_ = now;
+        have_last_frame_timestamp_ = true;
     }
 
 }
 
+void DecklinkOutput::request_audio_flush()
+{
+    // only what xstudio sent before now is for the old position
+    audio_flush_position_ = audio_ring_.write_position();
+    audio_flush_requested_ = true;
+}
+
 #define CHECK_BIT(var,pos) ((var) & (1<<(pos)))
 
 void DecklinkOutput::report_status(const std::string & status_message, const bool sdi_output_is_active) {
@@ -488,7 +1786,7 @@ void DecklinkOutput::report_status(const std::string & status_message, const boo
     j["status_message"] = status_message;
     j["sdi_output_is_active"] = sdi_output_is_active;    
     j["error_state"] = false;    
-    decklink_xstudio_plugin_->send_status(j);
+    decklink_xstudio_plugin_->send_output_status(j);
 
 }
 
@@ -498,10 +1796,225 @@ void DecklinkOutput::report_error(const std::string & status_message) {
     j["status_message"] = status_message;
     j["sdi_output_is_active"] = false;    
     j["error_state"] = true;    
-    decklink_xstudio_plugin_->send_status(j);
+    decklink_xstudio_plugin_->send_output_status(j);
+}
+
+void DecklinkOutput::metrics_publisher_loop() {
+
+    // Counters are updated by the Decklink driver threads. We push them to
+    // the plugin (and therefore the UI) once a second from this thread rather
+    // than building json messages in the driver callbacks. Audio meter levels
+    // go out at a faster (but still low) rate so the meters move smoothly.
+    uint64_t last_underruns = std::numeric_limits<uint64_t>::max();
+    uint64_t last_silent_samples = std::numeric_limits<uint64_t>::max();
+    uint64_t last_dropped_samples = std::numeric_limits<uint64_t>::max();
+    uint32_t last_water_level = 0;
+    uint64_t last_adapted_frames = std::numeric_limits<uint64_t>::max();
+    std::string last_thread_scheduling;
+    uint64_t last_late_frames = std::numeric_limits<uint64_t>::max();
+    uint64_t last_dropped_frames = std::numeric_limits<uint64_t>::max();
+    uint32_t last_startup_generation = 0;
+    bool meters_idle = false;
+    AudioLevels levels;
+    int tick = 0;
+
+    std::unique_lock lk(metrics_mutex_);
+    while (!exit_metrics_thread_) {
+
+        metrics_cv_.wait_for(lk, std::chrono::milliseconds(1000/meter_updates_per_second_), [=] { return exit_metrics_thread_; });
+        if (exit_metrics_thread_) break;
+
+        int num_channels = 0;
+        const size_t metered_frames = audio_meter_.take(levels, num_channels);
+        if (metered_frames || !meters_idle) {
+
+            // levels in dBFS, floored at -96 which is also what we send once
+            // when audio stops so the meters drop back down
+            auto to_db = [](const float v) {
+                return v > 1.58e-5f ? 20.0f*std::log10(v) : -96.0f;
+            };
+            std::vector<float> peak(num_channels, -96.0f);
+            std::vector<float> rms(num_channels, -96.0f);
+            for (int c = 0; c < num_channels && metered_frames; ++c) {
+                peak[c] = to_db(levels.peak[c]);
+                rms[c] = to_db(std::sqrt(levels.sum_squares[c]/float(metered_frames)));
+            }
+            utility::JsonStore j;
+            j["audio_levels"]["peak"] = peak;
+            j["audio_levels"]["rms"] = rms;
+            decklink_xstudio_plugin_->send_output_status(j);
+            meters_idle = metered_frames == 0;
+
+        }
+
+        // at the meter rate, so that loss of reference is timed closely
+        poll_reference_status();
+
+        if (++tick < meter_updates_per_second_) continue;
+        tick = 0;
+
+        poll_device_telemetry();
+
+        // what scheduling our threads actually got, see set_thread_scheduling
+        const int output_policy = output_thread_policy_;
+        const ThreadPriority requested{ThreadPolicy(requested_thread_policy_.load()), requested_thread_priority_};
+        std::string thread_scheduling = output_policy < 0 ? std::string("Output thread: not started.") :
+            fmt::format("Output thread: {}.", describe_thread_priority(requested, ThreadPriority{ThreadPolicy(output_policy), output_thread_priority_}));
+        if (!conversion_thread_scheduling_.empty()) thread_scheduling += " " + conversion_thread_scheduling_;
+        if (thread_scheduling != last_thread_scheduling) {
+            last_thread_scheduling = thread_scheduling;
+            utility::JsonStore j;
+            j["thread_scheduling"] = thread_scheduling;
+            decklink_xstudio_plugin_->send_output_status(j);
+        }
+
+        // how the first frames went, once per start of the output
+        const uint32_t generation = output_generation_;
+        if (generation != last_startup_generation && startup_frames_ >= startup_window_frames_) {
+            last_startup_generation = generation;
+            utility::JsonStore startup;
+            startup["frames"] = startup_window_frames_;
+            startup["warm_up_ms"] = double(warm_up_us_)/1000.0;
+            startup["mean_frame_time_ms"] = double(startup_frame_time_total_us_)/double(startup_window_frames_)/1000.0;
+            startup["max_frame_time_ms"] = double(startup_frame_time_max_us_)/1000.0;
+            startup["late_frames"] = startup_late_frames_.load();
+            startup["dropped_frames"] = startup_dropped_frames_.load();
+            spdlog::info("Decklink output startup: warm up {:.1f}ms, first {} frames took {:.2f}ms on average, {:.2f}ms at most, {} late, {} dropped.",
+                double(warm_up_us_)/1000.0, startup_window_frames_,
+                double(startup_frame_time_total_us_)/double(startup_window_frames_)/1000.0,
+                double(startup_frame_time_max_us_)/1000.0, startup_late_frames_.load(), startup_dropped_frames_.load());
+            utility::JsonStore j;
+            j["startup_metrics"] = startup;
+            decklink_xstudio_plugin_->send_output_status(j);
+        }
+
+        const uint64_t underruns = audio_underrun_count_;
+        const uint64_t silent_samples = audio_silent_samples_;
+        const uint64_t dropped_samples = audio_dropped_samples_;
+        const uint32_t water_level = samples_water_level_;
+        const uint64_t adapted_frames = adapted_frame_count_;
+        const uint64_t late_frames = late_frame_count_;
+        const uint64_t dropped_frames = dropped_frame_count_;
+        if (underruns == last_underruns && silent_samples == last_silent_samples && dropped_samples == last_dropped_samples && water_level == last_water_level &&
+            adapted_frames == last_adapted_frames && late_frames == last_late_frames && dropped_frames == last_dropped_frames) continue;
+
+        last_underruns = underruns;
+        last_silent_samples = silent_samples;
+        last_dropped_samples = dropped_samples;
+        last_water_level = water_level;
+        last_adapted_frames = adapted_frames;
+        last_late_frames = late_frames;
+        last_dropped_frames = dropped_frames;
+
+        utility::JsonStore j;
+        j["audio_underruns"] = underruns;
+        j["audio_silent_samples"] = silent_samples;
+        j["audio_dropped_samples"] = dropped_samples;
+        j["audio_buffer_level"] = water_level;
+        j["adapted_video_frames"] = adapted_frames;
+        j["late_video_frames"] = late_frames;
+        j["dropped_video_frames"] = dropped_frames;
+        decklink_xstudio_plugin_->send_output_status(j);
+
+    }
+}
+
+void DecklinkOutput::post_output_event(const OutputEvent::Type type, const int index, const utility::time_point time)
+{
+    // Called from the driver threads. If the queue is full the event is
+    // dropped, which is better than blocking the card.
+    if (output_events_.push(OutputEvent{type, output_generation_, index, time})) {
+        sem_post(&output_events_wake_);
+    }
+}
+
+void DecklinkOutput::output_event_loop()
+{
+    while (true) {
+
+        // a post can be left over from an event we popped last time round,
+        // in which case there's nothing to do
+        while (sem_wait(&output_events_wake_) != 0 && errno == EINTR) {}
+        if (exit_output_event_thread_) return;
+
+        OutputEvent event;
+        while (output_events_.pop(event)) {
+            try {
+                handle_output_event(event);
+            } catch (std::exception & e) {
+                report_error(e.what());
+            }
+        }
+
+        // drop the images that the frame callback has finished with, outside
+        // the lock as freeing them may take a while
+        std::array<media_reader::ImageBufPtr, 8> retired;
+        frames_mutex_.lock();
+        for (size_t i = 0; i < retired_frames_count_; ++i) retired[i] = std::move(retired_frames_[i]);
+        retired_frames_count_ = 0;
+        frames_mutex_.unlock();
+
+    }
+}
+
+void DecklinkOutput::handle_output_event(const OutputEvent & event)
+{
+    if (event.type == OutputEvent::RequestVideoFrame) {
+        decklink_xstudio_plugin_->request_render(event.time);
+        return;
+    }
+    if (event.type == OutputEvent::VideoFrameConsumed) {
+        decklink_xstudio_plugin_->frame_displayed(event.time);
+        return;
+    }
+
+    // the rest are about one run of the output, which may have been stopped
+    // (or restarted) since
+    std::lock_guard l(device_mutex_);
+    if (!output_enabled_ || event.generation != output_generation_) return;
+
+    // warnings are only logged the first time
+    const bool first = warned_generation_[event.type] != event.generation;
+    warned_generation_[event.type] = event.generation;
+
+    switch (event.type) {
+    case OutputEvent::OutputRunning:
+        if (running_ && !standby_) {
+            report_status(fmt::format("Running in mode {}.", display_mode_name_), true);
+            decklink_xstudio_plugin_->start_rendering(frameWidth(), frameHeight());
+        }
+        break;
+    case OutputEvent::VideoScheduleFailed:
+        stop_sdi_output("Failed to schedule video frame.");
+        break;
+    case OutputEvent::VideoConversionFailed:
+        stop_sdi_output("Unable to convert frame pixel formats.");
+        break;
+    case OutputEvent::MirrorScheduleFailed: {
+        std::lock_guard m(mutex_);
+        if (size_t(event.index) < mirrors_.size()) {
+            spdlog::warn("Failed to schedule video frame on {}, stopping output to this device.", mirrors_[event.index].device_name);
+        }
+        break;
+    }
+    case OutputEvent::PreviewScheduleFailed:
+        spdlog::warn("Failed to schedule video frame on {}, stopping preview output.", preview_.device_name);
+        break;
+    case OutputEvent::PreviewConversionFailed:
+        if (first) spdlog::warn("Unable to convert preview frame pixel format.");
+        break;
+    case OutputEvent::FramePoolExhausted:
+        if (first) spdlog::warn("Decklink output ran out of video frames, repeating the last frame.");
+        break;
+    case OutputEvent::AudioScheduleFailed:
+        if (first) spdlog::warn("Failed to schedule audio out.");
+        break;
+    default:
+        break;
+    }
 }
 
-void DecklinkOutput::fill_decklink_video_frame(IDeckLinkVideoFrame* decklink_video_frame)
+void DecklinkOutput::fill_decklink_video_frame(const BMDOutputFrameCompletionResult result)
 {
 
     // this function (fill_decklink_video_frame) is called by the Decklink API at a steady beat
@@ -513,7 +2026,25 @@ void DecklinkOutput::fill_decklink_video_frame(IDeckLinkVideoFrame* decklink_vid
     //
     // The time value passed into this request is our best estimate of when the frame that we are
     // requesting will actually be put on the screen.
-    decklink_xstudio_plugin_->request_video_frame(utility::clock::now());
+    // On standby xstudio isn't rendering for us and we just re-send black.
+    //
+    // This is the driver's thread, so we don't allocate, throw or call into
+    // xstudio from here. The requests (and any errors) are passed on to
+    // output_event_thread_ through output_events_.
+    apply_callback_thread_priority(video_thread_priority_);
+    const bool standby = standby_;
+    const auto now = utility::clock::now();
+
+    // the frame that the card has just finished with, see metrics_publisher_loop
+    const bool startup = startup_frames_ < startup_window_frames_;
+    if (result == bmdOutputFrameDisplayedLate) {
+        late_frame_count_++;
+        if (startup) startup_late_frames_++;
+    } else if (result == bmdOutputFrameDropped) {
+        dropped_frame_count_++;
+        if (startup) startup_dropped_frames_++;
+    }
+    if (!standby) post_output_event(OutputEvent::RequestVideoFrame, 0, now);
 
 
     // We also need to make this crucial call to tell xstudio's offscreen viewport when the
@@ -523,7 +2054,7 @@ void DecklinkOutput::fill_decklink_video_frame(IDeckLinkVideoFrame* decklink_vid
     // In the case of the Decklink, we know that this function (fill_decklink_video_frame) is being
     // called with a beat matching the SDI refresh (as long as our code immediately below 
     // completes well inside/ that period)
-    decklink_xstudio_plugin_->video_frame_consumed(utility::clock::now());
+    if (!standby) post_output_event(OutputEvent::VideoFrameConsumed, 0, now);
 
     static auto tp = utility::clock::now();
     auto tp1 = utility::clock::now();
@@ -532,128 +2063,296 @@ void DecklinkOutput::fill_decklink_video_frame(IDeckLinkVideoFrame* decklink_vid
 	mutex_.lock();
 
 	frames_mutex_.lock();
-    media_reader::ImageBufPtr the_frame = current_frame_;
+    media_reader::ImageBufPtr the_frame = standby ? media_reader::ImageBufPtr() : current_frame_;
 	frames_mutex_.unlock();
 
-    if (the_frame) {
-
-        auto tp = utility::clock::now();
-
-        if (the_frame->size() >= decklink_video_frame->GetRowBytes()*frame_height_) {
-
-            int xstudio_buf_pixel_format = the_frame->params().value("pixel_format", 0);
+    // We convert the image from xstudio once for each pixel format that our
+    // outputs use, however many outputs there are, and schedule the same
+    // frame on all of the outputs with that format. If xstudio hasn't sent
+    // a new image since last time we just re-send what we converted last time.
+    if (reanchor_video_.exchange(false)) reanchor_video_stream();
 
-            if (xstudio_buf_pixel_format == ui::viewport::RGBA_10_10_10_2) {
+    const char * error = nullptr;
+    bool schedule_failed = false;
+    bool intermediate_ready = false;
+    const SourceImage & source = source_image(the_frame);
+    for (const auto pix_fmt: output_pixel_formats_) {
 
-                if (decklink_video_frame->GetPixelFormat() != bmdFormat10BitRGB) {
+        DecklinkVideoFrame * frame = output_frame(pix_fmt, the_frame, source, intermediate_ready, error);
+        if (!frame) continue; // nothing to send, the card repeats its last frame
 
-                    // our xstudio frame is 10 bit RGB, so we need to do a conversion
-                    // N.B. Under testing this approach doesn't work, video output is
-                    // in wrong pixel format for any mode other than 10bit RGB. 
-                    // More work to be done.
+        if (!schedule_video_frame(frame)) {
+            schedule_failed = true;
+        }
+        frame->Release();
 
-                    if (!intermediate_frame_ || intermediate_frame_->GetWidth() != decklink_video_frame->GetWidth() || 
-                        intermediate_frame_->GetHeight() != decklink_video_frame->GetHeight()) {
-                        // new intermediate frame needed
-                        if (intermediate_frame_) intermediate_frame_->Release();
-                        intermediate_frame_ = new RGB10BitVideoFrame(decklink_video_frame->GetWidth(), decklink_video_frame->GetHeight(), decklink_video_frame->GetFlags());
-                    }
+    }
 
-                    // copy from xstudio frame to intermediate frame
-                    void*	pFrame;
-                    intermediate_frame_->GetBytes((void**)&pFrame);
-                    multithreadMemCopy(pFrame, the_frame->buffer(), intermediate_frame_->GetRowBytes()*frame_height_, 8);
+    // the preview is scaled from the same image
+    if (!error && !schedule_failed && preview_.running) {
+        if (DecklinkVideoFrame * frame = make_preview_frame(the_frame, source)) {
+            schedule_preview_frame(frame);
+            frame->Release();
+        }
+    }
 
-                    // do conversion
-                    auto result = frame_converter_->ConvertFrame(intermediate_frame_, decklink_video_frame);
-                    if (FAILED(result))
-                    {
-                        stop_sdi_output("Unable to convert frame pixel formats.");
-                    }
+    if (error || schedule_failed) {
+		mutex_.unlock();
+        // output_event_thread_ stops the output
+        post_output_event(schedule_failed ? OutputEvent::VideoScheduleFailed : OutputEvent::VideoConversionFailed);
+    } else {
+        if (!running_ && !standby) {
+            running_ = true;
+            post_output_event(OutputEvent::OutputRunning);
+        }
+        uiTotalFrames++;
+        mutex_.unlock();
+    }
 
-                } else {
+    if (startup) {
+        const uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(utility::clock::now() - now).count();
+        startup_frame_time_total_us_ += us;
+        if (us > startup_frame_time_max_us_) startup_frame_time_max_us_ = us;
+        startup_frames_++;
+    }
 
-                    void*	pFrame;
-                    decklink_video_frame->GetBytes((void**)&pFrame);
-                    multithreadMemCopy(pFrame, the_frame->buffer(), decklink_video_frame->GetRowBytes()*frame_height_, 8);
+    // If xstudio still has this image, dropping our reference under the
+    // lock can't free it. If xstudio has moved on ours may be the last
+    // reference and we don't want to be the ones freeing it, so it's queued
+    // for output_event_thread_. The queue only fills up if that thread has
+    // missed several frames, when all we can do is drop it here.
+    frames_mutex_.lock();
+    if (the_frame.get() == current_frame_.get()) {
+        the_frame = media_reader::ImageBufPtr();
+    } else if (retired_frames_count_ < retired_frames_.size()) {
+        retired_frames_[retired_frames_count_++] = std::move(the_frame);
+    }
+    frames_mutex_.unlock();
 
-                }
+}
 
-            } else if (xstudio_buf_pixel_format == ui::viewport::RGBA_16) {
+const DecklinkOutput::SourceImage & DecklinkOutput::source_image(const media_reader::ImageBufPtr & the_frame)
+{
+    // called with mutex_ held. We only look at each image from xstudio once.
+    if (!the_frame) {
+        source_frame_ = nullptr;
+        source_ = SourceImage();
+        return source_;
+    }
+    if (the_frame.get() == source_frame_) return source_;
+    source_frame_ = the_frame.get();
 
-                void*	pFrame;
-                decklink_video_frame->GetBytes((void**)&pFrame);
-                int num_pix = decklink_video_frame->GetWidth() * decklink_video_frame->GetHeight();
+    source_.pixel_format = the_frame->params().value("pixel_format", 0);
+    source_.buffer = the_frame->buffer();
+    source_.size = the_frame->size();
 
-                if (decklink_video_frame->GetPixelFormat() == bmdFormat10BitRGB) {
+    const size_t bytes_per_pixel = FrameGeometryAdapter::bytes_per_pixel(source_.pixel_format);
+    const size_t raster_size = size_t(frame_width_)*size_t(frame_height_)*bytes_per_pixel;
 
-                    pixel_swizzler_.cpy16bitRGBA_to_10bitRGB(pFrame, the_frame->buffer(), num_pix);
+    // formats we can't convert are left to convert_video_frame, which fails
+    if (!bytes_per_pixel) return source_;
 
-                } else if (decklink_video_frame->GetPixelFormat() == bmdFormat10BitRGBXLE) {
+    const auto & dims = the_frame->image_size_in_pixels();
+    const size_t width = size_t(std::max(dims.x, 0));
+    const size_t height = size_t(std::max(dims.y, 0));
+    const bool dims_known = width && height;
 
-                    pixel_swizzler_.cpy16bitRGBA_to_10bitRGBXLE(pFrame, the_frame->buffer(), num_pix);
+    if (dims_known ? (width == frame_width_ && height == frame_height_ && source_.size >= raster_size) : source_.size >= raster_size) {
+        return source_;
+    }
 
-                } else if (decklink_video_frame->GetPixelFormat() == bmdFormat10BitRGBX) {
+    adapted_frame_count_++;
+    source_.buffer = dims_known && source_.size >= width*height*bytes_per_pixel ?
+        geometry_adapter_.adapt(the_frame->buffer(), width, height, source_.pixel_format) : nullptr;
+    source_.size = geometry_adapter_.size();
+    return source_;
+}
 
-                    pixel_swizzler_.cpy16bitRGBA_to_10bitRGBX(pFrame, the_frame->buffer(), num_pix);
+DecklinkVideoFrame * DecklinkOutput::output_frame(
+    const BMDPixelFormat pix_fmt,
+    const media_reader::ImageBufPtr & the_frame,
+    const SourceImage & source,
+    bool & intermediate_ready,
+    const char *& error)
+{
+    // called with mutex_ held. Returns a frame with a reference for the
+    // caller, or nullptr if there's nothing to send. make_frame_pools makes
+    // the last_frames_ entry, so this doesn't allocate.
+    DecklinkVideoFrame *& last_frame = last_frames_[pix_fmt];
+    DecklinkVideoFrame * frame = nullptr;
 
-                } else if (decklink_video_frame->GetPixelFormat() == bmdFormat12BitRGB) {
+    if (last_frame && (!the_frame || last_frame->source_image() == the_frame.get())) {
 
-                    pixel_swizzler_.cpy16bitRGBA_to_12bitRGB(pFrame, the_frame->buffer(), num_pix);
+        frame = last_frame;
+        frame->AddRef();
 
-                } else if (decklink_video_frame->GetPixelFormat() == bmdFormat12BitRGBLE) {
+    } else {
 
-                    pixel_swizzler_.cpy16bitRGBA_to_12bitRGBLE(pFrame, the_frame->buffer(), num_pix);
+        frame = frame_pools_[pix_fmt]->try_acquire();
+        if (!frame) {
+            // every frame in the pool is queued on the card. Rather than
+            // allocating another we send the last one again.
+            post_output_event(OutputEvent::FramePoolExhausted);
+            if (last_frame) last_frame->AddRef();
+            return last_frame;
+        }
+        if (!source.buffer) {
+            // show black rather than whatever was in the frame before
+            pixel_swizzler_.clear(frame->bytes(), frame->size());
+        } else if (!convert_video_frame(source.buffer, source.size, source.pixel_format,
+            frame, intermediate_frame_, intermediate_ready)) {
+            error = "Unable to convert frame pixel formats.";
+        }
+        frame->set_source_image(the_frame.get());
+        if (last_frame) last_frame->Release();
+        last_frame = frame;
+        last_frame->AddRef();
 
-                }
+    }
+    return frame;
+}
 
+bool DecklinkOutput::convert_video_frame(
+    void * src_buffer,
+    const size_t src_size,
+    const int xstudio_buf_pixel_format,
+    DecklinkVideoFrame * decklink_video_frame,
+    RGB10BitVideoFrame *& intermediate_frame,
+    bool & intermediate_ready)
+{
+    // The source is always the raster of the frame we are converting into
+    // (see source_image and make_preview_frame), in xstudio's pixel format.
+    // Anything we can't convert goes out black rather than as whatever was
+    // left in the frame from before.
+    const size_t width = decklink_video_frame->GetWidth();
+    const size_t height = decklink_video_frame->GetHeight();
+    const size_t src_bytes_per_pixel = FrameGeometryAdapter::bytes_per_pixel(xstudio_buf_pixel_format);
+    const size_t src_row_bytes = width*src_bytes_per_pixel;
+    auto fail = [&]() {
+        pixel_swizzler_.clear(decklink_video_frame->bytes(), decklink_video_frame->size());
+        return false;
+    };
+    if (!src_bytes_per_pixel || src_size < src_row_bytes*height) return fail();
+
+    void * pFrame = decklink_video_frame->bytes();
+    const size_t row_bytes = decklink_video_frame->GetRowBytes();
+    const BMDPixelFormat pix_fmt = decklink_video_frame->GetPixelFormat();
+
+    if (xstudio_buf_pixel_format == ui::viewport::RGBA_10_10_10_2 && pix_fmt == bmdFormat10BitRGB) {
+
+        if (row_bytes == src_row_bytes) {
+            pixel_swizzler_.copy(pFrame, src_buffer, row_bytes*height);
+        } else {
+            // 10 bit RGB rows are padded to a multiple of 64 pixels
+            for (size_t y = 0; y < height; ++y) {
+                memcpy((uint8_t *)pFrame + y*row_bytes, (uint8_t *)src_buffer + y*src_row_bytes, src_row_bytes);
             }
+        }
+        return true;
+
+    } else if (xstudio_buf_pixel_format == ui::viewport::RGBA_16) {
+
+        if (pix_fmt == bmdFormat10BitRGB) {
+            pixel_swizzler_.cpy16bitRGBA_to_10bitRGB(pFrame, src_buffer, width, height, row_bytes);
+            return true;
+        } else if (pix_fmt == bmdFormat10BitRGBXLE) {
+            pixel_swizzler_.cpy16bitRGBA_to_10bitRGBXLE(pFrame, src_buffer, width, height, row_bytes);
+            return true;
+        } else if (pix_fmt == bmdFormat10BitRGBX) {
+            pixel_swizzler_.cpy16bitRGBA_to_10bitRGBX(pFrame, src_buffer, width, height, row_bytes);
+            return true;
+        } else if (pix_fmt == bmdFormat12BitRGB) {
+            pixel_swizzler_.cpy16bitRGBA_to_12bitRGB(pFrame, src_buffer, width, height, row_bytes);
+            return true;
+        } else if (pix_fmt == bmdFormat12BitRGBLE) {
+            pixel_swizzler_.cpy16bitRGBA_to_12bitRGBLE(pFrame, src_buffer, width, height, row_bytes);
+            return true;
+        }
 
+    }
 
+    // Everything else (e.g. YUV) goes through BMD's frame converter from an
+    // intermediate 10 bit RGB frame.
+    // N.B. Under testing this approach doesn't work for 10 bit RGB from
+    // xstudio, video output is in wrong pixel format for any mode other
+    // than 10bit RGB. More work to be done.
+    if (!intermediate_ready) {
+
+        // normally made in advance by make_frame_pools/start_preview
+        make_intermediate_frame(intermediate_frame, width, height, decklink_video_frame->GetFlags());
+
+        // copy from xstudio frame to intermediate frame. This is only
+        // done once per refresh, however many output formats use it.
+        void*	pIntermediate;
+        intermediate_frame->GetBytes((void**)&pIntermediate);
+        if (xstudio_buf_pixel_format == ui::viewport::RGBA_16) {
+            pixel_swizzler_.cpy16bitRGBA_to_10bitRGBX(pIntermediate, src_buffer, width, height, intermediate_frame->GetRowBytes());
+        } else {
+            pixel_swizzler_.copy(pIntermediate, src_buffer, intermediate_frame->GetRowBytes()*height);
         }
+        intermediate_ready = true;
     }
 
-	if (decklink_output_interface_->ScheduleVideoFrame(decklink_video_frame, (uiTotalFrames * frame_duration_), frame_duration_, frame_timescale_) != S_OK)
-	{
-		mutex_.unlock();
-        running_ = false;
-        decklink_xstudio_plugin_->stop();
-        report_error("Failed to schedule video frame.");
-		return;
-	}
-	
-    if (!running_) {
-        running_ = true;
-        report_status(fmt::format("Running in mode {}.", display_mode_name_), running_);
-        decklink_xstudio_plugin_->start(frameWidth(), frameHeight());
+    if (FAILED(frame_converter_->ConvertFrame(intermediate_frame, decklink_video_frame))) {
+        return fail();
     }
-	uiTotalFrames++;
-	mutex_.unlock();
-
-/* */
+    return true;
 }
 
-void DecklinkOutput::receive_samples_from_xstudio(int16_t * samples, unsigned long num_samps) 
+void DecklinkOutput::receive_samples_from_xstudio(const float * samples, unsigned long num_samps) 
 {
     // note this method is called by the xstudio audio output thread in a loop
     // that streams chunks of samples to an audio output device (i.e. this class)
-    // The xstudio audio output actor expects us to return from here only when the
-    // samples have been 'consumed'.
-    {
-        // lock mutex and immediately copy our samples to the buffer ready to
-        // send to Decklink
-        std::unique_lock lk2(audio_samples_buf_mutex_);
-        const size_t buf_size = audio_samples_buffer_.size();
-        audio_samples_buffer_.resize(buf_size+num_samps);
-        memcpy(audio_samples_buffer_.data()+buf_size, samples, num_samps*sizeof(int16_t));
+    // We copy the samples into our ring buffer and return straight away as long
+    // as the ring is below its high water mark. Only when xstudio has got well
+    // ahead of the SDI output do we make it wait, and then we let it go again
+    // once the ring has drained below the low water mark so that it can deliver
+    // several chunks in one go rather than waking up for every driver callback.
+    if (audio_ring_.frames_available() >= ring_high_water_) {
+
+        std::unique_lock lk(audio_samples_cv_mutex_);
+        xstudio_audio_thread_waiting_ = true;
+        // the timeout means we don't get stuck here if the SDI output is
+        // stopped and the driver isn't calling us back
+        audio_samples_cv_.wait_for(lk, std::chrono::milliseconds(100), [=] {
+            return audio_ring_.frames_available() < ring_low_water_;
+        });
+        xstudio_audio_thread_waiting_ = false;
+
     }
 
-    // now WAIT until the samples have been played (RenderAudioSamples is called
-    // from a Decklink driver thread - we only want to return from THIS function
-    // when Decklink needs a top-up of audio samples)
-    std::unique_lock lk(audio_samples_cv_mutex_);
-    audio_samples_cv_.wait(lk, [=] { return fetch_more_samples_from_xstudio_; });
-    fetch_more_samples_from_xstudio_ = false;
+    // Convert to the SDI sample type and apply our channel routing as we
+    // write straight into the ring's memory. If the ring is still full at
+    // this point the SDI output isn't consuming samples and there is no-one to
+    // play them to, so any overflow is dropped (and counted).
+    // Meter levels are measured in the same pass.
+    std::lock_guard l(audio_routing_mutex_);
+    if (audio_routing_.in_channels != audio_device_channels_) {
+        // a routing for a different layout is waiting for the output to be
+        // restarted, see set_audio_routing. There's nothing we can do with
+        // these until then.
+        audio_dropped_samples_ += num_samps/std::max(audio_device_channels_, 1);
+        return;
+    }
+    size_t num_frames = num_samps/audio_routing_.in_channels;
+    size_t frames_written = 0;
+    audio_levels_.reset();
+    for (int i = 0; i < 2 && num_frames; ++i) {
+        const auto region = audio_ring_.write_region();
+        const size_t n = std::min(region.second, num_frames);
+        if (!n) break;
+        convert_and_route_samples(region.first, samples, n, audio_routing_, &audio_levels_);
+        audio_ring_.commit(n);
+        samples += n*audio_routing_.in_channels;
+        num_frames -= n;
+        frames_written += n;
+    }
+    if (num_frames) {
+        audio_dropped_samples_ += num_frames;
+    }
+    if (frames_written) {
+        audio_meter_.accumulate(audio_levels_, frames_written, audio_routing_.out_channels);
+    }
 
 }
 
@@ -665,62 +2364,470 @@ long DecklinkOutput::num_samples_in_buffer() {
     std::unique_lock lk0(bmd_mutex_);
     uint32_t prerollAudioSampleCount;
 	if (decklink_output_interface_->GetBufferedAudioSampleFrameCount(&prerollAudioSampleCount) == S_OK) {
-        return (long)prerollAudioSampleCount - (audio_sync_delay_milliseconds_*48000)/1000;
+        return (long)prerollAudioSampleCount + (long)audio_ring_.frames_available() - (audio_sync_delay_milliseconds_*48000)/1000;
     }
     return 0;
 }
 
+void DecklinkOutput::set_audio_routing(const std::string & routing_preset)
+{
+    // throws if the preset isn't known
+    AudioRoutingMatrix routing = audio_routing_preset(routing_preset);
+
+    // xstudio asks for our channel count once, when it makes the audio
+    // output device (see audio_device_channels), so after that the layout
+    // can't change
+    std::lock_guard l(audio_routing_mutex_);
+    if (audio_device_channels_ && routing.in_channels != audio_device_channels_) {
+        throw std::runtime_error(fmt::format(
+            "Audio routing {} needs {} input channels. Restart xSTUDIO to apply it.",
+            routing_preset,
+            routing.in_channels));
+    }
+
+    // The ring and the card are set up for the current routing's channels,
+    // and the driver may be calling us now, so the new routing waits for
+    // configure_audio_buffers when output is next started
+    pending_audio_routing_ = routing;
+    audio_input_channels_ = routing.in_channels;
+    audio_routing_changed_ = true;
+}
+
+int DecklinkOutput::audio_device_channels()
+{
+    std::lock_guard l(audio_routing_mutex_);
+    audio_device_channels_ = audio_input_channels_;
+    return audio_device_channels_;
+}
+
+void DecklinkOutput::configure_audio_buffers()
+{
+    // (Re)allocate everything in the audio path that depends on the number
+    // of SDI channels. Only called when the driver audio thread is not
+    // running, so it is the one place where the audio buffers get allocated.
+    std::lock_guard l(audio_routing_mutex_);
+    if (!audio_routing_changed_ && !audio_history_.empty()) return;
+    if (audio_routing_changed_) audio_routing_ = pending_audio_routing_;
+    audio_routing_changed_ = false;
+
+    // the card takes 2, 8, 16 or 32 channels
+    const int out = audio_routing_.out_channels;
+    sdi_audio_channels_ = out <= 2 ? 2 : out <= 8 ? 8 : out <= 16 ? 16 : 32;
+    if (sdi_audio_channels_ != out) {
+        AudioRoutingMatrix padded(audio_routing_.in_channels, sdi_audio_channels_);
+        for (int i = 0; i < audio_routing_.in_channels; ++i) {
+            for (int o = 0; o < out; ++o) {
+                padded.set_gain(i, o, audio_routing_.gains[i*audio_routing_.padded_out_channels + o]);
+            }
+        }
+        audio_routing_ = padded;
+    }
+
+    const int ch = sdi_audio_channels_;
+    audio_ring_.resize(audio_ring_.capacity(), ch);
+    silence_buffer_.assign(silence_buffer_samples_*ch, 0);
+    audio_history_.assign(audio_history_frames_*ch, 0);
+    audio_scratch_.assign(audio_crossfade_frames_*ch, 0);
+    audio_crossfade_buffer_.assign(audio_crossfade_frames_*ch, 0);
+    seek_tail_.assign(audio_crossfade_frames_*ch, 0);
+    audio_crossfade_gains_.resize(audio_crossfade_frames_*ch);
+    make_crossfade_gains(audio_crossfade_gains_.data(), audio_crossfade_frames_, ch);
+}
+
+void DecklinkOutput::set_audio_samples_water_level(const int w)
+{
+    fixed_samples_water_level_ = (uint32_t)std::max(w, 256);
+    if (audio_buffering_profile_ == AudioBufferingProfile::Fixed) {
+        samples_water_level_ = fixed_samples_water_level_.load();
+        audio_chunk_samples_ = 2048;
+    }
+}
+
+void DecklinkOutput::set_audio_buffering_profile(const AudioBufferingProfile profile)
+{
+    audio_buffering_profile_ = profile;
+    if (profile == AudioBufferingProfile::Fixed) {
+        samples_water_level_ = fixed_samples_water_level_.load();
+        audio_chunk_samples_ = 2048;
+    }
+}
+
+namespace {
+
+    // Tuning for the adaptive audio buffering profiles. Water levels and
+    // chunk sizes are in sample frames at 48kHz.
+    struct AudioBufferingParams {
+        uint32_t min_water_level;
+        uint32_t max_water_level;
+        uint32_t min_chunk;
+        uint32_t max_chunk;
+        double intervals;          // callback intervals of audio to keep on the card
+        double jitter_multiplier;  // extra cover for callback jitter
+        double underrun_headroom;  // extra water level added for each underrun
+    };
+
+    const AudioBufferingParams low_latency_params = {1024, 8192, 256, 1024, 1.5, 3.0, 512.0};
+    const AudioBufferingParams robust_params = {4096, 16384, 1024, 2048, 3.0, 6.0, 2048.0};
+
+    uint32_t round_down_to_pow2(uint32_t v) {
+        uint32_t r = 1;
+        while ((r << 1) <= v) r <<= 1;
+        return r;
+    }
+}
+
+void DecklinkOutput::adapt_audio_buffering(const bool underrun)
+{
+    // called from the driver audio thread on every RenderAudioSamples. We 
+    // track the mean and (decaying) peak interval between callbacks. From these
+    // we pick the size of the chunks we ask xstudio for, the water level for
+    // the card and the ring's water marks. The latency profile keeps all of
+    // these as small as the measured callback jitter allows so that scrubbing
+    // is tight, the robust profile keeps a good safety margin. Underruns push
+    // the water level up, and that extra headroom decays away slowly again.
+    const auto now = utility::clock::now();
+    if (last_audio_callback_time_ == utility::time_point()) {
+        last_audio_callback_time_ = now;
+        return;
+    }
+
+    const double interval = std::chrono::duration<double>(now - last_audio_callback_time_).count();
+    last_audio_callback_time_ = now;
+    if (mean_audio_callback_interval_ == 0.0) mean_audio_callback_interval_ = interval;
+    mean_audio_callback_interval_ += (interval - mean_audio_callback_interval_) * 0.05;
+    peak_audio_callback_interval_ = std::max(interval, peak_audio_callback_interval_*0.995);
+
+    const AudioBufferingProfile profile = audio_buffering_profile_;
+    const AudioBufferingParams & params = profile == AudioBufferingProfile::LowLatency ? low_latency_params : robust_params;
+
+    if (underrun) {
+        underrun_headroom_ = std::min(underrun_headroom_ + params.underrun_headroom, double(params.max_water_level));
+    } else {
+        underrun_headroom_ *= 0.999;
+    }
+
+    const double mean_frames = mean_audio_callback_interval_ * 48000.0;
+    const double jitter_frames = std::max(0.0, peak_audio_callback_interval_ - mean_audio_callback_interval_) * 48000.0;
+
+    uint32_t chunk = 2048;
+    if (profile != AudioBufferingProfile::Fixed) {
+
+        // ask xstudio for roughly one callback interval of samples at a time
+        chunk = std::clamp(round_down_to_pow2(uint32_t(mean_frames)), params.min_chunk, params.max_chunk);
+        audio_chunk_samples_ = chunk;
+
+        samples_water_level_ = std::clamp(
+            uint32_t(mean_frames*params.intervals + jitter_frames*params.jitter_multiplier + underrun_headroom_),
+            params.min_water_level,
+            params.max_water_level);
+
+    }
+
+    const uint32_t max_low = uint32_t(audio_ring_.capacity()) - chunk*2;
+    const uint32_t low = std::min(
+        max_low,
+        std::max(chunk, uint32_t(2.0 * std::max(peak_audio_callback_interval_, mean_audio_callback_interval_) * 48000.0)));
+    ring_low_water_ = low;
+    ring_high_water_ = low + chunk;
+
+}
+
 // Note, I have not yet understood the significance of the preroll flag
 void DecklinkOutput::copy_audio_samples_to_decklink_buffer(const bool /*preroll*/) 
 {
 
+    apply_callback_thread_priority(audio_thread_priority_);
+
     std::unique_lock lk0(bmd_mutex_);
 
+    if (audio_flush_requested_.exchange(false)) {
+        flush_audio_for_seek();
+    }
+    if (reanchor_audio_.exchange(false)) {
+        reanchor_audio_stream(audio_seek_margin());
+    }
+
+    const uint32_t water_level = samples_water_level_;
+
     // How many samples are sitting on the SDI card ready to be played?
-	uint32_t prerollAudioSampleCount;
+	uint32_t prerollAudioSampleCount = 0;
 	if (decklink_output_interface_->GetBufferedAudioSampleFrameCount(&prerollAudioSampleCount) == S_OK) {
-        if (prerollAudioSampleCount > samples_water_level_) {
+        if (prerollAudioSampleCount > water_level && audio_stream_state_ != AudioStreamState::SeekPending) {
             // plenty of samples already in the bmd buffer ready to be played, 
             // let's do nothing here
+            adapt_audio_buffering(false);
             return;
-        } else {
-            // We need to top-up the samples in the buffer.
-
-            // the xstudio audio output thread is probably waiting in
-            // receive_samples_from_xstudio ... because the number of samples
-            // in the BMD buffer is below our target 'water_level' we now 
-            // release the lock in 'receive_samples_from_xstudio' so that the
-            // xstudio audio sample streaming loop can continue and fetch 
-            // more samples to give to us
+        }
+    }
+
+    if (standby_) {
+
+        // Nothing is playing. Keep the card topped up with silence and throw
+        // away anything that xstudio sends.
+        audio_ring_.consume(audio_ring_.frames_available());
+        audio_stream_state_ = AudioStreamState::Underrun;
+        if (prerollAudioSampleCount < water_level) {
+            schedule_silence(water_level - prerollAudioSampleCount);
+        }
+        if (xstudio_audio_thread_waiting_) {
             {
                 std::lock_guard m(audio_samples_cv_mutex_);
-                fetch_more_samples_from_xstudio_ = true;
             }
             audio_samples_cv_.notify_one();
         }
+        return;
     }
 
-    std::unique_lock lk(audio_samples_buf_mutex_);
+    if (audio_stream_state_ == AudioStreamState::SeekPending) {
+
+        // The card is playing out the last of the old audio up to the point
+        // where we want the new audio to start.
+        adapt_audio_buffering(false);
+        if (audio_ring_.frames_available() >= audio_crossfade_frames_) {
+
+            // audio for the new playhead position has arrived in time, so we
+            // crossfade from the old audio into it
+            audio_ring_.read(audio_scratch_.data(), audio_crossfade_frames_);
+            schedule_crossfade(seek_tail_.data(), audio_scratch_.data());
+            audio_stream_state_ = AudioStreamState::Streaming;
+            decklink_output_interface_->GetBufferedAudioSampleFrameCount(&prerollAudioSampleCount);
+
+        } else if (prerollAudioSampleCount < audio_seek_margin()) {
+
+            // we're about to run out of the old audio. Fade it out, and we
+            // will fade in the new audio when it turns up.
+            schedule_crossfade(seek_tail_.data(), silence_buffer_.data());
+            audio_stream_state_ = AudioStreamState::Underrun;
+            fade_in_pending_ = true;
+            return;
+
+        } else {
+            return;
+        }
+    }
 
-    if (audio_samples_buffer_.empty())
+    // We need to top-up the samples in the card buffer from our ring. 
+    if (!audio_ring_.frames_available())
     { 
-        // 512 samples of silence to start filling buffer in the absence
-        // of audio samples streaming from xstudio
-        audio_samples_buffer_.resize(4096);
-        memset(audio_samples_buffer_.data(), 0, audio_samples_buffer_.size()*sizeof(uint16_t));
+        // xstudio hasn't delivered anything. Top up the card with exactly
+        // enough silence to bring it back to the water level - unless we
+        // are waiting for audio following a seek, in which case we want the
+        // new audio to go out as soon as it arrives
+        const bool new_underrun = audio_stream_state_ == AudioStreamState::Streaming;
+        if (new_underrun) {
+            audio_stream_state_ = AudioStreamState::Underrun;
+            audio_underrun_count_++;
+        }
+        adapt_audio_buffering(new_underrun);
+        if (prerollAudioSampleCount < water_level && !fade_in_pending_) {
+            schedule_silence(water_level - prerollAudioSampleCount);
+        }
+
+    } else {
+
+        adapt_audio_buffering(false);
+
+        if (fade_in_pending_) {
+
+            if (audio_ring_.frames_available() < audio_crossfade_frames_) return;
+
+            // the card might have run dry while we waited for this audio
+            reanchor_audio_stream(audio_crossfade_frames_);
+            audio_ring_.read(audio_scratch_.data(), audio_crossfade_frames_);
+            schedule_crossfade(silence_buffer_.data(), audio_scratch_.data());
+            fade_in_pending_ = false;
+            decklink_output_interface_->GetBufferedAudioSampleFrameCount(&prerollAudioSampleCount);
+
+        }
+
+        audio_stream_state_ = AudioStreamState::Streaming;
+
+        // move enough samples across to bring the card back up to the water
+        // level, the rest stay in the ring. The ring wraps, so this can take
+        // two calls to ScheduleAudioSamples. The driver copies the samples so
+        // we can schedule straight from the ring's memory.
+        uint32_t deficit = water_level - std::min(prerollAudioSampleCount, water_level);
+        for (int i = 0; i < 2 && deficit; ++i) {
+
+            const auto region = audio_ring_.read_region();
+            const uint32_t n = std::min(uint32_t(region.second), deficit);
+            if (!n) break;
+
+            schedule_audio(region.first, n);
+            audio_ring_.consume(n);
+            deficit -= n;
+
+        }
     }
-	
-	if (decklink_output_interface_->ScheduleAudioSamples(
-        audio_samples_buffer_.data(),
-        audio_samples_buffer_.size()/2,
+
+    // if the xstudio audio thread is waiting for room in the ring, and we
+    // have now drained it below the low water mark, let it go
+    if (xstudio_audio_thread_waiting_ && audio_ring_.frames_available() < ring_low_water_) {
+        {
+            std::lock_guard m(audio_samples_cv_mutex_);
+        }
+        audio_samples_cv_.notify_one();
+    }
+
+}
+
+void DecklinkOutput::schedule_audio(const SDIAudioSample * samples, const uint32_t num_frames)
+{
+    // caller must hold bmd_mutex_
+    if (decklink_output_interface_->ScheduleAudioSamples(
+        (void *)samples,
+        num_frames,
         samples_delivered_,
         bmdAudioSampleRate48kHz,
         nullptr) != S_OK) {
-        throw std::runtime_error("Failed to shedule audio out.");
+        // we're on the driver's thread, output_event_thread_ reports it
+        post_output_event(OutputEvent::AudioScheduleFailed);
+        return;
+    }
+
+    // keep a copy of what we have scheduled, indexed by stream time, so that
+    // we can put back the audio that should keep playing if we flush the
+    // card buffer on a seek
+    uint64_t pos = samples_delivered_;
+    uint32_t remaining = num_frames;
+    while (remaining) {
+        const uint64_t offset = pos & (audio_history_frames_-1);
+        const uint32_t n = std::min(remaining, uint32_t(audio_history_frames_ - offset));
+        memcpy(audio_history_.data() + offset*sdi_audio_channels_, samples, n*sdi_audio_channels_*sizeof(SDIAudioSample));
+        samples += n*sdi_audio_channels_;
+        pos += n;
+        remaining -= n;
+    }
+
+    samples_delivered_ += num_frames;
+}
+
+void DecklinkOutput::schedule_silence(const uint32_t num_samps)
+{
+    // caller must hold bmd_mutex_
+    uint32_t remaining = num_samps;
+    while (remaining) {
+
+        const uint32_t n = std::min(remaining, silence_buffer_samples_);
+        schedule_audio(silence_buffer_.data(), n);
+        audio_silent_samples_ += n;
+        remaining -= n;
+
+    }
+}
+
+void DecklinkOutput::schedule_crossfade(const SDIAudioSample * fade_out, const SDIAudioSample * fade_in)
+{
+    crossfade_samples(
+        audio_crossfade_buffer_.data(),
+        fade_out,
+        fade_in,
+        audio_crossfade_gains_.data(),
+        audio_crossfade_frames_*sdi_audio_channels_);
+    schedule_audio(audio_crossfade_buffer_.data(), audio_crossfade_frames_);
+}
+
+void DecklinkOutput::copy_from_audio_history(SDIAudioSample * dst, uint64_t position, uint32_t num_frames) const
+{
+    while (num_frames) {
+        const uint64_t offset = position & (audio_history_frames_-1);
+        const uint32_t n = std::min(num_frames, uint32_t(audio_history_frames_ - offset));
+        memcpy(dst, audio_history_.data() + offset*sdi_audio_channels_, n*sdi_audio_channels_*sizeof(SDIAudioSample));
+        dst += n*sdi_audio_channels_;
+        position += n;
+        num_frames -= n;
+    }
+}
+
+uint32_t DecklinkOutput::audio_seek_margin() const
+{
+    // if the card holds less than this we need to act before the next
+    // RenderAudioSamples callback
+    return audio_crossfade_frames_ + uint32_t(2.0*mean_audio_callback_interval_*48000.0);
+}
+
+void DecklinkOutput::reanchor_audio_stream(const uint32_t lead)
+{
+    // make sure the next samples we schedule are not in the past
+    BMDTimeValue stream_time = 0;
+    double speed = 0.0;
+    if (decklink_output_interface_->GetScheduledStreamTime(bmdAudioSampleRate48kHz, &stream_time, &speed) == S_OK) {
+        samples_delivered_ = std::max(samples_delivered_, (unsigned long)(stream_time + lead));
     }
+}
+
+void DecklinkOutput::reanchor_video_stream()
+{
+    // Called from the frame callback with mutex_ held, after the reference
+    // lock has changed. If the card's clock has jumped ahead of our
+    // schedule, the next frame goes a preroll's worth ahead of where the
+    // card is now. Frame locked mirrors and the preview follow uiTotalFrames.
+    // Other mirrors are separate cards with their own reference.
+    BMDTimeValue stream_time = 0;
+    double speed = 0.0;
+    if (!frame_duration_ || decklink_output_interface_->GetScheduledStreamTime(frame_timescale_, &stream_time, &speed) != S_OK) {
+        return;
+    }
+    const uint32_t next_frame = uint32_t(stream_time/frame_duration_) + video_preroll_frames_;
+    if (next_frame > uiTotalFrames) {
+        reanchored_frame_count_ += next_frame - uiTotalFrames;
+        uiTotalFrames = next_frame;
+    }
+}
+
+void DecklinkOutput::flush_audio_for_seek()
+{
+    // caller must hold bmd_mutex_. The playhead has jumped so everything
+    // on the card, and what was in our ring when the jump was seen, is for
+    // the wrong position.
+    BMDTimeValue stream_time = 0;
+    double speed = 0.0;
+    if (decklink_output_interface_->GetScheduledStreamTime(bmdAudioSampleRate48kHz, &stream_time, &speed) != S_OK) {
+        return;
+    }
+
+    decklink_output_interface_->FlushBufferedAudioSamples();
+    // xstudio may already have sent audio for the new position, keep that
+    audio_ring_.consume_to(audio_flush_position_);
+
+    const unsigned long now = (unsigned long)stream_time;
+    const unsigned long old_end = samples_delivered_;
+    if (now >= old_end) {
+        // card had already run dry, new audio fades in when it arrives
+        samples_delivered_ = now;
+        audio_stream_state_ = AudioStreamState::Underrun;
+        fade_in_pending_ = true;
+        return;
+    }
+
+    // Old audio is put back to play out for one chunk (plus a safety margin)
+    // which is as long as it should take for audio at the new position to
+    // arrive. The old audio immediately after that point is held so that we
+    // can crossfade it into the new audio.
+    const unsigned long anchor = std::min(old_end, now + audio_chunk_samples_ + audio_seek_margin());
+
+    samples_delivered_ = now;
+    for (int i = 0; i < 2 && samples_delivered_ < anchor; ++i) {
+        // schedule straight from the history, it already holds these samples
+        const uint64_t offset = samples_delivered_ & (audio_history_frames_-1);
+        const uint32_t n = std::min(uint32_t(anchor - samples_delivered_), uint32_t(audio_history_frames_ - offset));
+        if (decklink_output_interface_->ScheduleAudioSamples(
+            audio_history_.data() + offset*sdi_audio_channels_,
+            n,
+            samples_delivered_,
+            bmdAudioSampleRate48kHz,
+            nullptr) != S_OK) {
+            post_output_event(OutputEvent::AudioScheduleFailed);
+            break;
+        }
+        samples_delivered_ += n;
+    }
+
+    const uint32_t tail = std::min(uint32_t(old_end - anchor), audio_crossfade_frames_);
+    copy_from_audio_history(seek_tail_.data(), anchor, tail);
+    std::fill(seek_tail_.begin() + tail*sdi_audio_channels_, seek_tail_.end(), 0);
 
-    samples_delivered_ += audio_samples_buffer_.size()/2;
-    audio_samples_buffer_.clear();
+    audio_stream_state_ = AudioStreamState::SeekPending;
 
 }
 
@@ -759,9 +2866,9 @@ ULONG AVOutputCallback::Release ()
 	return (ULONG)(oldValue - 1);
 }
 
-HRESULT	AVOutputCallback::ScheduledFrameCompleted (IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult /*result*/)
+HRESULT	AVOutputCallback::ScheduledFrameCompleted (IDeckLinkVideoFrame* /*completedFrame*/, BMDOutputFrameCompletionResult result)
 {
-	owner_->fill_decklink_video_frame(completedFrame);
+	owner_->fill_decklink_video_frame(result);
 	return S_OK;
 }
 
@@ -5,10 +5,28 @@
 #include <atomic>
 #include <deque>
 #include <vector>
+#include <thread>
+#include <condition_variable>
+#include <array>
+#include <semaphore.h>
 
 #include "extern/DeckLinkAPI.h"
 #include "xstudio/media_reader/image_buffer.hpp"
+#include "xstudio/utility/chrono.hpp"
+#include "conversion_worker_pool.hpp"
 #include "pixel_swizzler.hpp"
+#include "audio_ring_buffer.hpp"
+#include "audio_dsp.hpp"
+#include "decklink_device_discovery.hpp"
+#include "display_mode_index.hpp"
+#include "frame_downscaler.hpp"
+#include "frame_geometry_adapter.hpp"
+#include "decklink_profile_manager.hpp"
+#include "decklink_video_frame.hpp"
+#include "decklink_output_host.hpp"
+#include "realtime_event_ring.hpp"
+#include "thread_scheduling.hpp"
+#include "device_telemetry.hpp"
 
 namespace xstudio {
     namespace bm_decklink_plugin_1_0 {
@@ -51,29 +69,104 @@ public:
 	virtual ULONG			STDMETHODCALLTYPE	Release();
 };
 
-class BMDecklinkPlugin;
+// How the audio chunk size and card water level are tuned at runtime
+enum class AudioBufferingProfile { LowLatency, Robust, Fixed };
+
+// How the main output is carried over SDI. Auto leaves the card as it is.
+enum class SDILinkConfiguration { Auto, SingleLink, DualLink, QuadLinkSquareDivision, QuadLinkSampleInterleave };
 
 class DecklinkOutput
 {
 
 public:
 
-	DecklinkOutput(BMDecklinkPlugin * decklink_xstudio_plugin);
+	DecklinkOutput(DecklinkOutputHost * decklink_xstudio_plugin);
 	~DecklinkOutput();
 
+	// Returns straight away, the driver is loaded and devices are found on
+	// a background thread which reports its progress through the plugin's
+	// status callback
 	bool init_decklink();
 
+	// Other devices that show the same picture as the main output. A
+	// pixel_format of 0 means use the same pixel format as the main output.
+	struct MirrorOutputConfig {
+		std::string device_name;
+		BMDPixelFormat pixel_format = {0};
+	};
+	void set_mirror_outputs(const std::vector<MirrorOutputConfig> & mirrors);
+
+	// A lower resolution copy of the main output on another device (or sub-
+	// device), e.g. an HD feed for a client monitor next to a UHD grading
+	// display. It is downscaled from the same render as the main output, in
+	// the same pixel format and at the same frame rate. An empty device_name
+	// means no preview output. Takes effect when output is next started.
+	struct PreviewOutputConfig {
+		std::string device_name;
+		std::string resolution = {"1920 x 1080"};
+	};
+	void set_preview_output(const PreviewOutputConfig & preview);
+
+	// Put the main output and its mirrors in one Decklink playback group so
+	// that they are frame locked. Takes effect when output is next started.
+	void set_frame_lock_outputs(const bool lock) { frame_lock_outputs_ = lock; }
+
+	// Takes effect when output is next started
+	void set_sdi_link_configuration(const SDILinkConfiguration link) { sdi_link_configuration_ = link; }
+
+	// Select the device to output to by name. The special name
+	// first_available_device picks whichever device the driver lists first.
+	void set_device(const std::string & device_name);
+	inline static const std::string first_available_device = {"First Available Device"};
+
+	// Switch the device to the named profile (see DecklinkProfileManager).
+	// unchanged_profile leaves the device in whatever profile it is in. The
+	// profile is applied to whichever device we are using, when it's opened.
+	void set_device_profile(const std::string & profile_name);
+	inline static const std::string unchanged_profile = {"Unchanged"};
+
+	// With warm standby, stopping output leaves the card running and sending
+	// black (so monitors keep sync) while xstudio stops rendering for us.
+	// Starting again is then just a matter of the next refresh.
+	void set_warm_standby(const bool warm_standby);
+
+	// Realtime scheduling for the threads that feed the card: the driver's
+	// callback threads, output_event_thread_ and the conversion workers. The
+	// workers can also be confined to a set of cores, e.g. "2-7" (empty
+	// for any core). Throws if the core list doesn't parse.
+	void set_thread_scheduling(const ThreadPriority & priority, const std::string & conversion_cores);
+
+	// The NUMA node that the conversion threads and frame buffers go on.
+	// numa_node_auto uses the card's node, numa_node_off any node. New
+	// buffers are made on the node when output is next started.
+	static constexpr int numa_node_auto = {-1};
+	static constexpr int numa_node_off = {-2};
+	void set_numa_node(const int node);
+
+	// Genlock timing adjustment, in pixels, for the card's reference input.
+	// Takes effect straight away on the open device, and on any device that
+	// is opened later.
+	void set_reference_timing_offset(const int offset);
+
 	bool start_sdi_output();
     void set_preroll();
 	bool stop_sdi_output(const std::string &error = std::string());
 	void StartStop();
 
-	void fill_decklink_video_frame(IDeckLinkVideoFrame* decklink_video_frame);
+	void fill_decklink_video_frame(const BMDOutputFrameCompletionResult result);
 	void copy_audio_samples_to_decklink_buffer(const bool preroll);
-	void receive_samples_from_xstudio(int16_t * samples, unsigned long num_samps);
+	void receive_samples_from_xstudio(const float * samples, unsigned long num_samps);
 	long num_samples_in_buffer();
 	void set_display_mode(const std::string & resolution, const std::string  &refresh_rate, const BMDPixelFormat pix_format);
-	void set_audio_samples_water_level(const int w) { samples_water_level_ = (uint32_t)w; }
+	void set_audio_samples_water_level(const int w);
+	void set_audio_buffering_profile(const AudioBufferingProfile profile);
+	[[nodiscard]] long audio_chunk_samples() const { return audio_chunk_samples_; }
+	[[nodiscard]] uint32_t audio_samples_water_level() const { return samples_water_level_; }
+	void set_flush_audio_on_seek(const bool flush) { flush_audio_on_seek_ = flush; }
+	void set_audio_routing(const std::string & routing_preset);
+	// Called once, by DecklinkAudioOutputDevice when xstudio makes it. The
+	// channel layout it reports then can't change, see set_audio_routing.
+	int audio_device_channels();
 	void set_audio_sync_delay_milliseconds(const long ms_delay) { audio_sync_delay_milliseconds_ = ms_delay; }
 
 	void incoming_frame(const media_reader::ImageBufPtr & frame);
@@ -83,18 +176,31 @@ public:
 
 	std::vector<std::string> get_available_refresh_rates(const std::string & output_resolution) const;
 
-	std::vector<std::string> output_resolution_names() const {
-		std::vector<std::string> result;
-		for (const auto &p: refresh_rate_per_output_resolution_) {
-			result.push_back(p.first);
-		}
-		std::sort(result.begin(), result.end());
-		return result;
-	}	
+	std::vector<std::string> output_resolution_names() const;
+
+	// the pixel formats that the device can output in the given mode
+	std::vector<BMDPixelFormat> get_available_pixel_formats(const std::string & output_resolution, const std::string & refresh_rate) const;
+
+protected:
+
+	// For running the output without the Decklink driver, on devices that
+	// don't come from it, as test/callback_allocation_test.cpp does.
+
+	// What init_decklink does, with frame_converter (which gets a reference)
+	// in place of the driver's and without a profile manager. The discovery
+	// returned doesn't look for devices itself, they are announced to it
+	// with DeckLinkDeviceArrived.
+	DecklinkDeviceDiscovery * init_without_driver(IDeckLinkVideoConversion * frame_converter);
+
+	// what incoming_frame does when the playhead jumps
+	void request_audio_flush();
+
+	// the threads that share each conversion with the frame callback
+	std::vector<std::thread::native_handle_type> conversion_threads() { return conversion_workers_.native_handles(); }
 
 private:
 
-	AVOutputCallback*		            output_callback_;
+	AVOutputCallback*		            output_callback_ = {nullptr};
 	std::mutex  				mutex_;
 
 	GLenum				glStatus;
@@ -107,7 +213,23 @@ private:
 	
 	IDeckLink*					decklink_interface_;
 	IDeckLinkOutput*			decklink_output_interface_;
-	IDeckLinkVideoConversion *  frame_converter_;
+	IDeckLinkVideoConversion *  frame_converter_ = {nullptr};
+
+	// The driver tells us about devices coming and going via device_discovery_.
+	// device_mutex_ protects the device we have open and its display modes.
+	DecklinkDeviceDiscovery *	device_discovery_ = {nullptr};
+	bool						discovery_complete_ = {false};
+	std::thread					init_thread_;
+
+	void initialise_driver();
+
+	std::string					selected_device_name_ = {first_available_device};
+	std::string					current_device_name_;
+	mutable std::mutex			device_mutex_;
+
+	DecklinkProfileManager *	profile_manager_ = {nullptr};
+	std::string					requested_profile_ = {unchanged_profile};
+	bool						restart_after_profile_change_ = {false};
 	
 	BMDTimeValue				frame_duration_;
 	BMDTimeScale				frame_timescale_;
@@ -118,31 +240,413 @@ private:
 	std::mutex  				frames_mutex_;
 	bool						running_ = {false};
 
+	// output_enabled_ is true from start_sdi_output to stop_sdi_output, while
+	// the card is clocked. standby_ is set while it's sending black.
+	bool						output_enabled_ = {false};
+	std::atomic<bool>			standby_ = {false};
+	std::atomic<bool>			warm_standby_ = {false};
+
+	void enter_standby();
+
+	// Applies a change of display mode or pixel format while output is
+	// enabled. A pixel format change is done at a frame boundary without
+	// stopping the card, a new raster re-enables video output.
+	void reconfigure_output();
+
+	bool switch_pixel_format();
+
+	void leave_standby();
+
+	// The image that we convert for the card. This is xstudio's image unless
+	// it isn't the size of our raster, in which case it is geometry_adapter_'s
+	// fitted copy of it. A null buffer means there's nothing usable to show.
+	struct SourceImage {
+		void * buffer = {nullptr};
+		size_t size = {0};
+		int pixel_format = {0};
+	};
+
 	void query_display_modes();
+
+	void devices_changed();
+
+	void open_selected_device();
+
+	bool open_device(IDeckLink * device, const std::string & device_name);
+
+	void close_device(const std::string & reason);
+
+	void report_devices();
+
+	void apply_device_profile();
+
+	void profile_changing(const bool streams_will_stop);
+
+	void profile_activated();
+
+	void update_mirrors();
+
+	void start_mirrors();
+
+	void stop_mirrors();
+
+	void update_preview();
+
+	void start_preview();
+
+	void stop_preview();
+
+	void close_preview();
+
+	void schedule_preview_frame(DecklinkVideoFrame * frame);
+
+	DecklinkVideoFrame * make_preview_frame(const media_reader::ImageBufPtr & the_frame, const SourceImage & source);
+
+	bool schedule_video_frame(DecklinkVideoFrame * frame);
+
+	void make_frame_pools();
+
+	void configure_sdi_link();
+	void unwind_failed_start();
+
+	const SourceImage & source_image(const media_reader::ImageBufPtr & the_frame);
+
+	// The frame to schedule in pix_fmt for the_frame: the last one if it was
+	// converted from the same image, otherwise a new conversion
+	DecklinkVideoFrame * output_frame(
+		const BMDPixelFormat pix_fmt,
+		const media_reader::ImageBufPtr & the_frame,
+		const SourceImage & source,
+		bool & intermediate_ready,
+		const char *& error);
+
+	// Converts an image in one of xstudio's viewport pixel formats into the
+	// format of decklink_video_frame. The intermediate frame is only used
+	// for formats that go through BMD's frame converter.
+	bool convert_video_frame(
+		void * src_buffer,
+		const size_t src_size,
+		const int xstudio_buf_pixel_format,
+		DecklinkVideoFrame * decklink_video_frame,
+		RGB10BitVideoFrame *& intermediate_frame,
+		bool & intermediate_ready);
 		
 	void report_status(const std::string & status_message, bool is_running);
 	
 	void report_error(const std::string & status_message);
 
-	std::map<std::string, std::vector<std::string>> refresh_rate_per_output_resolution_;
-	std::map<std::pair<std::string, std::string>, BMDDisplayMode> display_modes_;
+	void configure_audio_buffers();
 
+	void schedule_audio(const SDIAudioSample * samples, const uint32_t num_frames);
+
+	void schedule_silence(const uint32_t num_samps);
+
+	void schedule_crossfade(const SDIAudioSample * fade_out, const SDIAudioSample * fade_in);
+
+	void copy_from_audio_history(SDIAudioSample * dst, uint64_t position, uint32_t num_frames) const;
+
+	[[nodiscard]] uint32_t audio_seek_margin() const;
+
+	void reanchor_audio_stream(const uint32_t lead);
+	void reanchor_video_stream();
+
+	void flush_audio_for_seek();
+
+	void adapt_audio_buffering(const bool underrun);
+
+	void metrics_publisher_loop();
+
+	DisplayModeIndex display_mode_index_;
+
+	// the mode and format that output is running in, and the ones that
+	// set_display_mode has asked for next time it starts
 	BMDPixelFormat current_pix_format_;
 	BMDDisplayMode current_display_mode_;
+	BMDPixelFormat requested_pix_format_ = {bmdFormat10BitYUV};
+	BMDDisplayMode requested_display_mode_ = {bmdModeUnknown};
 	std::string display_mode_name_;
 
 	RGB10BitVideoFrame * intermediate_frame_ = {nullptr};
 
-	BMDecklinkPlugin * decklink_xstudio_plugin_;
-
-	std::vector<int16_t> audio_samples_buffer_;
-	std::mutex audio_samples_buf_mutex_, audio_samples_cv_mutex_, bmd_mutex_;
+	// Pixel conversion of each frame is split across these threads. How it
+	// is split depends on the SDI link configuration.
+	static constexpr int conversion_threads_ = {8};
+	ConversionWorkerPool conversion_workers_{conversion_threads_};
+	PixelSwizzler pixel_swizzler_ = {conversion_workers_};
+	std::atomic<SDILinkConfiguration> sdi_link_configuration_ = {SDILinkConfiguration::Auto};
+
+	// Video only outputs on other devices, fed from the same conversions as
+	// the main output. Scheduled from the main output's frame callback.
+	struct MirrorOutput {
+		std::string device_name;
+		BMDPixelFormat requested_pixel_format = {0};
+		BMDPixelFormat pixel_format = {0};
+		IDeckLink * device = {nullptr};
+		IDeckLinkOutput * output = {nullptr};
+		BMDTimeValue frames_scheduled = {0};
+		bool running = {false};
+		bool frame_locked = {false};
+	};
+	void close_mirror(MirrorOutput & m);
+
+	bool join_playback_group(IDeckLink * device, const bool join);
+
+	static constexpr int64_t playback_group_id_ = {0x78737464};
+	std::atomic<bool> frame_lock_outputs_ = {false};
+	bool frame_locked_ = {false};
+
+	std::vector<MirrorOutputConfig> mirror_config_;
+	std::vector<MirrorOutput> mirrors_;
+
+	// Frames from xstudio that don't match our raster (usually for a frame
+	// or two after a mode change) are centred or scaled to fit
+	FrameGeometryAdapter geometry_adapter_{conversion_workers_};
+	const media_reader::ImageBuffer * source_frame_ = {nullptr};
+	SourceImage source_;
+	std::atomic<uint64_t> adapted_frame_count_ = {0};
+
+	// The downconverted preview output. Its frames come from their own pool,
+	// are scaled from the main output's source image by downscaler_ and are
+	// scheduled alongside the main output's frames.
+	struct PreviewOutput {
+		std::string device_name;
+		IDeckLink * device = {nullptr};
+		IDeckLinkOutput * output = {nullptr};
+		BMDDisplayMode display_mode = {bmdModeUnknown};
+		std::shared_ptr<VideoFramePool> frame_pool;
+		DecklinkVideoFrame * last_frame = {nullptr};
+		std::vector<uint8_t> scaled_image;
+		RGB10BitVideoFrame * intermediate_frame = {nullptr};
+		BMDTimeValue frames_scheduled = {0};
+		bool running = {false};
+		bool frame_locked = {false};
+	};
+	PreviewOutputConfig preview_config_;
+	PreviewOutput preview_;
+	FrameDownscaler downscaler_{conversion_workers_};
+
+	// Frames that we convert into, one pool per pixel format in use, and the
+	// last frame we converted in each format
+	static constexpr size_t video_frame_pool_size_ = {6};
+	std::vector<BMDPixelFormat> output_pixel_formats_;
+	std::map<BMDPixelFormat, std::shared_ptr<VideoFramePool>> frame_pools_;
+	std::map<BMDPixelFormat, DecklinkVideoFrame *> last_frames_;
+
+	DecklinkOutputHost * decklink_xstudio_plugin_;
+
+	// Samples from xstudio wait here until the Decklink driver asks for them.
+	// Written by the xstudio audio thread, read by the driver audio thread.
+	AudioRingBuffer<SDIAudioSample> audio_ring_ = {AudioRingBuffer<SDIAudioSample>(32768, 2)};
+	std::mutex audio_samples_cv_mutex_, bmd_mutex_;
 	std::condition_variable audio_samples_cv_;
-	bool fetch_more_samples_from_xstudio_ = {false};
+	std::atomic<bool> xstudio_audio_thread_waiting_ = {false};
 	unsigned long samples_delivered_ = {0};
-	uint32_t samples_water_level_ = {4096};
+
+	// The xstudio audio thread is only made to wait when the ring holds more
+	// than ring_high_water_ frames, and is released once it drops below
+	// ring_low_water_. These, the xstudio chunk size and the card water level
+	// are derived from the measured interval (and jitter) between
+	// RenderAudioSamples callbacks and from underruns - see adapt_audio_buffering
+	std::atomic<uint32_t> ring_low_water_ = {4096};
+	std::atomic<uint32_t> ring_high_water_ = {6144};
+	std::atomic<uint32_t> audio_chunk_samples_ = {2048};
+	std::atomic<AudioBufferingProfile> audio_buffering_profile_ = {AudioBufferingProfile::Fixed};
+	std::atomic<uint32_t> fixed_samples_water_level_ = {4096};
+	utility::time_point last_audio_callback_time_;
+	double mean_audio_callback_interval_ = {0.0};
+	double peak_audio_callback_interval_ = {0.0};
+	double underrun_headroom_ = {0.0};
+	std::atomic<uint32_t> samples_water_level_ = {4096};
 	long audio_sync_delay_milliseconds_ = {0};
-	PixelSwizzler pixel_swizzler_;
+
+	// Preallocated block of zeros that we schedule (in chunks, if needed) when
+	// xstudio has not delivered any audio. Allocated once in the constructor
+	// so the driver audio thread never touches the heap.
+	static constexpr uint32_t silence_buffer_samples_ = {8192};
+	std::vector<SDIAudioSample> silence_buffer_;
+
+	// xstudio gives us float samples with audio_input_channels_ per frame.
+	// These are converted and routed to sdi_audio_channels_ of 32 bit
+	// integer samples as they go into the ring.
+	// A new routing is held in pending_audio_routing_ (with
+	// audio_routing_changed_ set) until configure_audio_buffers swaps it in
+	// at the next start. audio_device_channels_ is what the xstudio audio
+	// device reported, 0 until it's made. All protected by
+	// audio_routing_mutex_.
+	AudioRoutingMatrix audio_routing_;
+	AudioRoutingMatrix pending_audio_routing_;
+	std::mutex audio_routing_mutex_;
+	bool audio_routing_changed_ = {false};
+	std::atomic<int> audio_input_channels_ = {0};
+	int audio_device_channels_ = {0};
+	int sdi_audio_channels_ = {2};
+
+	enum class AudioStreamState { Streaming, Underrun, SeekPending };
+	AudioStreamState audio_stream_state_ = {AudioStreamState::Streaming};
+	std::atomic<uint64_t> audio_underrun_count_ = {0};
+	std::atomic<uint64_t> audio_silent_samples_ = {0};
+	std::atomic<uint64_t> audio_dropped_samples_ = {0}; // ring full, see receive_samples_from_xstudio
+
+	// Seek handling. When the playhead jumps we flush the card and the old
+	// audio in the ring, let the old audio (replayed from audio_history_) run
+	// on for one chunk and then crossfade from it into the audio for the new
+	// position.
+	static constexpr uint32_t audio_crossfade_frames_ = {256};
+	static constexpr uint64_t audio_history_frames_ = {32768};
+	std::vector<SDIAudioSample> audio_history_;
+	std::vector<SDIAudioSample> audio_scratch_;
+	std::vector<SDIAudioSample> audio_crossfade_buffer_;
+	std::vector<SDIAudioSample> seek_tail_;
+	std::vector<float> audio_crossfade_gains_;
+	std::atomic<bool> audio_flush_requested_ = {false};
+	std::atomic<size_t> audio_flush_position_ = {0};	// audio_ring_ write position at the seek
+	std::atomic<bool> flush_audio_on_seek_ = {true};
+	bool fade_in_pending_ = {false};
+	timebase::flicks last_frame_timestamp_;
+	bool have_last_frame_timestamp_ = {false};
+	utility::time_point last_frame_time_;
+	double timeline_rate_ = {0.0}; // timeline seconds per second, negative in reverse
+
+	// peak/rms levels of the audio going to the card, measured by the
+	// xstudio audio thread and read by the metrics thread
+	static constexpr int meter_updates_per_second_ = 10;
+	AudioLevels audio_levels_;
+	AudioMeter audio_meter_;
+
+	// low rate thread that pushes our counters to the plugin attributes
+	std::thread metrics_thread_;
+	std::mutex metrics_mutex_;
+	std::condition_variable metrics_cv_;
+	bool exit_metrics_thread_ = {false};
+
+	// The frame and audio callbacks run on the driver's threads and must
+	// not allocate, throw or call into xstudio. What they have to tell
+	// xstudio (frame requests, errors) is posted here and dealt with on
+	// output_event_thread_.
+	struct OutputEvent {
+		enum Type : uint8_t {
+			RequestVideoFrame,
+			VideoFrameConsumed,
+			OutputRunning,
+			VideoScheduleFailed,
+			VideoConversionFailed,
+			MirrorScheduleFailed,
+			PreviewScheduleFailed,
+			PreviewConversionFailed,
+			FramePoolExhausted,
+			AudioScheduleFailed,
+			NumTypes
+		};
+		Type type;
+		uint32_t generation;		// output_generation_ when it was posted
+		int index;					// which mirror, for MirrorScheduleFailed
+		utility::time_point time;
+	};
+
+	void post_output_event(const OutputEvent::Type type, const int index = 0, const utility::time_point time = utility::time_point());
+	void output_event_loop();
+	void handle_output_event(const OutputEvent & event);
+	void release_last_frames();
+
+	RealtimeEventRing<OutputEvent, 256> output_events_;
+	std::thread output_event_thread_;
+	// posted once per event, sem_post doesn't block or allocate so the
+	// driver threads can wake output_event_thread_ without taking a lock
+	sem_t output_events_wake_;
+	std::atomic<bool> exit_output_event_thread_ = {false};
+
+	// counts calls to start_sdi_output, so that errors from an earlier run
+	// of the output are ignored
+	std::atomic<uint32_t> output_generation_ = {0};
+
+	// warnings are logged once per run of the output
+	std::array<uint32_t, OutputEvent::NumTypes> warned_generation_ = {};
+
+	// When xstudio has moved on to another image during a frame callback,
+	// the callback's reference may be the last one. It queues the image here
+	// for output_event_thread_ to drop, which it does each time it wakes (at
+	// least once per frame). Protected by frames_mutex_.
+	std::array<media_reader::ImageBufPtr, 8> retired_frames_;
+	size_t retired_frames_count_ = {0};
+
+	// See set_thread_scheduling. The driver's threads apply the requested
+	// priority to themselves when thread_priority_generation_ changes, and
+	// leave what they got in output_thread_policy_/priority_ for the metrics
+	// thread to report. Normal leaves a driver thread as the driver set it
+	// up, unless we raised it before, when it goes back to how it was.
+	struct CallbackThreadPriority {
+		uint32_t generation = {0};			// thread_priority_generation_ applied
+		pthread_t thread = {};
+		bool raised = {false};				// we changed thread's priority
+		ThreadPriority driver_priority;		// what thread had before that
+	};
+	void apply_callback_thread_priority(CallbackThreadPriority & applied);
+	std::atomic<int> requested_thread_policy_ = {int(ThreadPolicy::Normal)};
+	std::atomic<int> requested_thread_priority_ = {0};
+	std::atomic<uint32_t> thread_priority_generation_ = {1};
+	CallbackThreadPriority video_thread_priority_;
+	CallbackThreadPriority audio_thread_priority_;
+	std::atomic<int> output_thread_policy_ = {-1};
+	std::atomic<int> output_thread_priority_ = {0};
+	std::string conversion_thread_scheduling_; // protected by metrics_mutex_
+
+	// Where the conversion threads run, and so where the frame buffers they
+	// zero end up. See place_conversion_threads. Protected by device_mutex_.
+	void place_conversion_threads();
+	ThreadPriority conversion_priority_;
+	std::vector<int> conversion_cores_;
+	int requested_numa_node_ = {numa_node_auto};
+	int device_numa_node_ = {-1};
+	int numa_node_ = {-1};
+	std::vector<int> numa_cores_;
+	int frame_pools_numa_node_ = {-1};
+
+	// The card's reference (genlock) input. The metrics thread polls the
+	// lock state and, when it changes, asks the frame and audio callbacks to
+	// re-anchor their schedules to the card's clock. See
+	// poll_reference_status.
+	static constexpr uint32_t video_preroll_frames_ = {3};
+	void apply_reference_timing_offset();
+	void poll_reference_status();
+	int reference_timing_offset_ = {0}; // protected by device_mutex_
+	std::atomic<bool> reanchor_video_ = {false};
+	std::atomic<bool> reanchor_audio_ = {false};
+	std::atomic<uint64_t> reanchored_frame_count_ = {0};
+
+	// only used by the metrics thread
+	struct ReferenceState {
+		std::string status;
+		std::string changed_at;
+		int64_t timing_offset = {0};
+		uint64_t losses = {0};
+		uint64_t reanchored_frames = {0};
+	};
+	ReferenceState reference_state_;
+	bool reference_state_sent_ = {false};
+
+	// PCIe link, temperature etc. of the card, read by the metrics thread
+	// once a second. See DeviceTelemetry.
+	void poll_device_telemetry();
+	int pcie_max_link_width_ = {0}; // protected by device_mutex_
+	DeviceTelemetry device_telemetry_;
+	bool device_telemetry_sent_ = {false};
+
+	// One of every conversion, run before the card is started so that the
+	// first frames don't pay for cold threads, caches and page faults
+	void warm_up();
+
+	// How the first frames after a start went: time spent in the frame
+	// callback and frames the card reports as late or dropped. Written by
+	// the frame callback, reported by the metrics thread.
+	static constexpr uint32_t startup_window_frames_ = {48};
+	std::atomic<uint32_t> startup_frames_ = {0};
+	std::atomic<uint64_t> startup_frame_time_total_us_ = {0};
+	std::atomic<uint64_t> startup_frame_time_max_us_ = {0};
+	std::atomic<uint32_t> startup_late_frames_ = {0};
+	std::atomic<uint32_t> startup_dropped_frames_ = {0};
+	std::atomic<uint64_t> warm_up_us_ = {0};
+	std::atomic<uint64_t> late_frame_count_ = {0};
+	std::atomic<uint64_t> dropped_frame_count_ = {0};
 
 };
 
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "xstudio/utility/chrono.hpp"
+#include "xstudio/utility/json_store.hpp"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief What DecklinkOutput needs from xstudio.
+     *
+     *  @details
+     *   BMDecklinkPlugin passes these on to its offscreen viewport and the
+     *   UI. Keeping them behind an interface means DecklinkOutput can be
+     *   driven without xstudio running, as the callback allocation test
+     *   (test/callback_allocation_test.cpp) does.
+     */
+    class DecklinkOutputHost {
+
+      public:
+        virtual ~DecklinkOutputHost() = default;
+
+        // status updates, see BMDecklinkPlugin::receive_status_callback
+        virtual void send_output_status(const utility::JsonStore &status) = 0;
+
+        // start and stop rendering frames of this size for the output
+        virtual void start_rendering(const int width, const int height) = 0;
+        virtual void stop_rendering() = 0;
+
+        // render the frame that goes on screen at this time
+        virtual void request_render(const utility::time_point &when) = 0;
+
+        // the card put a frame on screen at this time
+        virtual void frame_displayed(const utility::time_point &when) = 0;
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -9,6 +9,7 @@
 #include "decklink_audio_device.hpp"
 #include "decklink_plugin.hpp"
 #include "decklink_output.hpp"
+#include "numa_topology.hpp"
 
 #include "xstudio/utility/helpers.hpp"
 #include "xstudio/utility/logging.hpp"
@@ -37,6 +38,24 @@ namespace {
             {"10 bit RGB-LE Video Range", bmdFormat10BitRGBXLE}
         });
 
+    static std::map<std::string, AudioBufferingProfile> audio_buffering_profiles(
+        {
+            {"Low Latency", AudioBufferingProfile::LowLatency},
+            {"Robust", AudioBufferingProfile::Robust},
+            {"Fixed", AudioBufferingProfile::Fixed}
+        });
+
+    static std::map<std::string, SDILinkConfiguration> sdi_link_configurations(
+        {
+            {"Auto", SDILinkConfiguration::Auto},
+            {"Single Link", SDILinkConfiguration::SingleLink},
+            {"Dual Link", SDILinkConfiguration::DualLink},
+            {"Quad Link (Square Division)", SDILinkConfiguration::QuadLinkSquareDivision},
+            {"Quad Link (2SI)", SDILinkConfiguration::QuadLinkSampleInterleave}
+        });
+
+    static const std::string no_preview_device("None");
+
 static const std::string version1_ui_qml(R"(
 import QtQuick 2.12
 import BlackmagicSDI 1.0
@@ -60,10 +79,70 @@ BMDecklinkPlugin::BMDecklinkPlugin(
 	}
 
     // add attributes used for configuring the SDI output
+    device_ = add_string_choice_attribute(
+        "Decklink Device",
+        "Device",
+        DecklinkOutput::first_available_device,
+        {DecklinkOutput::first_available_device});
+    device_->expose_in_ui_attrs_group("Decklink Settings");
+    device_->set_preference_path("/plugin/decklink/device");
+
+    // other devices that show the same picture, e.g. a client monitor. A json
+    // list of device names or of {"device": name, "pixel_format": format}
+    mirror_outputs_ = add_json_attribute("Mirror Outputs", "Mirror Outputs");
+    mirror_outputs_->expose_in_ui_attrs_group("Decklink Settings");
+    mirror_outputs_->set_preference_path("/plugin/decklink/mirror_outputs");
+
+    frame_lock_outputs_ = add_boolean_attribute("Frame Lock Outputs", "Frame Lock Outputs", false);
+    frame_lock_outputs_->expose_in_ui_attrs_group("Decklink Settings");
+    frame_lock_outputs_->set_preference_path("/plugin/decklink/frame_lock_outputs");
+
+    // a downconverted copy of the output on another device, e.g. HD for a
+    // client monitor alongside a UHD grading display
+    preview_device_ = add_string_choice_attribute(
+        "Preview Device",
+        "Preview",
+        no_preview_device,
+        {no_preview_device});
+    preview_device_->expose_in_ui_attrs_group("Decklink Settings");
+    preview_device_->set_preference_path("/plugin/decklink/preview_device");
+
+    preview_resolution_ = add_string_choice_attribute(
+        "Preview Resolution",
+        "Preview Res.",
+        "1920 x 1080",
+        {"1920 x 1080"});
+    preview_resolution_->expose_in_ui_attrs_group("Decklink Settings");
+    preview_resolution_->set_preference_path("/plugin/decklink/preview_resolution");
+
+    // profile (sub-device / duplex arrangement) of the device, for cards that
+    // have a choice. The choices are filled in when the device is opened.
+    device_profile_ = add_string_choice_attribute(
+        "Device Profile",
+        "Profile",
+        DecklinkOutput::unchanged_profile,
+        {DecklinkOutput::unchanged_profile});
+    device_profile_->expose_in_ui_attrs_group("Decklink Settings");
+    device_profile_->set_preference_path("/plugin/decklink/device_profile");
+
+    // model, persistent ID and sub-device index of each device, for display
+    device_info_ = add_json_attribute("Decklink Device Info", "Decklink Device Info");
+    device_info_->expose_in_ui_attrs_group("Decklink Settings");
+
     pixel_formats_ = add_string_choice_attribute("Pixel Format", "Pix Fmt", "10 bit YUV", utility::map_key_to_vec(bmd_pixel_formats));
     pixel_formats_->expose_in_ui_attrs_group("Decklink Settings");
     pixel_formats_->set_preference_path("/plugin/decklink/pixel_format");
 
+    // how the output is carried over the SDI connectors. 8K modes need one of
+    // the quad link options on cards that support it.
+    sdi_link_ = add_string_choice_attribute(
+        "SDI Link",
+        "SDI Link",
+        "Auto",
+        utility::map_key_to_vec(sdi_link_configurations));
+    sdi_link_->expose_in_ui_attrs_group("Decklink Settings");
+    sdi_link_->set_preference_path("/plugin/decklink/sdi_link_configuration");
+
     sdi_output_is_running_ = add_boolean_attribute("Enabled", "Enabled", false);
     sdi_output_is_running_->expose_in_ui_attrs_group("Decklink Settings");
 
@@ -93,12 +172,78 @@ BMDecklinkPlugin::BMDecklinkPlugin(
         add_boolean_attribute("Start Stop", "Start Stop", false);
     start_stop_->expose_in_ui_attrs_group("Decklink Settings");
 
+    // stopping output leaves the card sending black, so restarting is instant
+    warm_standby_ = add_boolean_attribute("Warm Standby", "Warm Standby", false);
+    warm_standby_->expose_in_ui_attrs_group("Decklink Settings");
+    warm_standby_->set_preference_path("/plugin/decklink/warm_standby");
+
+    // realtime scheduling of the threads that feed the card, and the cores
+    // that the conversion threads run on (e.g. "2-7", empty for any)
+    realtime_scheduling_ = add_string_choice_attribute(
+        "Realtime Scheduling",
+        "Realtime Scheduling",
+        thread_policy_names().front(),
+        thread_policy_names());
+    realtime_scheduling_->expose_in_ui_attrs_group("Decklink Settings");
+    realtime_scheduling_->set_preference_path("/plugin/decklink/realtime_scheduling");
+
+    realtime_priority_ = add_integer_attribute("Realtime Priority", "Realtime Priority", 50);
+    realtime_priority_->expose_in_ui_attrs_group("Decklink Settings");
+    realtime_priority_->set_preference_path("/plugin/decklink/realtime_priority");
+
+    conversion_cores_ = add_string_attribute("Conversion Cores", "Conversion Cores", "");
+    conversion_cores_->set_preference_path("/plugin/decklink/conversion_cores");
+
+    // NUMA node for the conversion threads and frame buffers. Auto is the
+    // node that the card is on.
+    std::vector<std::string> numa_nodes({"Auto", "Off"});
+    for (int i = 0; i < numa_node_count(); ++i) numa_nodes.push_back(std::to_string(i));
+    numa_node_ = add_string_choice_attribute("NUMA Node", "NUMA Node", "Auto", numa_nodes);
+    numa_node_->expose_in_ui_attrs_group("Decklink Settings");
+    numa_node_->set_preference_path("/plugin/decklink/numa_node");
+
+    // genlock timing adjustment, and the state of the reference input
+    reference_timing_offset_ = add_integer_attribute("Reference Timing Offset", "Reference Timing Offset", 0);
+    reference_timing_offset_->expose_in_ui_attrs_group("Decklink Settings");
+    reference_timing_offset_->set_preference_path("/plugin/decklink/reference_timing_offset");
+
+    reference_status_ = add_json_attribute("Reference Status", "Reference Status", utility::JsonStore());
+    reference_status_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // PCIe link, temperature etc. as reported by the card
+    device_telemetry_ = add_json_attribute("Device Telemetry", "Device Telemetry", utility::JsonStore());
+    device_telemetry_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // the scheduling the threads actually got, for the status tooltip
+    thread_scheduling_ = add_string_attribute("Thread Scheduling", "Thread Scheduling", "");
+    thread_scheduling_->expose_in_ui_attrs_group("Decklink Settings");
+
     auto_start_ = add_boolean_attribute("Auto Start", "Auto Start", false);
     auto_start_->set_preference_path("/plugin/decklink/auto_start_sdi");
 
     samples_water_level_ = add_integer_attribute("Audio Samples Water Level", "Audio Samples Water Level", 4096);
     samples_water_level_->set_preference_path("/plugin/decklink/audio_samps_water_level");
 
+    audio_buffering_profile_ = add_string_choice_attribute(
+        "Audio Buffering",
+        "Audio Buffering",
+        "Fixed",
+        utility::map_key_to_vec(audio_buffering_profiles));
+    audio_buffering_profile_->set_preference_path("/plugin/decklink/audio_buffering_profile");
+    audio_buffering_profile_->expose_in_ui_attrs_group("Decklink Settings");
+
+    flush_audio_on_seek_ = add_boolean_attribute("Flush Audio On Seek", "Flush Audio On Seek", true);
+    flush_audio_on_seek_->set_preference_path("/plugin/decklink/flush_audio_on_seek");
+    flush_audio_on_seek_->expose_in_ui_attrs_group("Decklink Settings");
+
+    audio_routing_ = add_string_choice_attribute(
+        "Audio Channel Routing",
+        "Audio Channel Routing",
+        audio_routing_preset_names().front(),
+        audio_routing_preset_names());
+    audio_routing_->set_preference_path("/plugin/decklink/audio_routing");
+    audio_routing_->expose_in_ui_attrs_group("Decklink Settings");
+
     video_pipeline_delay_milliseconds_= add_integer_attribute("Video Sync Delay", "Video Sync Delay", 0);
     video_pipeline_delay_milliseconds_->set_preference_path("/plugin/decklink/video_sync_delay");
     video_pipeline_delay_milliseconds_->expose_in_ui_attrs_group("Decklink Settings");
@@ -111,6 +256,44 @@ BMDecklinkPlugin::BMDecklinkPlugin(
     disable_pc_audio_when_running_->set_preference_path("/plugin/decklink/disable_pc_audio_when_sdi_is_running");
     disable_pc_audio_when_running_->expose_in_ui_attrs_group("Decklink Settings");
 
+    // metrics, updated by the DecklinkOutput. The counters are 64 bit, more
+    // than an int or a float holds exactly (silent samples at 48kHz pass
+    // 2^24 in under 6 minutes) so they are shown as strings.
+    audio_underruns_ = add_string_attribute("Audio Underruns", "Audio Underruns", "0");
+    audio_underruns_->expose_in_ui_attrs_group("Decklink Settings");
+
+    audio_silent_samples_ = add_string_attribute("Silent Audio Samples", "Silent Audio Samples", "0");
+    audio_silent_samples_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // samples from xstudio that didn't fit in our ring
+    audio_dropped_samples_ = add_string_attribute("Dropped Audio Samples", "Dropped Audio Samples", "0");
+    audio_dropped_samples_->expose_in_ui_attrs_group("Decklink Settings");
+
+    audio_buffer_level_ = add_integer_attribute("Audio Buffer Level", "Audio Buffer Level", 4096);
+    audio_buffer_level_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // frames from xstudio that had to be fitted to the output raster
+    adapted_video_frames_ = add_string_attribute("Adapted Video Frames", "Adapted Video Frames", "0");
+    adapted_video_frames_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // frames the card showed late, or not at all
+    late_video_frames_ = add_string_attribute("Late Video Frames", "Late Video Frames", "0");
+    late_video_frames_->expose_in_ui_attrs_group("Decklink Settings");
+
+    dropped_video_frames_ = add_string_attribute("Dropped Video Frames", "Dropped Video Frames", "0");
+    dropped_video_frames_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // how the first frames went after the output was last started
+    startup_metrics_ = add_json_attribute("Startup Metrics", "Startup Metrics", utility::JsonStore());
+    startup_metrics_->expose_in_ui_attrs_group("Decklink Settings");
+
+    // per channel peak/rms in dBFS, for the meters in the settings dialog
+    utility::JsonStore no_levels;
+    no_levels["peak"] = std::vector<float>();
+    no_levels["rms"] = std::vector<float>();
+    audio_levels_ = add_json_attribute("Audio Levels", "Audio Levels", no_levels);
+    audio_levels_->expose_in_ui_attrs_group("Decklink Settings");
+
     VideoOutputPlugin::finalise();
 }
 
@@ -137,6 +320,88 @@ void BMDecklinkPlugin::receive_status_callback(const utility::JsonStore & status
     if (status_data.contains("error_state") && status_data["error_state"].is_boolean()) {
         is_in_error_->set_value(status_data["error_state"].get<bool>());
     }
+    if (status_data.contains("audio_underruns") && status_data["audio_underruns"].is_number_integer()) {
+        audio_underruns_->set_value(std::to_string(status_data["audio_underruns"].get<uint64_t>()));
+    }
+    if (status_data.contains("audio_silent_samples") && status_data["audio_silent_samples"].is_number_integer()) {
+        audio_silent_samples_->set_value(std::to_string(status_data["audio_silent_samples"].get<uint64_t>()));
+    }
+    if (status_data.contains("audio_dropped_samples") && status_data["audio_dropped_samples"].is_number_integer()) {
+        audio_dropped_samples_->set_value(std::to_string(status_data["audio_dropped_samples"].get<uint64_t>()));
+    }
+    if (status_data.contains("audio_buffer_level") && status_data["audio_buffer_level"].is_number()) {
+        audio_buffer_level_->set_value(status_data["audio_buffer_level"].get<int>());
+    }
+    if (status_data.contains("adapted_video_frames") && status_data["adapted_video_frames"].is_number_integer()) {
+        adapted_video_frames_->set_value(std::to_string(status_data["adapted_video_frames"].get<uint64_t>()));
+    }
+    if (status_data.contains("late_video_frames") && status_data["late_video_frames"].is_number_integer()) {
+        late_video_frames_->set_value(std::to_string(status_data["late_video_frames"].get<uint64_t>()));
+    }
+    if (status_data.contains("dropped_video_frames") && status_data["dropped_video_frames"].is_number_integer()) {
+        dropped_video_frames_->set_value(std::to_string(status_data["dropped_video_frames"].get<uint64_t>()));
+    }
+    if (status_data.contains("startup_metrics") && status_data["startup_metrics"].is_object()) {
+        startup_metrics_->set_value(status_data["startup_metrics"]);
+    }
+    if (status_data.contains("reference_status") && status_data["reference_status"].is_object()) {
+        reference_status_->set_value(status_data["reference_status"]);
+    }
+    if (status_data.contains("device_telemetry") && status_data["device_telemetry"].is_object()) {
+        device_telemetry_->set_value(status_data["device_telemetry"]);
+    }
+    if (status_data.contains("thread_scheduling") && status_data["thread_scheduling"].is_string()) {
+        thread_scheduling_->set_value(status_data["thread_scheduling"].get<std::string>());
+    }
+    if (status_data.contains("decklink_devices") && status_data["decklink_devices"].is_array()) {
+        auto choices = status_data["decklink_devices"].get<std::vector<std::string>>();
+        choices.insert(choices.begin(), DecklinkOutput::first_available_device);
+        // keep the selected device in the list even if it isn't connected
+        if (std::find(choices.begin(), choices.end(), device_->value()) == choices.end()) {
+            choices.push_back(device_->value());
+        }
+        device_->set_role_data(module::Attribute::StringChoices, choices);
+
+        choices.front() = no_preview_device;
+        if (std::find(choices.begin(), choices.end(), preview_device_->value()) == choices.end()) {
+            choices.push_back(preview_device_->value());
+        }
+        preview_device_->set_role_data(module::Attribute::StringChoices, choices);
+    }
+    if (status_data.contains("decklink_device_info") && status_data["decklink_device_info"].is_object()) {
+        device_info_->set_value(status_data["decklink_device_info"]);
+    }
+    if (status_data.contains("decklink_profiles") && status_data["decklink_profiles"].is_array()) {
+        auto choices = status_data["decklink_profiles"].get<std::vector<std::string>>();
+        choices.insert(choices.begin(), DecklinkOutput::unchanged_profile);
+        if (std::find(choices.begin(), choices.end(), device_profile_->value()) == choices.end()) {
+            choices.push_back(device_profile_->value());
+        }
+        device_profile_->set_role_data(module::Attribute::StringChoices, choices);
+    }
+    if (status_data.contains("decklink_discovery_complete") && status_data["decklink_discovery_complete"].is_boolean() &&
+        status_data["decklink_discovery_complete"].get<bool>() && !discovery_complete_) {
+        // the devices present at startup are known, so we can auto start if
+        // our device was opened before this
+        discovery_complete_ = true;
+        if (!ready_device_name_.empty()) auto_start_output();
+    }
+    if (status_data.contains("decklink_device_ready") && status_data["decklink_device_ready"].is_string()) {
+        const auto device_name = status_data["decklink_device_ready"].get<std::string>();
+        const auto profile_name = status_data.value("decklink_profile", std::string());
+        if (device_name != ready_device_name_) {
+            ready_device_name_ = device_name;
+            active_profile_name_ = profile_name;
+            if (!device_name.empty()) device_ready();
+        } else if (profile_name != active_profile_name_) {
+            // the display modes available can change with the profile
+            active_profile_name_ = profile_name;
+            if (!device_name.empty()) update_display_modes();
+        }
+    }
+    if (status_data.contains("audio_levels") && status_data["audio_levels"].is_object()) {
+        audio_levels_->set_value(status_data["audio_levels"]);
+    }
 
 }
 
@@ -167,6 +432,47 @@ void BMDecklinkPlugin::attribute_changed(const utility::Uuid &attribute_uuid, co
                 frame_rates_->set_value(*i);
             }
 
+        } else if (attribute_uuid == device_->uuid() && role == module::Attribute::Value) {
+
+            dcl_output_->set_device(device_->value());
+
+        } else if (attribute_uuid == device_profile_->uuid() && role == module::Attribute::Value) {
+
+            dcl_output_->set_device_profile(device_profile_->value());
+
+        } else if (attribute_uuid == mirror_outputs_->uuid() && role == module::Attribute::Value) {
+
+            set_mirror_outputs();
+
+        } else if ((attribute_uuid == preview_device_->uuid() || attribute_uuid == preview_resolution_->uuid()) && role == module::Attribute::Value) {
+
+            set_preview_output();
+
+        } else if (attribute_uuid == frame_lock_outputs_->uuid()) {
+
+            dcl_output_->set_frame_lock_outputs(frame_lock_outputs_->value());
+
+        } else if (attribute_uuid == sdi_link_->uuid()) {
+
+            set_sdi_link();
+
+        } else if (attribute_uuid == warm_standby_->uuid()) {
+
+            dcl_output_->set_warm_standby(warm_standby_->value());
+
+        } else if (attribute_uuid == realtime_scheduling_->uuid() || attribute_uuid == realtime_priority_->uuid() ||
+            attribute_uuid == conversion_cores_->uuid()) {
+
+            set_thread_scheduling();
+
+        } else if (attribute_uuid == numa_node_->uuid()) {
+
+            set_numa_node();
+
+        } else if (attribute_uuid == reference_timing_offset_->uuid()) {
+
+            dcl_output_->set_reference_timing_offset(reference_timing_offset_->value());
+
         } else if (attribute_uuid == start_stop_->uuid()) {
 
             dcl_output_->StartStop();
@@ -175,6 +481,8 @@ void BMDecklinkPlugin::attribute_changed(const utility::Uuid &attribute_uuid, co
 
         if (attribute_uuid == pixel_formats_->uuid() || attribute_uuid == resolutions_->uuid() || attribute_uuid == frame_rates_->uuid()) {
 
+            if (attribute_uuid == resolutions_->uuid() || attribute_uuid == frame_rates_->uuid()) update_pixel_formats();
+
             try {
 
                 if (bmd_pixel_formats.find(pixel_formats_->value()) == bmd_pixel_formats.end()) {
@@ -212,6 +520,12 @@ void BMDecklinkPlugin::attribute_changed(const utility::Uuid &attribute_uuid, co
 
         } else if (attribute_uuid == samples_water_level_->uuid()) {
             dcl_output_->set_audio_samples_water_level(samples_water_level_->value());
+        } else if (attribute_uuid == audio_buffering_profile_->uuid()) {
+            set_audio_buffering_profile();
+        } else if (attribute_uuid == flush_audio_on_seek_->uuid()) {
+            dcl_output_->set_flush_audio_on_seek(flush_audio_on_seek_->value());
+        } else if (attribute_uuid == audio_routing_->uuid()) {
+            set_audio_routing();
         } else if (attribute_uuid == audio_sync_delay_milliseconds_->uuid()) {
             dcl_output_->set_audio_sync_delay_milliseconds(audio_sync_delay_milliseconds_->value());
         } else if (attribute_uuid == video_pipeline_delay_milliseconds_->uuid()) {
@@ -237,12 +551,28 @@ void BMDecklinkPlugin::initialise() {
 
         dcl_output_ = new DecklinkOutput(this);
 
-        resolutions_->set_role_data(module::Attribute::StringChoices, dcl_output_->output_resolution_names());
-
         dcl_output_->set_audio_samples_water_level(samples_water_level_->value());
+        set_audio_buffering_profile();
+        dcl_output_->set_flush_audio_on_seek(flush_audio_on_seek_->value());
+        set_audio_routing();
         dcl_output_->set_audio_sync_delay_milliseconds(audio_sync_delay_milliseconds_->value());
 
-        spdlog::info("Decklink Card Initialised");
+        // The driver is loaded and devices are discovered (and the selected
+        // one opened) in the background, so this doesn't hold up xstudio
+        // starting. device_ready() is called when the device is available.
+        dcl_output_->set_device(device_->value());
+        dcl_output_->set_device_profile(device_profile_->value());
+        set_mirror_outputs();
+        set_preview_output();
+        dcl_output_->set_frame_lock_outputs(frame_lock_outputs_->value());
+        set_sdi_link();
+        dcl_output_->set_warm_standby(warm_standby_->value());
+        set_thread_scheduling();
+        set_numa_node();
+        dcl_output_->set_reference_timing_offset(reference_timing_offset_->value());
+        dcl_output_->init_decklink();
+
+        spdlog::info("Decklink Plugin Initialised");
 
         // We register the UI here
         register_viewport_dockable_widget(
@@ -266,14 +596,6 @@ void BMDecklinkPlugin::initialise() {
                 }
                 )");
 
-        // now we are set-up we can kick ourselves to fill in the refresh rate list etc.
-        attribute_changed(resolutions_->uuid(), module::Attribute::Value);
-
-        if (auto_start_->value()) {
-            // start output immediately if auto_start_ is enabled (via prefs)
-            dcl_output_->StartStop();
-        }
-
         sync_geometry_to_main_viewport(false);
 
         video_delay_milliseconds(video_pipeline_delay_milliseconds_->value());
@@ -293,6 +615,106 @@ void BMDecklinkPlugin::initialise() {
 
 }
 
+void BMDecklinkPlugin::device_ready() {
+
+    spdlog::info("Decklink device {} ready", ready_device_name_);
+
+    update_display_modes();
+    auto_start_output();
+
+}
+
+void BMDecklinkPlugin::auto_start_output() {
+
+    // start output as soon as we can if auto_start_ is enabled (via prefs),
+    // which is when device discovery has finished. This also restarts
+    // output when a device is reconnected.
+    if (discovery_complete_ && auto_start_->value() && !sdi_output_is_running_->value()) {
+        dcl_output_->StartStop();
+    }
+
+}
+
+void BMDecklinkPlugin::update_display_modes() {
+
+    const auto resolutions = dcl_output_->output_resolution_names();
+    resolutions_->set_role_data(module::Attribute::StringChoices, resolutions);
+
+    // the preview device is usually the same model (or another sub-device
+    // of the same card) so offer the same resolutions
+    auto preview_resolutions = resolutions;
+    if (std::find(preview_resolutions.begin(), preview_resolutions.end(), preview_resolution_->value()) == preview_resolutions.end()) {
+        preview_resolutions.push_back(preview_resolution_->value());
+    }
+    preview_resolution_->set_role_data(module::Attribute::StringChoices, preview_resolutions);
+
+    // now we are set-up we can kick ourselves to fill in the refresh rate list etc.
+    attribute_changed(resolutions_->uuid(), module::Attribute::Value);
+
+}
+
+void BMDecklinkPlugin::update_pixel_formats() {
+
+    // only offer the pixel formats that the device can output in the
+    // selected mode
+    std::vector<std::string> choices;
+    for (const auto pix_fmt: dcl_output_->get_available_pixel_formats(resolutions_->value(), frame_rates_->value())) {
+        for (const auto & p: bmd_pixel_formats) {
+            if (p.second == pix_fmt) choices.push_back(p.first);
+        }
+    }
+    // no device (yet), leave the list as it is
+    if (choices.empty()) return;
+
+    pixel_formats_->set_role_data(module::Attribute::StringChoices, choices);
+
+    // pick a sensible format if the current one isn't available
+    if (std::find(choices.begin(), choices.end(), pixel_formats_->value()) == choices.end()) {
+        auto i = std::find(choices.begin(), choices.end(), "10 bit YUV");
+        pixel_formats_->set_value(i != choices.end() ? *i : choices.front());
+    }
+
+}
+
+void BMDecklinkPlugin::set_mirror_outputs() {
+
+    std::vector<DecklinkOutput::MirrorOutputConfig> mirrors;
+    try {
+        for (const auto & m: mirror_outputs_->value()) {
+            DecklinkOutput::MirrorOutputConfig c;
+            if (m.is_string()) {
+                c.device_name = m.get<std::string>();
+            } else {
+                c.device_name = m.value("device", std::string());
+                const auto pix_fmt = m.value("pixel_format", std::string());
+                if (!pix_fmt.empty()) {
+                    if (bmd_pixel_formats.find(pix_fmt) == bmd_pixel_formats.end()) {
+                        throw std::runtime_error(fmt::format("Invalid pixel format for mirror output {}: {}", c.device_name, pix_fmt));
+                    }
+                    c.pixel_format = bmd_pixel_formats[pix_fmt];
+                }
+            }
+            if (!c.device_name.empty()) mirrors.push_back(c);
+        }
+    } catch (std::exception & e) {
+        status_message_->set_value(e.what());
+        is_in_error_->set_value(true);
+    }
+    dcl_output_->set_mirror_outputs(mirrors);
+
+}
+
+void BMDecklinkPlugin::set_preview_output() {
+
+    DecklinkOutput::PreviewOutputConfig preview;
+    if (preview_device_->value() != no_preview_device) {
+        preview.device_name = preview_device_->value();
+    }
+    preview.resolution = preview_resolution_->value();
+    dcl_output_->set_preview_output(preview);
+
+}
+
 void BMDecklinkPlugin::set_pc_audio_muting() {
 
     // we can get access to the
@@ -306,6 +728,70 @@ void BMDecklinkPlugin::set_pc_audio_muting() {
 
 }
 
+void BMDecklinkPlugin::set_audio_buffering_profile() {
+
+    auto p = audio_buffering_profiles.find(audio_buffering_profile_->value());
+    if (p != audio_buffering_profiles.end()) {
+        dcl_output_->set_audio_buffering_profile(p->second);
+    }
+
+}
+
+void BMDecklinkPlugin::set_sdi_link() {
+
+    // takes effect the next time SDI output is started
+    auto p = sdi_link_configurations.find(sdi_link_->value());
+    if (p != sdi_link_configurations.end()) {
+        dcl_output_->set_sdi_link_configuration(p->second);
+    }
+
+}
+
+void BMDecklinkPlugin::set_audio_routing() {
+
+    // a new routing takes effect the next time SDI output is started
+    try {
+        dcl_output_->set_audio_routing(audio_routing_->value());
+    } catch (std::exception & e) {
+        status_message_->set_value(e.what());
+        is_in_error_->set_value(true);
+    }
+
+}
+
+void BMDecklinkPlugin::set_thread_scheduling() {
+
+    // takes effect straight away. Without the right privileges the threads
+    // fall back to what they are allowed, which shows up in Thread Scheduling.
+    try {
+        dcl_output_->set_thread_scheduling(
+            ThreadPriority{thread_policy_from_name(realtime_scheduling_->value()), realtime_priority_->value()},
+            conversion_cores_->value());
+    } catch (std::exception & e) {
+        status_message_->set_value(e.what());
+        is_in_error_->set_value(true);
+    }
+
+}
+
+void BMDecklinkPlugin::set_numa_node() {
+
+    const std::string node = numa_node_->value();
+    if (node == "Auto") {
+        dcl_output_->set_numa_node(DecklinkOutput::numa_node_auto);
+    } else if (node == "Off") {
+        dcl_output_->set_numa_node(DecklinkOutput::numa_node_off);
+    } else {
+        try {
+            dcl_output_->set_numa_node(std::stoi(node));
+        } catch (std::exception &) {
+            status_message_->set_value(fmt::format("Invalid NUMA node: {}", node));
+            is_in_error_->set_value(true);
+        }
+    }
+
+}
+
 BMDecklinkPlugin::~BMDecklinkPlugin() {
 }
 
@@ -2,13 +2,14 @@
 #pragma once
 
 #include "xstudio/ui/viewport/video_output_plugin.hpp"
+#include "decklink_output_host.hpp"
 
 namespace xstudio {
     namespace bm_decklink_plugin_1_0 {
 
     class DecklinkOutput;
 
-    class BMDecklinkPlugin : public ui::viewport::VideoOutputPlugin {
+    class BMDecklinkPlugin : public ui::viewport::VideoOutputPlugin, public DecklinkOutputHost {
 
         public:
 
@@ -35,6 +36,13 @@ namespace xstudio {
         // in a thread managed by the Decklink driver, and the xstudio threads
         void receive_status_callback(const utility::JsonStore & status_data) override;
 
+        // DecklinkOutputHost interface, called from DecklinkOutput's threads
+        void send_output_status(const utility::JsonStore &status) override { send_status(status); }
+        void start_rendering(const int width, const int height) override { start(width, height); }
+        void stop_rendering() override { stop(); }
+        void request_render(const utility::time_point &when) override { request_video_frame(when); }
+        void frame_displayed(const utility::time_point &when) override { video_frame_consumed(when); }
+
         private:
 
       protected:
@@ -43,9 +51,41 @@ namespace xstudio {
 
         void set_pc_audio_muting();
 
+        void device_ready();
+
+        void auto_start_output();
+
+        void update_display_modes();
+
+        void update_pixel_formats();
+
+        void set_mirror_outputs();
+
+        void set_preview_output();
+
+        void set_sdi_link();
+
+        void set_audio_buffering_profile();
+        void set_audio_routing();
+
+        void set_thread_scheduling();
+        void set_numa_node();
+
         DecklinkOutput * dcl_output_ = nullptr;
+        std::string ready_device_name_;
+        std::string active_profile_name_;
+        bool discovery_complete_ = {false};
+
+        module::StringChoiceAttribute *device_ {nullptr};
+        module::StringChoiceAttribute *device_profile_ {nullptr};
+        module::JsonAttribute *device_info_ {nullptr};
+        module::JsonAttribute *mirror_outputs_ {nullptr};
+        module::BooleanAttribute *frame_lock_outputs_ {nullptr};
+        module::StringChoiceAttribute *preview_device_ {nullptr};
+        module::StringChoiceAttribute *preview_resolution_ {nullptr};
 
         module::StringChoiceAttribute *pixel_formats_ {nullptr};
+        module::StringChoiceAttribute *sdi_link_ {nullptr};
         module::StringChoiceAttribute *resolutions_ {nullptr};
         module::StringChoiceAttribute *frame_rates_ {nullptr};
         module::StringAttribute *status_message_ {nullptr};
@@ -54,10 +94,31 @@ namespace xstudio {
         module::BooleanAttribute *start_stop_ {nullptr};
         module::BooleanAttribute *track_main_viewport_ {nullptr};
         module::BooleanAttribute *auto_start_ {nullptr};
+        module::BooleanAttribute *warm_standby_ {nullptr};
+        module::StringChoiceAttribute *realtime_scheduling_ {nullptr};
+        module::IntegerAttribute *realtime_priority_ {nullptr};
+        module::StringAttribute *conversion_cores_ {nullptr};
+        module::StringChoiceAttribute *numa_node_ {nullptr};
+        module::StringAttribute *thread_scheduling_ {nullptr};
+        module::IntegerAttribute *reference_timing_offset_ {nullptr};
+        module::JsonAttribute *reference_status_ {nullptr};
+        module::JsonAttribute *device_telemetry_ {nullptr};
         module::BooleanAttribute *disable_pc_audio_when_running_ {nullptr};
         module::IntegerAttribute *samples_water_level_ {nullptr};
         module::IntegerAttribute *audio_sync_delay_milliseconds_ {nullptr};
         module::IntegerAttribute *video_pipeline_delay_milliseconds_ {nullptr};
+        module::StringChoiceAttribute *audio_buffering_profile_ {nullptr};
+        module::BooleanAttribute *flush_audio_on_seek_ {nullptr};
+        module::StringChoiceAttribute *audio_routing_ {nullptr};
+        module::StringAttribute *audio_underruns_ {nullptr};
+        module::IntegerAttribute *audio_buffer_level_ {nullptr};
+        module::JsonAttribute *audio_levels_ {nullptr};
+        module::StringAttribute *audio_silent_samples_ {nullptr};
+        module::StringAttribute *audio_dropped_samples_ {nullptr};
+        module::StringAttribute *adapted_video_frames_ {nullptr};
+        module::StringAttribute *late_video_frames_ {nullptr};
+        module::StringAttribute *dropped_video_frames_ {nullptr};
+        module::JsonAttribute *startup_metrics_ {nullptr};
 
     };
 } // namespace bm_decklink_plugin_1_0
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "decklink_profile_manager.hpp"
+#include "xstudio/utility/logging.hpp"
+
+#include <map>
+
+using namespace xstudio;
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+namespace {
+
+const std::map<int64_t, std::string> profile_names_by_id(
+    {{bmdProfileOneSubDeviceFullDuplex, "1 Sub-Device Full Duplex"},
+     {bmdProfileOneSubDeviceHalfDuplex, "1 Sub-Device Half Duplex"},
+     {bmdProfileTwoSubDevicesFullDuplex, "2 Sub-Devices Full Duplex"},
+     {bmdProfileTwoSubDevicesHalfDuplex, "2 Sub-Devices Half Duplex"},
+     {bmdProfileFourSubDevicesHalfDuplex, "4 Sub-Devices Half Duplex"}});
+
+std::string profile_name(IDeckLinkProfile *profile) {
+
+    int64_t id = 0;
+    IDeckLinkProfileAttributes *attributes = NULL;
+    if (profile->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&attributes) == S_OK) {
+        attributes->GetInt(BMDDeckLinkProfileID, &id);
+        attributes->Release();
+    }
+    auto p = profile_names_by_id.find(id);
+    return p != profile_names_by_id.end() ? p->second : fmt::format("Profile {:x}", id);
+}
+
+} // namespace
+
+DecklinkProfileManager::DecklinkProfileManager(
+    std::function<void(bool streams_will_stop)> profile_changing,
+    std::function<void()> profile_activated)
+    : profile_changing_(std::move(profile_changing)),
+      profile_activated_(std::move(profile_activated)) {}
+
+DecklinkProfileManager::~DecklinkProfileManager() { close(); }
+
+bool DecklinkProfileManager::open(IDeckLink *device) {
+
+    close();
+    if (device->QueryInterface(IID_IDeckLinkProfileManager, (void **)&manager_) != S_OK) {
+        manager_ = nullptr;
+        return false;
+    }
+    manager_->SetCallback(this);
+    return true;
+}
+
+void DecklinkProfileManager::close() {
+
+    if (manager_) {
+        manager_->SetCallback(NULL);
+        manager_->Release();
+        manager_ = nullptr;
+    }
+}
+
+template <typename F> void DecklinkProfileManager::for_each_profile(F &&f) const {
+
+    if (!manager_)
+        return;
+
+    IDeckLinkProfileIterator *iterator = NULL;
+    if (manager_->GetProfiles(&iterator) != S_OK)
+        return;
+
+    IDeckLinkProfile *profile = NULL;
+    while (iterator->Next(&profile) == S_OK) {
+        f(profile);
+        profile->Release();
+    }
+    iterator->Release();
+}
+
+std::vector<std::string> DecklinkProfileManager::profile_names() const {
+
+    std::vector<std::string> result;
+    for_each_profile([&](IDeckLinkProfile *profile) { result.push_back(profile_name(profile)); });
+    return result;
+}
+
+std::string DecklinkProfileManager::active_profile_name() const {
+
+    std::string result;
+    for_each_profile([&](IDeckLinkProfile *profile) {
+        bool active = false;
+        if (profile->IsActive(&active) == S_OK && active)
+            result = profile_name(profile);
+    });
+    return result;
+}
+
+IDeckLinkProfile *DecklinkProfileManager::acquire_inactive_profile(const std::string &name) const {
+
+    IDeckLinkProfile *target = NULL;
+    for_each_profile([&](IDeckLinkProfile *profile) {
+        if (!target && profile_name(profile) == name) {
+            profile->AddRef();
+            target = profile;
+        }
+    });
+
+    if (!target) {
+        spdlog::warn("Decklink profile {} is not available on this device.", name);
+        return nullptr;
+    }
+
+    bool active = false;
+    if (target->IsActive(&active) == S_OK && active) {
+        target->Release();
+        return nullptr;
+    }
+    return target;
+}
+
+HRESULT DecklinkProfileManager::ProfileChanging(
+    IDeckLinkProfile *profile_to_be_activated, bool streams_will_be_forced_to_stop) {
+
+    spdlog::info(
+        "Decklink profile changing to {}{}",
+        profile_name(profile_to_be_activated),
+        streams_will_be_forced_to_stop ? ", output will be stopped" : "");
+    profile_changing_(streams_will_be_forced_to_stop);
+    return S_OK;
+}
+
+HRESULT DecklinkProfileManager::ProfileActivated(IDeckLinkProfile *activated_profile) {
+
+    spdlog::info("Decklink profile {} activated", profile_name(activated_profile));
+    profile_activated_();
+    return S_OK;
+}
+
+HRESULT DecklinkProfileManager::QueryInterface(REFIID /*iid*/, LPVOID *ppv) {
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+ULONG DecklinkProfileManager::AddRef() { return ++ref_count_; }
+
+ULONG DecklinkProfileManager::Release() {
+    ULONG new_ref_count = --ref_count_;
+    if (new_ref_count == 0)
+        delete this;
+    return new_ref_count;
+}
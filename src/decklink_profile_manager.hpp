@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "extern/DeckLinkAPI.h"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief DecklinkProfileManager class. Lists and switches the profiles of
+     *  a Decklink device, using IDeckLinkProfileManager.
+     *
+     *  @details
+     *   Cards with several connectors (e.g. the 8K Pro or Duo 2) have profiles
+     *   that trade the number of independent sub-devices against what each of
+     *   them can do, such as full vs half duplex. Devices with only one
+     *   profile don't have a profile manager, in which case profile_names()
+     *   is empty.
+     *
+     *   When a profile is activated (by us or by another application) the
+     *   driver calls profile_changing before the switch, and if
+     *   streams_will_stop is set we must stop output then, and calls
+     *   profile_activated afterwards. These are called on a driver thread,
+     *   so don't hold locks that they need while calling SetActive.
+     */
+    class DecklinkProfileManager : public IDeckLinkProfileCallback {
+
+      public:
+        DecklinkProfileManager(
+            std::function<void(bool streams_will_stop)> profile_changing,
+            std::function<void()> profile_activated);
+
+        // Returns false if the device doesn't have selectable profiles
+        bool open(IDeckLink *device);
+        void close();
+
+        [[nodiscard]] std::vector<std::string> profile_names() const;
+        [[nodiscard]] std::string active_profile_name() const;
+
+        // Returns the named profile with a reference added (caller must
+        // Release it), or nullptr if it's already active or the device
+        // doesn't have it. Call SetActive on it to switch profile.
+        IDeckLinkProfile *acquire_inactive_profile(const std::string &profile_name) const;
+
+        // IDeckLinkProfileCallback
+        HRESULT ProfileChanging(IDeckLinkProfile *profile_to_be_activated, bool streams_will_be_forced_to_stop) override;
+        HRESULT ProfileActivated(IDeckLinkProfile *activated_profile) override;
+
+        // IUnknown
+        HRESULT QueryInterface(REFIID iid, LPVOID *ppv) override;
+        ULONG AddRef() override;
+        ULONG Release() override;
+
+      private:
+        ~DecklinkProfileManager() override;
+
+        template <typename F> void for_each_profile(F &&f) const;
+
+        std::function<void(bool)> profile_changing_;
+        std::function<void()> profile_activated_;
+        IDeckLinkProfileManager *manager_ = {nullptr};
+        std::atomic<ULONG> ref_count_     = {1};
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "decklink_video_frame.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+namespace {
+size_t page_aligned_size(const size_t size) { return ((size + 4095) / 4096) * 4096; }
+} // namespace
+
+int32_t xstudio::bm_decklink_plugin_1_0::row_bytes_for_pixel_format(
+    const BMDPixelFormat pix_format, const int32_t width) {
+
+    switch (pix_format) {
+    case bmdFormat8BitYUV:
+        return width * 2;
+    case bmdFormat10BitYUV:
+        return ((width + 47) / 48) * 128;
+    case bmdFormat10BitRGB:
+    case bmdFormat10BitRGBX:
+    case bmdFormat10BitRGBXLE:
+        return ((width + 63) / 64) * 256;
+    case bmdFormat12BitRGB:
+    case bmdFormat12BitRGBLE:
+        return (width * 36) / 8;
+    default:
+        return width * 4;
+    }
+}
+
+DecklinkVideoFrame::DecklinkVideoFrame(
+    const long width,
+    const long height,
+    const BMDPixelFormat pix_format,
+    const BMDFrameFlags flags,
+    std::weak_ptr<VideoFramePool> pool,
+    const FrameBufferInit &buffer_init)
+    : width_(width),
+      height_(height),
+      row_bytes_(row_bytes_for_pixel_format(pix_format, width)),
+      pix_format_(pix_format),
+      flags_(flags),
+      pool_(std::move(pool)) {
+
+    // page aligned, which is what the driver wants for DMA
+    const size_t sz = page_aligned_size(size());
+    void *buf       = nullptr;
+    if (posix_memalign(&buf, 4096, sz) != 0) {
+        throw std::runtime_error("Failed to allocate video frame.");
+    }
+    buffer_.reset((uint8_t *)buf);
+    capacity_ = sz;
+    if (buffer_init) {
+        buffer_init(buffer_.get(), sz);
+    } else {
+        memset(buf, 0, sz);
+    }
+}
+
+DecklinkVideoFrame::DecklinkVideoFrame(
+    const long width,
+    const long height,
+    const BMDPixelFormat pix_format,
+    const BMDFrameFlags flags,
+    std::weak_ptr<VideoFramePool> pool,
+    std::unique_ptr<uint8_t, FreeDeleter> buffer,
+    const size_t capacity)
+    : width_(width),
+      height_(height),
+      row_bytes_(row_bytes_for_pixel_format(pix_format, width)),
+      pix_format_(pix_format),
+      flags_(flags),
+      buffer_(std::move(buffer)),
+      capacity_(capacity),
+      pool_(std::move(pool)) {}
+
+HRESULT DecklinkVideoFrame::GetBytes(void **buffer) {
+    *buffer = (void *)buffer_.get();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DecklinkVideoFrame::QueryInterface(REFIID iid, LPVOID *ppv) {
+
+    if (ppv == NULL)
+        return E_INVALIDARG;
+
+    *ppv = NULL;
+
+    CFUUIDBytes iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+    if (memcmp(&iid, &iunknown, sizeof(REFIID)) == 0 ||
+        memcmp(&iid, &IID_IDeckLinkVideoFrame, sizeof(REFIID)) == 0) {
+        *ppv = (IDeckLinkVideoFrame *)this;
+        AddRef();
+        return S_OK;
+    }
+
+    return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE DecklinkVideoFrame::AddRef() { return ++ref_count_; }
+
+ULONG STDMETHODCALLTYPE DecklinkVideoFrame::Release() {
+
+    ULONG new_ref_count = --ref_count_;
+    if (new_ref_count == 0) {
+        if (auto pool = pool_.lock()) {
+            pool->recycle(this);
+        } else {
+            delete this;
+        }
+    }
+    return new_ref_count;
+}
+
+std::shared_ptr<VideoFramePool> VideoFramePool::create(
+    const long width,
+    const long height,
+    const BMDPixelFormat pix_format,
+    const BMDFrameFlags flags,
+    const size_t num_frames,
+    FrameBufferInit buffer_init,
+    const std::vector<std::shared_ptr<VideoFramePool>> &spare_pools) {
+
+    std::shared_ptr<VideoFramePool> pool(
+        new VideoFramePool(width, height, pix_format, flags, std::move(buffer_init)));
+    // room for every frame to come back (and some more from acquire), so
+    // that recycling on a driver thread doesn't allocate
+    pool->free_frames_.reserve(num_frames * 2);
+
+    // the free frames of the pools we are replacing
+    std::vector<DecklinkVideoFrame *> spare_frames;
+    for (const auto &p : spare_pools) {
+        std::lock_guard l(p->mutex_);
+        spare_frames.insert(spare_frames.end(), p->free_frames_.begin(), p->free_frames_.end());
+        p->free_frames_.clear();
+    }
+
+    const size_t needed = page_aligned_size(size_t(row_bytes_for_pixel_format(pix_format, width)) * size_t(height));
+    for (size_t i = 0; i < num_frames; ++i) {
+        auto spare = std::find_if(spare_frames.begin(), spare_frames.end(), [=](const DecklinkVideoFrame *f) {
+            return f->capacity_ >= needed;
+        });
+        if (spare != spare_frames.end()) {
+            // already faulted in, and it gets overwritten before it's sent
+            pool->free_frames_.push_back(new DecklinkVideoFrame(
+                width, height, pix_format, flags, pool->weak_from_this(), std::move((*spare)->buffer_), (*spare)->capacity_));
+            delete *spare;
+            spare_frames.erase(spare);
+        } else {
+            pool->free_frames_.push_back(new DecklinkVideoFrame(
+                width, height, pix_format, flags, pool->weak_from_this(), pool->buffer_init_));
+        }
+    }
+
+    // too small to use
+    for (auto f : spare_frames) {
+        delete f;
+    }
+    return pool;
+}
+
+VideoFramePool::VideoFramePool(
+    const long width,
+    const long height,
+    const BMDPixelFormat pix_format,
+    const BMDFrameFlags flags,
+    FrameBufferInit buffer_init)
+    : width_(width),
+      height_(height),
+      pix_format_(pix_format),
+      flags_(flags),
+      buffer_init_(std::move(buffer_init)) {}
+
+VideoFramePool::~VideoFramePool() {
+    for (auto f : free_frames_) {
+        delete f;
+    }
+}
+
+DecklinkVideoFrame *VideoFramePool::acquire() {
+
+    if (DecklinkVideoFrame *f = try_acquire())
+        return f;
+    // all our frames are in flight
+    return new DecklinkVideoFrame(
+        width_, height_, pix_format_, flags_, weak_from_this(), buffer_init_);
+}
+
+DecklinkVideoFrame *VideoFramePool::try_acquire() {
+
+    std::lock_guard l(mutex_);
+    if (free_frames_.empty())
+        return nullptr;
+    DecklinkVideoFrame *f = free_frames_.back();
+    free_frames_.pop_back();
+    f->ref_count_ = 1;
+    return f;
+}
+
+void VideoFramePool::recycle(DecklinkVideoFrame *frame) {
+    std::lock_guard l(mutex_);
+    free_frames_.push_back(frame);
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "extern/DeckLinkAPI.h"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    class VideoFramePool;
+
+    // Called to zero each new frame buffer. Pages of memory are placed on the
+    // NUMA node of the thread that first writes to them, so this lets the
+    // owner of the pool do that from the threads that will fill the frames.
+    using FrameBufferInit = std::function<void(uint8_t *buffer, size_t size)>;
+
+    // Bytes per row for the given pixel format, as per the Decklink SDK docs
+    int32_t row_bytes_for_pixel_format(const BMDPixelFormat pix_format, const int32_t width);
+
+    /**
+     *  @brief DecklinkVideoFrame class. An IDeckLinkVideoFrame whose pixel
+     *  buffer we allocate ourselves.
+     *
+     *  @details
+     *   Because we own the buffer, one frame can be scheduled on several
+     *   Decklink outputs at once. Each output holds a reference until it has
+     *   displayed the frame, when the last reference is released the frame
+     *   goes back to the VideoFramePool that it came from.
+     */
+    class DecklinkVideoFrame : public IDeckLinkVideoFrame {
+
+      public:
+        DecklinkVideoFrame(
+            const long width,
+            const long height,
+            const BMDPixelFormat pix_format,
+            const BMDFrameFlags flags,
+            std::weak_ptr<VideoFramePool> pool,
+            const FrameBufferInit &buffer_init = FrameBufferInit());
+
+        // IDeckLinkVideoFrame interface
+        long STDMETHODCALLTYPE GetWidth(void) override { return width_; }
+        long STDMETHODCALLTYPE GetHeight(void) override { return height_; }
+        long STDMETHODCALLTYPE GetRowBytes(void) override { return row_bytes_; }
+        HRESULT STDMETHODCALLTYPE GetBytes(void **buffer) override;
+        BMDFrameFlags STDMETHODCALLTYPE GetFlags(void) override { return flags_; }
+        BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void) override { return pix_format_; }
+
+        HRESULT STDMETHODCALLTYPE GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary) override {
+            return E_NOTIMPL;
+        }
+        HRESULT STDMETHODCALLTYPE GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode) override {
+            return E_NOTIMPL;
+        }
+
+        // IUnknown interface
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) override;
+        ULONG STDMETHODCALLTYPE AddRef() override;
+        ULONG STDMETHODCALLTYPE Release() override;
+
+        [[nodiscard]] uint8_t *bytes() { return buffer_.get(); }
+        [[nodiscard]] size_t size() const { return size_t(row_bytes_) * size_t(height_); }
+
+        // Identifies the xstudio image that was last converted into this frame
+        void set_source_image(const void *image) { source_image_ = image; }
+        [[nodiscard]] const void *source_image() const { return source_image_; }
+
+      private:
+        friend class VideoFramePool;
+        ~DecklinkVideoFrame() override = default;
+
+        struct FreeDeleter {
+            void operator()(uint8_t *p) const { free(p); }
+        };
+
+        // Takes over a buffer of capacity bytes from a frame that isn't
+        // needed any more. The contents are left as they are.
+        DecklinkVideoFrame(
+            const long width,
+            const long height,
+            const BMDPixelFormat pix_format,
+            const BMDFrameFlags flags,
+            std::weak_ptr<VideoFramePool> pool,
+            std::unique_ptr<uint8_t, FreeDeleter> buffer,
+            const size_t capacity);
+
+        const long width_;
+        const long height_;
+        const long row_bytes_;
+        const BMDPixelFormat pix_format_;
+        const BMDFrameFlags flags_;
+        std::unique_ptr<uint8_t, FreeDeleter> buffer_;
+        size_t capacity_ = {0};
+        std::weak_ptr<VideoFramePool> pool_;
+        const void *source_image_ = {nullptr};
+        std::atomic<ULONG> ref_count_ = {1};
+    };
+
+    /**
+     *  @brief VideoFramePool class. Recycles DecklinkVideoFrames of one size and
+     *  pixel format so that we aren't allocating frame buffers during playback.
+     *
+     *  @details
+     *   Frames are returned to the pool from Decklink driver threads (when they
+     *   release the last reference) so the free list is protected by a mutex.
+     *   If the pool is destroyed while frames are still scheduled they delete
+     *   themselves when released.
+     *
+     *   A new pool can take over the free frame buffers of pools that it is
+     *   replacing, so changing the raster size doesn't mean allocating (and
+     *   faulting in) every frame buffer again. Buffers are only reused where
+     *   they are big enough for the new frames.
+     */
+    class VideoFramePool : public std::enable_shared_from_this<VideoFramePool> {
+
+      public:
+        static std::shared_ptr<VideoFramePool> create(
+            const long width,
+            const long height,
+            const BMDPixelFormat pix_format,
+            const BMDFrameFlags flags,
+            const size_t num_frames,
+            FrameBufferInit buffer_init = FrameBufferInit(),
+            const std::vector<std::shared_ptr<VideoFramePool>> &spare_pools = {});
+
+        ~VideoFramePool();
+
+        // Returns a frame with one reference, which the caller must Release.
+        // Allocates a new frame if none are free.
+        DecklinkVideoFrame *acquire();
+
+        // As acquire, but returns nullptr rather than allocating. For the
+        // frame callback.
+        DecklinkVideoFrame *try_acquire();
+
+        [[nodiscard]] BMDPixelFormat pixel_format() const { return pix_format_; }
+        [[nodiscard]] long width() const { return width_; }
+        [[nodiscard]] long height() const { return height_; }
+
+      private:
+        VideoFramePool(
+            const long width,
+            const long height,
+            const BMDPixelFormat pix_format,
+            const BMDFrameFlags flags,
+            FrameBufferInit buffer_init);
+
+        friend class DecklinkVideoFrame;
+        void recycle(DecklinkVideoFrame *frame);
+
+        const long width_;
+        const long height_;
+        const BMDPixelFormat pix_format_;
+        const BMDFrameFlags flags_;
+        const FrameBufferInit buffer_init_;
+        std::vector<DecklinkVideoFrame *> free_frames_;
+        std::mutex mutex_;
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
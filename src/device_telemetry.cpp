@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "device_telemetry.hpp"
+
+#include <cstdlib>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+namespace {
+
+// On Linux strings returned by the Decklink API are malloc'd and must be
+// freed by the caller
+std::string take_string(const char *str) {
+    std::string result(str ? str : "");
+    free((void *)str);
+    return result;
+}
+
+std::string display_mode_name(IDeckLinkOutput *output, const int64_t mode) {
+
+    if (!mode || mode == bmdModeUnknown)
+        return std::string();
+    IDeckLinkDisplayMode *display_mode = NULL;
+    if (output->GetDisplayMode(BMDDisplayMode(mode), &display_mode) != S_OK || !display_mode)
+        return std::string();
+    std::string name;
+    const char *str = NULL;
+    if (display_mode->GetName(&str) == S_OK) {
+        name = take_string(str);
+    }
+    display_mode->Release();
+    return name;
+}
+
+std::string busy_state_string(const int64_t busy) {
+
+    std::string result;
+    auto add = [&](const char *what) {
+        if (!result.empty())
+            result += ", ";
+        result += what;
+    };
+    if (busy & bmdDevicePlaybackBusy)
+        add("Playback");
+    if (busy & bmdDeviceCaptureBusy)
+        add("Capture");
+    if (busy & bmdDeviceSerialPortBusy)
+        add("Serial Port");
+    return result.empty() ? std::string("Idle") : result;
+}
+
+} // namespace
+
+bool DeviceTelemetry::operator==(const DeviceTelemetry &o) const {
+    return device_name == o.device_name && pcie_link_width == o.pcie_link_width &&
+           pcie_link_speed == o.pcie_link_speed && pcie_max_link_width == o.pcie_max_link_width &&
+           temperature == o.temperature && busy_state == o.busy_state &&
+           output_mode == o.output_mode && reference_mode == o.reference_mode;
+}
+
+DeviceTelemetry read_device_telemetry(IDeckLink *device, IDeckLinkOutput *output) {
+
+    DeviceTelemetry result;
+    IDeckLinkStatus *status = NULL;
+    if (device->QueryInterface(IID_IDeckLinkStatus, (void **)&status) != S_OK)
+        return result;
+
+    // not every card reports everything, anything missing is left at 0
+    auto get_int = [=](const BMDDeckLinkStatusID id, int64_t &value) {
+        if (status->GetInt(id, &value) != S_OK)
+            value = 0;
+    };
+    get_int(bmdDeckLinkStatusPCIExpressLinkWidth, result.pcie_link_width);
+    get_int(bmdDeckLinkStatusPCIExpressLinkSpeed, result.pcie_link_speed);
+    get_int(bmdDeckLinkStatusDeviceTemperature, result.temperature);
+    get_int(bmdDeckLinkStatusBusy, result.busy_state);
+
+    int64_t mode = 0;
+    get_int(bmdDeckLinkStatusCurrentVideoOutputMode, mode);
+    result.output_mode = display_mode_name(output, mode);
+    get_int(bmdDeckLinkStatusReferenceSignalMode, mode);
+    result.reference_mode = display_mode_name(output, mode);
+
+    status->Release();
+    return result;
+}
+
+utility::JsonStore device_telemetry_json(const DeviceTelemetry &telemetry) {
+
+    utility::JsonStore j;
+    j["device"] = telemetry.device_name;
+    j["pcie_link_width"] = telemetry.pcie_link_width;
+    j["pcie_link_speed"] = telemetry.pcie_link_speed;
+    j["pcie_max_link_width"] = telemetry.pcie_max_link_width;
+    j["pcie_link_degraded"] = telemetry.pcie_link_degraded();
+    j["temperature"] = telemetry.temperature;
+    j["busy"] = busy_state_string(telemetry.busy_state);
+    j["output_mode"] = telemetry.output_mode;
+    j["reference_mode"] = telemetry.reference_mode;
+    return j;
+}
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "extern/DeckLinkAPI.h"
+#include "xstudio/utility/json_store.hpp"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief What a Decklink card says about itself through IDeckLinkStatus,
+     *  so that hardware problems can be diagnosed from within xstudio.
+     *
+     *  @details
+     *   Anything the card doesn't report stays at zero (or empty). The PCIe
+     *   link is what the card negotiated with its slot: a card running on
+     *   fewer lanes than it has (e.g. x4 in an x8 card) may not have the
+     *   bandwidth for big frames at high rates. How many lanes the card has
+     *   isn't in IDeckLinkStatus, the caller fills in pcie_max_link_width
+     *   from sysfs (see decklink_pcie_max_link_width).
+     */
+    struct DeviceTelemetry {
+
+        std::string device_name;
+        int64_t pcie_link_width     = {0}; // lanes
+        int64_t pcie_link_speed     = {0}; // PCIe generation, 1 is 2.5 GT/s
+        int64_t pcie_max_link_width = {0};
+        int64_t temperature         = {0}; // degrees C
+        int64_t busy_state          = {0}; // BMDDeviceBusyState
+        std::string output_mode;           // what the card is sending
+        std::string reference_mode;        // detected on the reference input
+
+        [[nodiscard]] bool pcie_link_degraded() const {
+            return pcie_link_width && pcie_max_link_width && pcie_link_width < pcie_max_link_width;
+        }
+
+        bool operator==(const DeviceTelemetry &o) const;
+        bool operator!=(const DeviceTelemetry &o) const { return !(*this == o); }
+    };
+
+    // Only queries the driver, so it's cheap, but not for the frame callbacks
+    DeviceTelemetry read_device_telemetry(IDeckLink *device, IDeckLinkOutput *output);
+
+    utility::JsonStore device_telemetry_json(const DeviceTelemetry &telemetry);
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
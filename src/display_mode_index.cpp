@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "display_mode_index.hpp"
+#include "xstudio/utility/logging.hpp"
+
+#include <cstdlib>
+
+using namespace xstudio;
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+namespace {
+
+// On Linux strings returned by the Decklink API are malloc'd and must be
+// freed by the caller
+std::string take_string(const char *str) {
+    std::string result(str ? str : "");
+    free((void *)str);
+    return result;
+}
+
+std::string refresh_rate_string(const BMDTimeValue frame_duration, const BMDTimeScale time_scale) {
+    std::string refresh_rate = fmt::format("{:.3f}", double(time_scale) / double(frame_duration));
+    // erase all but the last trailing zero
+    while (refresh_rate.back() == '0' && refresh_rate.rfind(".0") != (refresh_rate.size() - 2)) {
+        refresh_rate.pop_back();
+    }
+    return refresh_rate;
+}
+
+std::string resolution_and_rate_key(const std::string &resolution, const std::string &refresh_rate) {
+    return resolution + "@" + refresh_rate;
+}
+
+const std::vector<BMDVideoConnection> output_connections(
+    {bmdVideoConnectionSDI,
+     bmdVideoConnectionHDMI,
+     bmdVideoConnectionOpticalSDI,
+     bmdVideoConnectionComponent,
+     bmdVideoConnectionComposite,
+     bmdVideoConnectionSVideo});
+
+} // namespace
+
+bool DisplayModeIndex::Mode::supports(const BMDPixelFormat pix_format, const BMDVideoConnection connection) const {
+    auto p = connections.find(pix_format);
+    return p != connections.end() && (connection == bmdVideoConnectionUnspecified || (p->second & connection));
+}
+
+void DisplayModeIndex::build(
+    IDeckLink *device, IDeckLinkOutput *output, const std::vector<BMDPixelFormat> &pixel_formats) {
+
+    clear();
+
+    // the connections that this device (in its current profile) has
+    int64_t device_connections = 0;
+    IDeckLinkProfileAttributes *attributes = NULL;
+    if (device->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&attributes) == S_OK) {
+        attributes->GetInt(BMDDeckLinkVideoOutputConnections, &device_connections);
+        attributes->Release();
+    }
+
+    IDeckLinkDisplayModeIterator *display_mode_iterator = NULL;
+    if (output->GetDisplayModeIterator(&display_mode_iterator) != S_OK)
+        return;
+
+    IDeckLinkDisplayMode *display_mode = NULL;
+    while (display_mode_iterator->Next(&display_mode) == S_OK) {
+
+        Mode m;
+        m.handle = display_mode; // our reference, released in clear()
+        m.mode   = display_mode->GetDisplayMode();
+        const char *name = NULL;
+        if (display_mode->GetName(&name) == S_OK) {
+            m.name = take_string(name);
+        }
+        m.width  = display_mode->GetWidth();
+        m.height = display_mode->GetHeight();
+        display_mode->GetFrameRate(&m.frame_duration, &m.time_scale);
+        m.field_dominance = display_mode->GetFieldDominance();
+        m.resolution      = fmt::format("{} x {}", m.width, m.height);
+        m.refresh_rate    = refresh_rate_string(m.frame_duration, m.time_scale);
+
+        for (const auto pix_format : pixel_formats) {
+
+            bool supported = false;
+            if (device_connections) {
+                int64_t connections = 0;
+                for (const auto connection : output_connections) {
+                    if (!(device_connections & connection))
+                        continue;
+                    if (output->DoesSupportVideoMode(
+                            connection, m.mode, pix_format, bmdNoVideoOutputConversion,
+                            bmdSupportedVideoModeDefault, NULL, &supported) == S_OK &&
+                        supported) {
+                        connections |= connection;
+                    }
+                }
+                if (connections)
+                    m.connections[pix_format] = connections;
+            } else if (
+                output->DoesSupportVideoMode(
+                    bmdVideoConnectionUnspecified, m.mode, pix_format, bmdNoVideoOutputConversion,
+                    bmdSupportedVideoModeDefault, NULL, &supported) == S_OK &&
+                supported) {
+                // the device doesn't tell us its connections
+                m.connections[pix_format] = bmdVideoConnectionUnspecified;
+            }
+        }
+
+        by_mode_[m.mode] = modes_.size();
+        modes_.push_back(std::move(m));
+    }
+    display_mode_iterator->Release();
+
+    // I've decided that support for interlaced modes is not useful! Where a
+    // device has both progressive and PsF versions of a mode we offer the
+    // progressive one.
+    for (size_t i = 0; i < modes_.size(); ++i) {
+
+        const Mode &m = modes_[i];
+        if (m.interlaced() || m.connections.empty())
+            continue;
+
+        const std::string key = resolution_and_rate_key(m.resolution, m.refresh_rate);
+        auto p = by_resolution_and_rate_.find(key);
+        if (p == by_resolution_and_rate_.end()) {
+            by_resolution_and_rate_[key] = i;
+            refresh_rates_[m.resolution].push_back(m.refresh_rate);
+        } else if (modes_[p->second].field_dominance == bmdProgressiveSegmentedFrame) {
+            p->second = i;
+        }
+    }
+
+    spdlog::info("Decklink device supports {} display modes, {} offered.", modes_.size(), by_resolution_and_rate_.size());
+}
+
+void DisplayModeIndex::clear() {
+    for (auto &m : modes_) {
+        m.handle->Release();
+    }
+    modes_.clear();
+    by_mode_.clear();
+    by_resolution_and_rate_.clear();
+    refresh_rates_.clear();
+}
+
+const DisplayModeIndex::Mode *DisplayModeIndex::find(const BMDDisplayMode mode) const {
+    auto p = by_mode_.find(mode);
+    return p != by_mode_.end() ? &modes_[p->second] : nullptr;
+}
+
+const DisplayModeIndex::Mode *
+DisplayModeIndex::find(const std::string &resolution, const std::string &refresh_rate) const {
+    auto p = by_resolution_and_rate_.find(resolution_and_rate_key(resolution, refresh_rate));
+    return p != by_resolution_and_rate_.end() ? &modes_[p->second] : nullptr;
+}
+
+std::vector<std::string> DisplayModeIndex::resolutions() const {
+    std::vector<std::string> result;
+    for (const auto &p : refresh_rates_) {
+        result.push_back(p.first);
+    }
+    return result;
+}
+
+std::vector<std::string> DisplayModeIndex::refresh_rates(const std::string &resolution) const {
+    auto p = refresh_rates_.find(resolution);
+    return p != refresh_rates_.end() ? p->second : std::vector<std::string>();
+}
+
+std::vector<BMDPixelFormat>
+DisplayModeIndex::pixel_formats(const std::string &resolution, const std::string &refresh_rate) const {
+    std::vector<BMDPixelFormat> result;
+    if (const Mode *m = find(resolution, refresh_rate)) {
+        for (const auto &p : m->connections) {
+            result.push_back(p.first);
+        }
+    }
+    return result;
+}
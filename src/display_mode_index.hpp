@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "extern/DeckLinkAPI.h"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief DisplayModeIndex class. What a Decklink output device can do,
+     *  worked out once when the device is opened.
+     *
+     *  @details
+     *   For every display mode we ask DoesSupportVideoMode about each pixel
+     *   format on each of the device's output connections. That's a lot of
+     *   driver calls, so build() runs when a device is opened (or changes
+     *   profile) on the driver's thread, never from the UI or a frame
+     *   callback.
+     *
+     *   The index keeps a reference to each IDeckLinkDisplayMode so that
+     *   starting output doesn't have to iterate the modes again, and mode
+     *   lookups are hash lookups.
+     */
+    class DisplayModeIndex {
+
+      public:
+        struct Mode {
+            IDeckLinkDisplayMode *handle = {nullptr};
+            BMDDisplayMode mode          = {bmdModeUnknown};
+            std::string name;
+            std::string resolution;   // e.g. "1920 x 1080"
+            std::string refresh_rate; // e.g. "23.976"
+            long width                = {0};
+            long height               = {0};
+            BMDTimeValue frame_duration = {0};
+            BMDTimeScale time_scale     = {0};
+            BMDFieldDominance field_dominance = {bmdUnknownFieldDominance};
+
+            // BMDVideoConnection bits that each pixel format can go out on
+            std::map<BMDPixelFormat, int64_t> connections;
+
+            [[nodiscard]] bool interlaced() const {
+                return field_dominance == bmdLowerFieldFirst || field_dominance == bmdUpperFieldFirst;
+            }
+            [[nodiscard]] bool supports(
+                const BMDPixelFormat pix_format,
+                const BMDVideoConnection connection = bmdVideoConnectionUnspecified) const;
+        };
+
+        DisplayModeIndex() = default;
+        DisplayModeIndex(const DisplayModeIndex &) = delete;
+        DisplayModeIndex &operator=(const DisplayModeIndex &) = delete;
+        ~DisplayModeIndex() { clear(); }
+
+        // Queries every mode of the device in each of pixel_formats
+        void build(IDeckLink *device, IDeckLinkOutput *output, const std::vector<BMDPixelFormat> &pixel_formats);
+        void clear();
+
+        [[nodiscard]] const Mode *find(const BMDDisplayMode mode) const;
+        [[nodiscard]] const Mode *find(const std::string &resolution, const std::string &refresh_rate) const;
+
+        // What we offer in the UI: progressive (and PsF) modes that support
+        // at least one of our pixel formats
+        [[nodiscard]] std::vector<std::string> resolutions() const;
+        [[nodiscard]] std::vector<std::string> refresh_rates(const std::string &resolution) const;
+        [[nodiscard]] std::vector<BMDPixelFormat>
+        pixel_formats(const std::string &resolution, const std::string &refresh_rate) const;
+
+      private:
+        std::vector<Mode> modes_;
+        std::unordered_map<BMDDisplayMode, size_t> by_mode_;
+        std::unordered_map<std::string, size_t> by_resolution_and_rate_;
+        std::map<std::string, std::vector<std::string>> refresh_rates_;
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "frame_downscaler.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+namespace {
+
+// The source pixels covering each of n_dst destination pixels. When we
+// aren't scaling down by a whole number some source pixels are counted in
+// two neighbouring blocks, which is close enough for a preview. Reuses the
+// storage of spans, so this doesn't allocate after reserve().
+template <typename Span> void make_spans(std::vector<Span> &spans, const size_t n_src, const size_t n_dst) {
+
+    spans.resize(n_dst);
+    for (size_t i = 0; i < n_dst; ++i) {
+        const size_t begin = std::min((i * n_src) / n_dst, n_src - 1);
+        const size_t end   = std::max(begin + 1, ((i + 1) * n_src + n_dst - 1) / n_dst);
+        spans[i]           = Span{uint32_t(begin), uint32_t(std::min(end, n_src))};
+    }
+}
+
+} // namespace
+
+void FrameDownscaler::reserve(const size_t max_dst_width, const size_t max_dst_height) {
+    columns_.reserve(max_dst_width);
+    rows_.reserve(max_dst_height);
+}
+
+void FrameDownscaler::configure(
+    const size_t src_width,
+    const size_t src_height,
+    const size_t dst_width,
+    const size_t dst_height,
+    const size_t dst_row_pixels) {
+
+    make_spans(columns_, src_width, dst_width);
+    make_spans(rows_, src_height, dst_height);
+    src_width_      = src_width;
+    dst_row_pixels_ = dst_row_pixels ? dst_row_pixels : dst_width;
+}
+
+template <typename F> void FrameDownscaler::for_each_row_band(F &&f) const {
+
+    const size_t n_threads = size_t(workers_.size());
+    const size_t height    = rows_.size();
+    workers_.run(int(n_threads), [&](const int i) {
+        f((height * size_t(i)) / n_threads, (height * size_t(i + 1)) / n_threads);
+    });
+}
+
+void FrameDownscaler::downscale_16bitRGBA(void *_dst, const void *_src) const {
+
+    uint16_t *dst       = (uint16_t *)_dst;
+    const uint16_t *src = (const uint16_t *)_src;
+
+    for_each_row_band([&](const size_t y0, const size_t y1) {
+
+        for (size_t y = y0; y < y1; ++y) {
+
+            const Span r   = rows_[y];
+            uint16_t *d    = dst + y * dst_row_pixels_ * 4;
+
+            for (const Span c : columns_) {
+
+                const float weight = 1.0f / float((r.end - r.begin) * (c.end - c.begin));
+
+#if defined(__SSE2__)
+
+                // all four channels of a pixel are summed in one register
+                const __m128i zero = _mm_setzero_si128();
+                __m128i acc        = zero;
+                for (uint32_t sy = r.begin; sy < r.end; ++sy) {
+                    const uint16_t *s = src + (sy * src_width_ + c.begin) * 4;
+                    for (uint32_t sx = c.begin; sx < c.end; ++sx, s += 4) {
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)s), zero));
+                    }
+                }
+                const __m128 mean = _mm_min_ps(
+                    _mm_mul_ps(_mm_cvtepi32_ps(acc), _mm_set1_ps(weight)), _mm_set1_ps(65535.0f));
+
+                // SSE2 can only pack to signed 16 bit, so offset by 32768
+                // and flip the top bit back afterwards
+                __m128i result = _mm_sub_epi32(_mm_cvtps_epi32(mean), _mm_set1_epi32(32768));
+                result         = _mm_xor_si128(_mm_packs_epi32(result, result), _mm_set1_epi16(int16_t(0x8000)));
+                _mm_storel_epi64((__m128i *)d, result);
+
+#else
+
+                uint32_t acc[4] = {0, 0, 0, 0};
+                for (uint32_t sy = r.begin; sy < r.end; ++sy) {
+                    const uint16_t *s = src + (sy * src_width_ + c.begin) * 4;
+                    for (uint32_t sx = c.begin; sx < c.end; ++sx, s += 4) {
+                        acc[0] += s[0];
+                        acc[1] += s[1];
+                        acc[2] += s[2];
+                        acc[3] += s[3];
+                    }
+                }
+                for (int ch = 0; ch < 4; ++ch)
+                    d[ch] = uint16_t(std::min(float(acc[ch]) * weight + 0.5f, 65535.0f));
+
+#endif
+                d += 4;
+            }
+        }
+    });
+}
+
+void FrameDownscaler::downscale_10bitRGB(void *_dst, const void *_src) const {
+
+    uint32_t *dst       = (uint32_t *)_dst;
+    const uint32_t *src = (const uint32_t *)_src;
+
+    for_each_row_band([&](const size_t y0, const size_t y1) {
+
+        for (size_t y = y0; y < y1; ++y) {
+
+            const Span r = rows_[y];
+            uint32_t *d  = dst + y * dst_row_pixels_;
+
+            for (const Span c : columns_) {
+
+                uint32_t red = 0, green = 0, blue = 0;
+                for (uint32_t sy = r.begin; sy < r.end; ++sy) {
+                    const uint32_t *s = src + sy * src_width_ + c.begin;
+                    for (uint32_t sx = c.begin; sx < c.end; ++sx) {
+                        const uint32_t le = __builtin_bswap32(*(s++));
+                        red += (le >> 20) & 0x3ff;
+                        green += (le >> 10) & 0x3ff;
+                        blue += le & 0x3ff;
+                    }
+                }
+                const float weight = 1.0f / float((r.end - r.begin) * (c.end - c.begin));
+                const uint32_t le  = uint32_t(float(blue) * weight + 0.5f) +
+                                    (uint32_t(float(green) * weight + 0.5f) << 10) +
+                                    (uint32_t(float(red) * weight + 0.5f) << 20);
+                *(d++) = __builtin_bswap32(le);
+            }
+        }
+    });
+}
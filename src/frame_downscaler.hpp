@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "conversion_worker_pool.hpp"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief FrameDownscaler class. Box filters the image rendered by xstudio
+     *  down to a smaller size, e.g. UHD to HD for a preview output.
+     *
+     *  @details
+     *   Each destination pixel is the average of the block of source pixels
+     *   that it covers. The blocks (and the weight of each one) are worked out
+     *   in configure(), which is the only call that allocates (and not even
+     *   that after reserve()), so downscale calls are fine from the Decklink
+     *   frame callback. Rows of the output are shared out between the
+     *   conversion worker threads.
+     *
+     *   The source stays in the pixel format that xstudio gave us, so the
+     *   result goes through the same pixel conversion as a full size frame.
+     */
+    class FrameDownscaler {
+
+      public:
+        explicit FrameDownscaler(ConversionWorkerPool &workers) : workers_(workers) {}
+
+        // Makes room for the largest destination we'll be asked for, so that
+        // configure() can be called from a frame callback
+        void reserve(const size_t max_dst_width, const size_t max_dst_height);
+
+        // dst_row_pixels (if set) is the width of a row in the destination
+        // buffer, which lets us scale into a rectangle inside a bigger image.
+        void configure(
+            const size_t src_width,
+            const size_t src_height,
+            const size_t dst_width,
+            const size_t dst_height,
+            const size_t dst_row_pixels = 0);
+
+        [[nodiscard]] size_t width() const { return columns_.size(); }
+        [[nodiscard]] size_t height() const { return rows_.size(); }
+
+        // 16 bit RGBA (xstudio's RGBA_16 viewport format)
+        void downscale_16bitRGBA(void *_dst, const void *_src) const;
+
+        // big endian 10 bit RGB words, as xstudio's RGBA_10_10_10_2 viewport
+        // format is laid out for bmdFormat10BitRGB
+        void downscale_10bitRGB(void *_dst, const void *_src) const;
+
+      private:
+        // range of source pixels (or rows) that one destination pixel covers
+        struct Span {
+            uint32_t begin, end;
+        };
+
+        template <typename F> void for_each_row_band(F &&f) const;
+
+        ConversionWorkerPool &workers_;
+        std::vector<Span> columns_;
+        std::vector<Span> rows_;
+        size_t src_width_      = {0};
+        size_t dst_row_pixels_ = {0};
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "frame_geometry_adapter.hpp"
+#include "xstudio/enums.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace xstudio;
+using namespace xstudio::bm_decklink_plugin_1_0;
+
+size_t FrameGeometryAdapter::bytes_per_pixel(const int xstudio_pixel_format) {
+
+    // the formats that we know how to convert for the card
+    if (xstudio_pixel_format == ui::viewport::RGBA_16)
+        return 8;
+    if (xstudio_pixel_format == ui::viewport::RGBA_10_10_10_2)
+        return 4;
+    return 0;
+}
+
+void FrameGeometryAdapter::configure(const size_t width, const size_t height) {
+
+    width_  = width;
+    height_ = height;
+
+    // big enough for the biggest pixel format. Only reallocated when it
+    // grows, and cleared then, as warm_up converts from it before any frame
+    // comes in.
+    if (width * height * 8 > capacity_) {
+        capacity_ = width * height * 8;
+        image_.reset(new uint8_t[capacity_]());
+    }
+    // place() runs on the frame callback when the source size changes, so
+    // it mustn't allocate either
+    downscaler_.reserve(width, height);
+    borders_.reserve(4);
+    src_width_  = 0;
+    src_height_ = 0;
+}
+
+void FrameGeometryAdapter::place(const size_t src_width, const size_t src_height, const int xstudio_pixel_format) {
+
+    src_width_       = src_width;
+    src_height_      = src_height;
+    pixel_format_    = xstudio_pixel_format;
+    bytes_per_pixel_ = bytes_per_pixel(xstudio_pixel_format);
+
+    // centre the image, scaling it down to fit if it's too big
+    size_t w = src_width, h = src_height;
+    scaled_ = w > width_ || h > height_;
+    if (scaled_) {
+        const double scale = std::min(double(width_) / double(w), double(height_) / double(h));
+        w = std::clamp(size_t(std::round(double(w) * scale)), size_t(1), width_);
+        h = std::clamp(size_t(std::round(double(h) * scale)), size_t(1), height_);
+        downscaler_.configure(src_width, src_height, w, h, width_);
+    }
+    image_rect_ = Rect{(width_ - w) / 2, (height_ - h) / 2, w, h};
+
+    // top, bottom, left and right of the image
+    const Rect &r = image_rect_;
+    borders_.clear();
+    for (const Rect &b :
+         {Rect{0, 0, width_, r.y},
+          Rect{0, r.y + r.height, width_, height_ - r.y - r.height},
+          Rect{0, r.y, r.x, r.height},
+          Rect{r.x + r.width, r.y, width_ - r.x - r.width, r.height}}) {
+        if (b.width && b.height)
+            borders_.push_back(b);
+    }
+
+    for (const auto &b : borders_)
+        clear_rect(b);
+}
+
+void FrameGeometryAdapter::clear_rect(const Rect &r) {
+
+    const size_t row_bytes = width_ * bytes_per_pixel_;
+    const size_t n_threads = size_t(workers_.size());
+    workers_.run(int(n_threads), [&](const int i) {
+        for (size_t y = r.y + (r.height * size_t(i)) / n_threads; y < r.y + (r.height * size_t(i + 1)) / n_threads; ++y) {
+            memset(image_.get() + y * row_bytes + r.x * bytes_per_pixel_, 0, r.width * bytes_per_pixel_);
+        }
+    });
+}
+
+void *FrameGeometryAdapter::adapt(
+    void *src, const size_t src_width, const size_t src_height, const int xstudio_pixel_format) {
+
+    if (!image_ || !src_width || !src_height || !bytes_per_pixel(xstudio_pixel_format))
+        return nullptr;
+
+    if (src_width != src_width_ || src_height != src_height_ || xstudio_pixel_format != pixel_format_) {
+        place(src_width, src_height, xstudio_pixel_format);
+    }
+
+    const size_t bpp           = bytes_per_pixel_;
+    const size_t row_bytes     = width_ * bpp;
+    const size_t src_row_bytes = src_width * bpp;
+    const Rect &r              = image_rect_;
+    uint8_t *dst               = image_.get() + r.y * row_bytes + r.x * bpp;
+
+    if (scaled_) {
+        if (xstudio_pixel_format == ui::viewport::RGBA_16)
+            downscaler_.downscale_16bitRGBA(dst, src);
+        else
+            downscaler_.downscale_10bitRGB(dst, src);
+    } else {
+        const size_t n_threads = size_t(workers_.size());
+        workers_.run(int(n_threads), [&](const int i) {
+            for (size_t y = (r.height * size_t(i)) / n_threads; y < (r.height * size_t(i + 1)) / n_threads; ++y) {
+                memcpy(dst + y * row_bytes, (const uint8_t *)src + y * src_row_bytes, r.width * bpp);
+            }
+        });
+    }
+
+    return image_.get();
+}
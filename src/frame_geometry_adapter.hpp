@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "conversion_worker_pool.hpp"
+#include "frame_downscaler.hpp"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief FrameGeometryAdapter class. Fits an image from xstudio that
+     *  isn't the size of the output raster into one that is.
+     *
+     *  @details
+     *   For a frame or two after the display mode changes xstudio can still
+     *   deliver images rendered at the old size. Rather than sending whatever
+     *   happens to be in the output frame we centre the image in a black
+     *   raster of the right size, scaling it down (keeping its aspect ratio)
+     *   if it doesn't fit.
+     *
+     *   The adapted image is kept between frames and stays in xstudio's pixel
+     *   format, so it goes through the normal conversion afterwards. Where the
+     *   image goes and the black borders around it are worked out when the
+     *   source size changes, and the borders are cleared then, so each frame
+     *   only the image area is written.
+     */
+    class FrameGeometryAdapter {
+
+      public:
+        explicit FrameGeometryAdapter(ConversionWorkerPool &workers)
+            : workers_(workers), downscaler_(workers) {}
+
+        // Sets the size of the output raster. Allocates the adapted image,
+        // so call when output starts rather than per frame.
+        void configure(const size_t width, const size_t height);
+
+        // Returns the adapted image, or nullptr if the source can't be used.
+        void *adapt(void *src, const size_t src_width, const size_t src_height, const int xstudio_pixel_format);
+
+        // size in bytes of the image returned by adapt
+        [[nodiscard]] size_t size() const { return width_ * height_ * bytes_per_pixel_; }
+
+        // The adapted image's buffer, which holds the raster in any pixel
+        // format. Black, or whatever was adapted last. DecklinkOutput's
+        // warm_up converts from it rather than allocating a buffer of its own.
+        [[nodiscard]] uint8_t *buffer() { return image_.get(); }
+        [[nodiscard]] size_t capacity() const { return capacity_; }
+
+        static size_t bytes_per_pixel(const int xstudio_pixel_format);
+
+      private:
+        struct Rect {
+            size_t x, y, width, height;
+        };
+
+        void place(const size_t src_width, const size_t src_height, const int xstudio_pixel_format);
+        void clear_rect(const Rect &r);
+
+        ConversionWorkerPool &workers_;
+        FrameDownscaler downscaler_;
+
+        size_t width_           = {0};
+        size_t height_          = {0};
+        size_t bytes_per_pixel_ = {8};
+        std::unique_ptr<uint8_t[]> image_;
+        size_t capacity_ = {0};
+
+        // current placement of the source within the raster
+        size_t src_width_  = {0};
+        size_t src_height_ = {0};
+        int pixel_format_  = {0};
+        bool scaled_       = {false};
+        Rect image_rect_   = {0, 0, 0, 0};
+        std::vector<Rect> borders_;
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "numa_topology.hpp"
+#include "thread_scheduling.hpp"
+#include "xstudio/utility/logging.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <set>
+
+namespace fs = std::filesystem;
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+namespace {
+
+// On Linux strings returned by the Decklink API are malloc'd and must be
+// freed by the caller
+std::string take_string(const char *str) {
+    std::string result(str ? str : "");
+    free((void *)str);
+    return result;
+}
+
+std::string read_line(const fs::path &path) {
+    std::ifstream f(path);
+    std::string line;
+    std::getline(f, line);
+    return line;
+}
+
+// numa_node of a PCI device directory in sysfs. The kernel says -1 where
+// it doesn't know.
+int pci_numa_node(const fs::path &pci_device) {
+    const std::string node = read_line(pci_device / "numa_node");
+    try {
+        return node.empty() ? -1 : std::stoi(node);
+    } catch (std::exception &) {
+        return -1;
+    }
+}
+
+// Blackmagic's PCI vendor IDs, current and older cards
+const std::set<std::string> blackmagic_vendor_ids({"0x1edb", "0xbdbd"});
+
+// The card's PCI device directory in sysfs, found from the driver's device
+// handle, or empty if we can't tell
+fs::path decklink_pci_device(IDeckLink *device, std::string &handle) {
+
+    IDeckLinkProfileAttributes *attributes = NULL;
+    if (device->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&attributes) == S_OK) {
+        const char *str = NULL;
+        if (attributes->GetString(BMDDeckLinkDeviceHandle, &str) == S_OK) {
+            handle = take_string(str);
+        }
+        attributes->Release();
+    }
+    if (handle.empty())
+        return fs::path();
+
+    std::error_code ec;
+
+    // the handle may include the card's PCI address, e.g. 0000:3b:00.0
+    std::smatch m;
+    if (std::regex_search(handle, m, std::regex("[0-9a-fA-F]{4}:[0-9a-fA-F]{2}:[0-9a-fA-F]{2}\\.[0-7]"))) {
+        const fs::path pci_device = fs::path("/sys/bus/pci/devices") / m.str();
+        if (fs::exists(pci_device, ec))
+            return pci_device;
+    }
+
+    // or name its device node, e.g. /dev/blackmagic/io0, which the
+    // driver's sysfs class links back to the PCI device
+    const fs::path class_device = fs::path("/sys/class/blackmagic") / fs::path(handle).filename() / "device";
+    if (fs::exists(class_device, ec))
+        return class_device;
+
+    return fs::path();
+}
+
+} // namespace
+
+int numa_node_count() {
+
+    std::error_code ec;
+    int count = 0;
+    for (const auto &entry : fs::directory_iterator("/sys/devices/system/node", ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit(name[4]))
+            count++;
+    }
+    return std::max(count, 1);
+}
+
+std::vector<int> numa_node_cores(const int node) {
+
+    if (node < 0)
+        return std::vector<int>();
+    try {
+        // same format as our core list preference, e.g. 0-15,32-47
+        return parse_core_list(read_line(fmt::format("/sys/devices/system/node/node{}/cpulist", node)));
+    } catch (std::exception &) {
+        return std::vector<int>();
+    }
+}
+
+int decklink_numa_node(IDeckLink *device) {
+
+    if (numa_node_count() < 2)
+        return -1;
+
+    std::string handle;
+    const fs::path pci_device = decklink_pci_device(device, handle);
+    if (!pci_device.empty())
+        return pci_numa_node(pci_device);
+
+    // if all the Blackmagic cards are on one node then so is this one
+    std::error_code ec;
+    std::set<int> nodes;
+    for (const auto &entry : fs::directory_iterator("/sys/bus/pci/devices", ec)) {
+        if (blackmagic_vendor_ids.count(read_line(entry.path() / "vendor")))
+            nodes.insert(pci_numa_node(entry.path()));
+    }
+    if (nodes.size() == 1)
+        return *nodes.begin();
+
+    spdlog::info("Could not tell which NUMA node Decklink device handle \"{}\" is on.", handle);
+    return -1;
+}
+
+int decklink_pcie_max_link_width(IDeckLink *device) {
+
+    std::string handle;
+    const fs::path pci_device = decklink_pci_device(device, handle);
+    if (pci_device.empty())
+        return 0;
+    try {
+        return std::stoi(read_line(pci_device / "max_link_width"));
+    } catch (std::exception &) {
+        return 0;
+    }
+}
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "extern/DeckLinkAPI.h"
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief Where a Decklink card sits on a multi-socket (NUMA) machine,
+     *  read from sysfs.
+     *
+     *  @details
+     *   We don't use libnuma. Memory goes on the node of the thread that
+     *   first writes to it (the kernel's default policy), so putting our
+     *   conversion threads on the card's node, and zeroing buffers from
+     *   them, is enough to keep frames on that node.
+     *
+     *   The card's PCIe device is found from the driver's device handle.
+     *   Failing that, if every Blackmagic card in the machine is on the same
+     *   node we use that.
+     */
+
+    // -1 if unknown, or the machine only has one node
+    int decklink_numa_node(IDeckLink *device);
+
+    // number of NUMA nodes in the machine (1 for a non-NUMA machine)
+    int numa_node_count();
+
+    // the cores of a node, empty if there's no such node
+    std::vector<int> numa_node_cores(const int node);
+
+    // How many PCIe lanes the card can use, which may be more than the slot
+    // gave it. 0 if unknown.
+    int decklink_pcie_max_link_width(IDeckLink *device);
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -1,16 +1,120 @@
 #include "pixel_swizzler.hpp"
-#include <memory>
-#include <thread>
-#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include "xstudio/utility/chrono.hpp"
 
 using namespace xstudio::bm_decklink_plugin_1_0;
 using namespace xstudio;
 
+template <typename DstType, typename SwizzleFunc>
+void PixelSwizzler::convert(
+    SwizzleFunc swizzle_chunk,
+    const size_t dst_bytes_per_8_pix,
+    void * _dst,
+    void * _src,
+    const size_t width,
+    const size_t height,
+    const size_t dst_row_bytes)
+{
+    // The image is split into jobs for our worker threads. Each job is a
+    // block of rows over a range of columns and we call swizzle_chunk for
+    // each row in the block. The source is always 16 bit RGBA.
+    struct Block {
+        size_t x0, width, y0, y1;
+    };
+
+    const size_t n_threads = size_t(workers_.size());
+    auto split = split_;
+
+    // for quad link square division each job is within one quadrant (i.e.
+    // one of the four SDI links). Every output pixel format that we write
+    // packs 8 pixels into a whole number of 32 bit words so quadrant columns
+    // need to start on a multiple of 8
+    if (split == ConversionSplit::Quadrants && ((width % 16) || (height % 2)))
+        split = ConversionSplit::Strips;
+
+    // jobs per quadrant / link when splitting for quad link
+    const size_t k = std::max(size_t(1), (n_threads + 3) / 4);
+
+    auto block = [=](const size_t j) -> Block {
+        if (split == ConversionSplit::Quadrants) {
+            const size_t quadrant = j / k;
+            const size_t band = j % k;
+            const size_t qh = height / 2;
+            const size_t y = (quadrant >> 1) * qh;
+            return Block{(quadrant & 1) * (width / 2), width / 2, y + (qh * band) / k, y + (qh * (band + 1)) / k};
+        } else if (split == ConversionSplit::SampleInterleave) {
+            // two sample interleave sends alternate pairs of pixels from
+            // alternate pairs of rows down the four links so every job
+            // covers whole pairs of rows, giving each link an equal share
+            const size_t n_jobs = 4 * k;
+            const size_t row_pairs = height / 2;
+            const size_t y0 = ((row_pairs * j) / n_jobs) * 2;
+            const size_t y1 = j == n_jobs - 1 ? height : ((row_pairs * (j + 1)) / n_jobs) * 2;
+            return Block{0, width, y0, y1};
+        }
+        return Block{0, width, (height * j) / n_threads, (height * (j + 1)) / n_threads};
+    };
+
+    const int n_jobs = split == ConversionSplit::Strips ? int(n_threads) : int(4 * k);
+
+    uint8_t * dst = (uint8_t *)_dst;
+    uint16_t * src = (uint16_t *)_src;
+
+    workers_.run(n_jobs, [&](const int j) {
+        const Block b = block(size_t(j));
+        for (size_t y = b.y0; y < b.y1; ++y) {
+            swizzle_chunk(
+                (DstType *)(dst + y * dst_row_bytes + (b.x0 * dst_bytes_per_8_pix) / 8),
+                src + (y * width + b.x0) * 4,
+                b.width);
+        }
+    });
+}
+
+void PixelSwizzler::copy(
+            void * _dst,
+            void * _src,
+            size_t buf_size) 
+{
+    // plain copy for when xstudio has already given us the pixel format
+    // that we need, split into page sized chunks across our workers
+    const size_t n_threads = size_t(workers_.size());
+    const size_t step = ((buf_size / n_threads + 4095) / 4096) * 4096;
+
+    uint8_t *dst = (uint8_t *)_dst;
+    uint8_t *src = (uint8_t *)_src;
+
+    workers_.run(int(n_threads), [&](const int i) {
+        const size_t offset = step * size_t(i);
+        if (offset < buf_size)
+            memcpy(dst + offset, src + offset, std::min(step, buf_size - offset));
+    });
+}
+
+void PixelSwizzler::clear(
+            void * _dst,
+            size_t buf_size) 
+{
+    const size_t n_threads = size_t(workers_.size());
+    const size_t step = ((buf_size / n_threads + 4095) / 4096) * 4096;
+
+    uint8_t *dst = (uint8_t *)_dst;
+
+    workers_.run(int(n_threads), [&](const int i) {
+        const size_t offset = step * size_t(i);
+        if (offset < buf_size)
+            memset(dst + offset, 0, std::min(step, buf_size - offset));
+    });
+}
+
 void PixelSwizzler::cpy16bitRGBA_to_10bitRGB(
             void * _dst,
             void * _src,
-            size_t num_pix) 
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes) 
 {
 
     // could SSE instructions be used here, or will compiler achieve that
@@ -29,35 +133,15 @@ void PixelSwizzler::cpy16bitRGBA_to_10bitRGB(
 
     };
 
-    // Note: my instinct tells me that spawning threads for
-    // every copy operation (which might happen 60 times a second)
-    // is not efficient but it seems that having a threadool doesn't
-    // make any real difference, the overhead of thread creation
-    // is tiny.
-    std::vector<std::thread> memcpy_threads;
-    size_t step = ((num_pix / n_threads_) / 4096) * 4096;
-
-    uint32_t *dst = (uint32_t *)_dst;
-    uint16_t *src = (uint16_t *)_src;
-
-    for (int i = 0; i < n_threads_; ++i) {
-        memcpy_threads.emplace_back(swizzle_chunk, dst, src, std::min(num_pix, step));
-        dst += step;
-        src += step*4;
-        num_pix -= step;
-    }
-
-    // ensure any threads still running to copy data to this texture are done
-    for (auto &t : memcpy_threads) {
-        if (t.joinable())
-            t.join();
-    }
+    convert<uint32_t>(swizzle_chunk, 32, _dst, _src, width, height, dst_row_bytes);
 }
 
 void PixelSwizzler::cpy16bitRGBA_to_10bitRGBX(
             void * _dst,
             void * _src,
-            size_t num_pix) 
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes) 
 {
 
     // could SSE instructions be used here, or will compiler achieve that
@@ -82,38 +166,15 @@ void PixelSwizzler::cpy16bitRGBA_to_10bitRGBX(
 
     };
 
-    //auto t0 = utility::clock::now();
-
-    // Note: my instinct tells me that spawning threads for
-    // every copy operation (which might happen 60 times a second)
-    // is not efficient but it seems that having a threadool doesn't
-    // make any real difference, the overhead of thread creation
-    // is tiny.
-    std::vector<std::thread> memcpy_threads;
-    size_t step = ((num_pix / n_threads_) / 4096) * 4096;
-
-    uint32_t *dst = (uint32_t *)_dst;
-    uint16_t *src = (uint16_t *)_src;
-
-    for (int i = 0; i < n_threads_; ++i) {
-        memcpy_threads.emplace_back(swizzle_chunk, dst, src, std::min(num_pix, step));
-        dst += step;
-        src += step*4;
-        num_pix -= step;
-    }
-
-    // ensure any threads still running to copy data to this texture are done
-    for (auto &t : memcpy_threads) {
-        if (t.joinable())
-            t.join();
-    }
-    // std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(utility::clock::now() - t0).count() << "\n";
+    convert<uint32_t>(swizzle_chunk, 32, _dst, _src, width, height, dst_row_bytes);
 }
 
 void PixelSwizzler::cpy16bitRGBA_to_10bitRGBXLE(
             void * _dst,
             void * _src,
-            size_t num_pix) 
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes) 
 {
 
     // could SSE instructions be used here, or will compiler achieve that
@@ -137,39 +198,16 @@ void PixelSwizzler::cpy16bitRGBA_to_10bitRGBXLE(
 
     };
 
-    //auto t0 = utility::clock::now();
-
-    // Note: my instinct tells me that spawning threads for
-    // every copy operation (which might happen 60 times a second)
-    // is not efficient but it seems that having a threadool doesn't
-    // make any real difference, the overhead of thread creation
-    // is tiny.
-    std::vector<std::thread> memcpy_threads;
-    size_t step = ((num_pix / n_threads_) / 4096) * 4096;
-
-    uint32_t *dst = (uint32_t *)_dst;
-    uint16_t *src = (uint16_t *)_src;
-
-    for (int i = 0; i < n_threads_; ++i) {
-        memcpy_threads.emplace_back(swizzle_chunk, dst, src, std::min(num_pix, step));
-        dst += step;
-        src += step*4;
-        num_pix -= step;
-    }
-
-    // ensure any threads still running to copy data to this texture are done
-    for (auto &t : memcpy_threads) {
-        if (t.joinable())
-            t.join();
-    }
-    // std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(utility::clock::now() - t0).count() << "\n";
+    convert<uint32_t>(swizzle_chunk, 32, _dst, _src, width, height, dst_row_bytes);
 }
 
 
 void PixelSwizzler::cpy16bitRGBA_to_10bitRGBLE(
             void * _dst,
             void * _src,
-            size_t num_pix) 
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes) 
 {
 
     auto swizzle_chunk = [](uint32_t * _dst, uint16_t * _src, size_t n) {
@@ -185,35 +223,15 @@ void PixelSwizzler::cpy16bitRGBA_to_10bitRGBLE(
 
     };
 
-    // Note: my instinct tells me that spawning threads for
-    // every copy operation (which might happen 60 times a second)
-    // is not efficient but it seems that having a threadool doesn't
-    // make any real difference, the overhead of thread creation
-    // is tiny.
-    std::vector<std::thread> memcpy_threads;
-    size_t step = ((num_pix / n_threads_) / 4096) * 4096;
-
-    uint32_t *dst = (uint32_t *)_dst;
-    uint16_t *src = (uint16_t *)_src;
-
-    for (int i = 0; i < n_threads_; ++i) {
-        memcpy_threads.emplace_back(swizzle_chunk, dst, src, std::min(num_pix, step));
-        dst += step;
-        src += step*4;
-        num_pix -= step;
-    }
-
-    // ensure any threads still running to copy data to this texture are done
-    for (auto &t : memcpy_threads) {
-        if (t.joinable())
-            t.join();
-    }
+    convert<uint32_t>(swizzle_chunk, 32, _dst, _src, width, height, dst_row_bytes);
 }
 
 void PixelSwizzler::cpy16bitRGBA_to_12bitRGBLE(
             void * _dst,
             void * _src,
-            size_t num_pix) 
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes) 
 {
 
     // again, SSE instructions could make this soooo much better unless
@@ -261,30 +279,15 @@ void PixelSwizzler::cpy16bitRGBA_to_12bitRGBLE(
 
     };
 
-    std::vector<std::thread> memcpy_threads;
-    size_t step = ((num_pix / n_threads_) / 4128) * 4128;
-
-    uint16_t *dst = (uint16_t *)_dst;
-    uint16_t *src = (uint16_t *)_src;
-
-    for (int i = 0; i < n_threads_; ++i) {
-        memcpy_threads.emplace_back(swizzle_chunk, dst, src, std::min(num_pix, step));
-        dst += (step*9)/4;
-        src += step*4;
-        num_pix -= step;
-    }
-
-    // ensure any threads still running to copy data to this texture are done
-    for (auto &t : memcpy_threads) {
-        if (t.joinable())
-            t.join();
-    }
+    convert<uint16_t>(swizzle_chunk, 36, _dst, _src, width, height, dst_row_bytes);
 }
 
 void PixelSwizzler::cpy16bitRGBA_to_12bitRGB(
             void * _dst,
             void * _src,
-            size_t num_pix) 
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes) 
 {
 
     // again, SSE instructions could make this soooo much better unless
@@ -339,23 +342,6 @@ void PixelSwizzler::cpy16bitRGBA_to_12bitRGB(
 
     };
 
-    std::vector<std::thread> memcpy_threads;
-    size_t step = ((num_pix / n_threads_) / 4128) * 4128;
-
-    uint16_t *dst = (uint16_t *)_dst;
-    uint16_t *src = (uint16_t *)_src;
-
-    for (int i = 0; i < n_threads_; ++i) {
-        memcpy_threads.emplace_back(swizzle_chunk, dst, src, std::min(num_pix, step));
-        dst += (step*9)/4;
-        src += step*4;
-        num_pix -= step;
-    }
-
-    // ensure any threads still running to copy data to this texture are done
-    for (auto &t : memcpy_threads) {
-        if (t.joinable())
-            t.join();
-    }
+    convert<uint16_t>(swizzle_chunk, 36, _dst, _src, width, height, dst_row_bytes);
 }
 
@@ -7,15 +7,36 @@ example packing 10 bit RGB into RGBA8 (unsigned byte) output when we need
 RGB 10_10_10_2 for the SDI Output card.
 */
 #include <cstddef>
+#include "conversion_worker_pool.hpp"
 
 namespace xstudio {
     namespace bm_decklink_plugin_1_0 {
 
+// How the image is divided up between our worker threads. With quad link SDI
+// (e.g. 8K output over 4 x 12G links) the card sends each quarter of the
+// frame down a different link, either as four quadrants (square division)
+// or with pairs of pixels dealt out to the links in turn (two sample
+// interleave). We split our conversion jobs along the same lines.
+enum class ConversionSplit { Strips, Quadrants, SampleInterleave };
+
 class PixelSwizzler
 {
     public:
 
-        PixelSwizzler(const int n_threads=8) : n_threads_(n_threads) {}
+        PixelSwizzler(ConversionWorkerPool & workers) : workers_(workers) {}
+
+        void set_split(const ConversionSplit split) { split_ = split; }
+
+        void copy(
+            void * _dst,
+            void * _src,
+            size_t buf_size);
+
+        // zeroes a buffer from the worker threads, so it is their memory
+        // node that the pages are placed on when first touched
+        void clear(
+            void * _dst,
+            size_t buf_size);
 
         /*void cpy8bitRGBA_to_8bitYUV(
             void * _dst,
@@ -40,33 +61,44 @@ class PixelSwizzler
         void cpy16bitRGBA_to_10bitRGB(
             void * _dst,
             void * _src,
-            size_t num_pix);
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
 
         void cpy16bitRGBA_to_10bitRGBX(
             void * _dst,
             void * _src,
-            size_t num_pix
-        );
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
 
         void cpy16bitRGBA_to_10bitRGBXLE(
             void * _dst,
             void * _src,
-            size_t num_pix
-        );        
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
 
         void cpy16bitRGBA_to_10bitRGBLE(
             void * _dst,
             void * _src,
-            size_t num_pix);
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
 
-        void cpy16bitRGBA_to_12bitRGB(void * _dst,
+        void cpy16bitRGBA_to_12bitRGB(
+            void * _dst,
             void * _src,
-            size_t num_pix);
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
 
-        void cpy16bitRGBA_to_12bitRGBLE(void * _dst,
+        void cpy16bitRGBA_to_12bitRGBLE(
+            void * _dst,
             void * _src,
-            size_t num_pix);
-
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
 
         /*void cpy16bitRGBA_to_12bitRGB(
             void * _dst,
@@ -83,7 +115,20 @@ class PixelSwizzler
             void * _src,
             size_t num_pix);*/
 
-    const int n_threads_;
+    private:
+
+        template <typename DstType, typename SwizzleFunc>
+        void convert(
+            SwizzleFunc swizzle_chunk,
+            const size_t dst_bytes_per_8_pix,
+            void * _dst,
+            void * _src,
+            const size_t width,
+            const size_t height,
+            const size_t dst_row_bytes);
+
+    ConversionWorkerPool & workers_;
+    ConversionSplit split_ = {ConversionSplit::Strips};
 };
 }
 }
\ No newline at end of file
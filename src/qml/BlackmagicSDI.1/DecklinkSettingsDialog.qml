@@ -9,7 +9,7 @@ XsWindow {
 
 	id: bmd_settings_dialog
 	width: 400
-	height: 500
+	height: 610
     title: "Blackmagic Designs Decklink Output"
     centerOnOpen: true
 
@@ -22,6 +22,7 @@ XsWindow {
             __startStop.index = search_recursive("Start Stop", "title")
             __trackViewport.index = search_recursive("Track Viewport", "title")
             __audioDelay.index = search_recursive("Audio Sync Delay (milliseconds)", "title")
+            __audioLevels.index = search_recursive("Audio Levels", "title")
         }
     }
 
@@ -62,10 +63,28 @@ XsWindow {
     }
     property alias audioDelay: __audioDelay.value
 
+    XsModelProperty {
+        id: __audioLevels
+        role: "value"
+        index: decklink_settings.search_recursive("Audio Levels", "title")
+    }
+    property var audioLevels: __audioLevels.value
+
+    // meters show -60dBFS to 0dBFS
+    function meterFraction(db) {
+        return db == undefined ? 0.0 : Math.max(0.0, Math.min(1.0, (db + 60.0) / 60.0))
+    }
+
     property var maxBoxWidth: 30
 
     ListModel{ 
         id: bmd_settings_attr_model
+        ListElement{
+            label_text: "Decklink Device"
+            model_name: "Decklink Settings"
+            attr_name: "Decklink Device"
+            disable_when_running: true
+        }
         ListElement{
             label_text: "SDI Output Resolution"
             model_name: "Decklink Settings"
@@ -257,7 +276,7 @@ XsWindow {
 
             Text {
 
-                Layout.row: 6
+                Layout.row: 7
                 Layout.column: 0
                 Layout.alignment: Qt.AlignRight
                 text: "Follow Main Viewport Pan/Zoom"
@@ -269,7 +288,7 @@ XsWindow {
             }
 
             XsCheckbox {
-                Layout.row: 6
+                Layout.row: 7
                 Layout.column: 1
                 Layout.alignment: Qt.AlignLeft
                 Layout.preferredHeight: 24
@@ -282,7 +301,7 @@ XsWindow {
 
             Text {
 
-                Layout.row: 7
+                Layout.row: 8
                 Layout.column: 0
                 Layout.alignment: Qt.AlignRight
                 text: "Audio Delay (millisecs)"
@@ -331,7 +350,7 @@ XsWindow {
             }
 
             Text {
-                Layout.row: 8
+                Layout.row: 9
                 Layout.column: 0
                 Layout.alignment: Qt.AlignRight | Qt.AlignTop
                 
@@ -346,7 +365,7 @@ XsWindow {
             Rectangle {
 
                 color: "#333"
-                Layout.row: 8
+                Layout.row: 9
                 Layout.column: 1
                 Layout.alignment: Qt.AlignLeft | Qt.AlignTop
                 Layout.preferredWidth: maxBoxWidth + 50
@@ -364,6 +383,64 @@ XsWindow {
                     verticalAlignment: Text.AlignTop
                 }
             }
+            Text {
+                Layout.row: 10
+                Layout.column: 0
+                Layout.alignment: Qt.AlignRight | Qt.AlignTop
+
+                text: "Audio Levels"
+                color: XsStyle.controlColor
+                font.family: XsStyle.controlTitleFontFamily
+                font.pixelSize: XsStyle.popupControlFontSize
+                horizontalAlignment: Text.AlignRight
+                verticalAlignment: Text.AlignVCenter
+            }
+
+            Row {
+
+                Layout.row: 10
+                Layout.column: 1
+                Layout.alignment: Qt.AlignLeft | Qt.AlignTop
+                Layout.preferredHeight: 60
+                spacing: 3
+
+                Repeater {
+
+                    // one meter per SDI channel. The bar is the RMS level and
+                    // the line above it is the peak level.
+                    model: audioLevels != undefined && audioLevels.rms != undefined ? audioLevels.rms.length : 0
+
+                    Rectangle {
+                        width: 10
+                        height: 60
+                        color: "#222"
+                        border.color: "#555"
+                        border.width: 1
+
+                        property var rmsFraction: meterFraction(audioLevels.rms[index])
+                        property var peakFraction: meterFraction(audioLevels.peak[index])
+
+                        Rectangle {
+                            anchors.bottom: parent.bottom
+                            anchors.left: parent.left
+                            anchors.right: parent.right
+                            anchors.margins: 1
+                            height: (parent.height-2)*rmsFraction
+                            color: rmsFraction > 0.9 ? "#c00" : rmsFraction > 0.7 ? "#cc0" : "#0a0"
+                        }
+
+                        Rectangle {
+                            anchors.left: parent.left
+                            anchors.right: parent.right
+                            anchors.margins: 1
+                            height: 2
+                            y: (parent.height-2)*(1.0-peakFraction)
+                            visible: peakFraction > 0.0
+                            color: peakFraction >= 1.0 ? "#f00" : XsStyle.controlColor
+                        }
+                    }
+                }
+            }
         }
 
         Item {
@@ -63,20 +63,20 @@ Item {
             label_text: "SDI Output Resolution"
             model_name: "Decklink Settings"
             attr_name: "Output Resolution"        
-            disable_when_running: true  
+            disable_when_running: false  
         }
         ListElement{
             label_text: "SDI Refresh Rate"
             model_name: "Decklink Settings"
             attr_name: "Refresh Rate"
-            disable_when_running: true  
+            disable_when_running: false  
         }
 
         ListElement{
             label_text: "Pixel Format"
             model_name: "Decklink Settings"
             attr_name: "Pixel Format" 
-            disable_when_running: true  
+            disable_when_running: false  
         }
 
         ListElement{
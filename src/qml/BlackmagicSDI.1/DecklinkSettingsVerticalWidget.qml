@@ -249,12 +249,113 @@ Item {
                 Layout.fillWidth: true
                 visible: false
     
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Device"
+                    attrs_model: decklink_settings
+                    attr_name: "Decklink Device"
+                    enabled: !is_running
+                }
+    
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Profile"
+                    attrs_model: decklink_settings
+                    attr_name: "Device Profile"
+                }
+
+                XsAttributeValue {
+                    id: __deviceInfo
+                    attributeTitle: "Decklink Device Info"
+                    model: decklink_settings
+                }
+
+                XsAttributeValue {
+                    id: __mirrorOutputs
+                    attributeTitle: "Mirror Outputs"
+                    model: decklink_settings
+                }
+
+                XsAttributeValue {
+                    id: __device
+                    attributeTitle: "Decklink Device"
+                    model: decklink_settings
+                }
+
+                XsLabel {
+                    text: "Mirror To"
+                    Layout.alignment: Qt.AlignLeft
+                    visible: mirror_repeater.count > 0
+                }
+
+                Repeater {
+
+                    id: mirror_repeater
+
+                    // every device apart from the main output can mirror it
+                    model: __deviceInfo.value ? Object.keys(__deviceInfo.value).filter(
+                        function(name) { return name != __device.value }) : []
+
+                    RowLayout {
+
+                        property var device_name: modelData
+                        property var mirrors: __mirrorOutputs.value ? __mirrorOutputs.value : []
+
+                        function mirrorIndex() {
+                            for (var i = 0; i < mirrors.length; ++i) {
+                                var m = mirrors[i]
+                                if (m == device_name || (m.device != undefined && m.device == device_name)) return i
+                            }
+                            return -1
+                        }
+
+                        XsCheckBox {
+                            checked: mirrorIndex() != -1
+                            enabled: !is_running
+                            onClicked: {
+                                var m = mirrors.slice()
+                                var i = mirrorIndex()
+                                if (i == -1) m.push(device_name)
+                                else m.splice(i, 1)
+                                __mirrorOutputs.value = m
+                            }
+                        }
+
+                        XsLabel {
+                            text: device_name
+                            Layout.alignment: Qt.AlignLeft
+                        }
+                    }
+                }
+
+                DecklinkToggleSetting {
+                    display_name: "Frame Lock Outputs"
+                    toggle_attr_name: "Frame Lock Outputs"
+                    visible: mirror_repeater.count > 0
+                    enabled: !is_running
+                }
+
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Preview To"
+                    attrs_model: decklink_settings
+                    attr_name: "Preview Device"
+                    enabled: !is_running
+                }
+
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Preview Res."
+                    attrs_model: decklink_settings
+                    attr_name: "Preview Resolution"
+                    enabled: !is_running
+                }
+
                 DecklinkMultichoiceSetting {
                     Layout.fillWidth: true
                     label_text: "Output Res."
                     attrs_model: decklink_settings
                     attr_name: "Output Resolution"
-                    enabled: !is_running
                 }
     
                 DecklinkMultichoiceSetting {
@@ -262,21 +363,51 @@ Item {
                     label_text: "Refresh Rate"
                     attrs_model: decklink_settings
                     attr_name: "Refresh Rate"
-                    enabled: !is_running
                 }
 
                 DecklinkMultichoiceSetting {
                     Layout.fillWidth: true
                     label_text: "Pixel Format" 
                     attrs_model: decklink_settings
-                    attr_name: "Pixel Format" 
+                    attr_name: "Pixel Format"
+                }
+
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "SDI Link"
+                    attrs_model: decklink_settings
+                    attr_name: "SDI Link"
                     enabled: !is_running
                 }
 
+                DecklinkToggleSetting {
+                    display_name: "Warm Standby"
+                    toggle_attr_name: "Warm Standby"
+                }
+
                 DecklinkIntegerSetting {
                     integer_attr_name: "Audio Sync Delay"
                     display_name: "Audio Delay / msec"
                 }
+
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Audio Buffering"
+                    attrs_model: decklink_settings
+                    attr_name: "Audio Buffering"
+                }
+
+                DecklinkToggleSetting {
+                    display_name: "Flush Audio On Seek"
+                    toggle_attr_name: "Flush Audio On Seek"
+                }
+
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Audio Routing"
+                    attrs_model: decklink_settings
+                    attr_name: "Audio Channel Routing"
+                }
                     
                 DecklinkIntegerSetting {
                     integer_attr_name: "Video Sync Delay"
@@ -288,6 +419,30 @@ Item {
                     toggle_attr_name: "Auto Disable PC Audio"
                 }
 
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "Realtime Scheduling"
+                    attrs_model: decklink_settings
+                    attr_name: "Realtime Scheduling"
+                }
+
+                DecklinkIntegerSetting {
+                    integer_attr_name: "Realtime Priority"
+                    display_name: "Realtime Priority"
+                }
+
+                DecklinkMultichoiceSetting {
+                    Layout.fillWidth: true
+                    label_text: "NUMA Node"
+                    attrs_model: decklink_settings
+                    attr_name: "NUMA Node"
+                }
+
+                DecklinkIntegerSetting {
+                    integer_attr_name: "Reference Timing Offset"
+                    display_name: "Genlock Offset / pixels"
+                }
+
             }
 
             Item {
@@ -17,6 +17,53 @@ Item {
         model: decklink_settings
     }
     property alias inError: __inError.value
+
+    XsAttributeValue {
+        id: __threadScheduling
+        attributeTitle: "Thread Scheduling"
+        model: decklink_settings
+    }
+    property alias threadScheduling: __threadScheduling.value
+
+    XsAttributeValue {
+        id: __referenceStatus
+        attributeTitle: "Reference Status"
+        model: decklink_settings
+    }
+    property alias referenceStatus: __referenceStatus.value
+
+    XsAttributeValue {
+        id: __deviceTelemetry
+        attributeTitle: "Device Telemetry"
+        model: decklink_settings
+    }
+    property alias deviceTelemetry: __deviceTelemetry.value
+
+    property var telemetryText: {
+        var d = deviceTelemetry
+        if (!d || !d.device) return ""
+        var t = d.device + ":"
+        if (d.pcie_link_width) {
+            t += " PCIe x" + d.pcie_link_width
+            if (d.pcie_link_degraded) t += " (card has x" + d.pcie_max_link_width + ")"
+            if (d.pcie_link_speed) t += " Gen " + d.pcie_link_speed
+            t += ","
+        }
+        if (d.temperature) t += " " + d.temperature + "\u00B0C,"
+        t += " " + d.busy
+        if (d.output_mode) t += ", sending " + d.output_mode
+        if (d.reference_mode) t += ", reference " + d.reference_mode
+        return t
+    }
+
+    property var referenceText: {
+        var r = referenceStatus
+        if (!r || r.status == undefined) return ""
+        var t = "Reference: " + r.status + ", timing offset " + r.timing_offset + " pixels"
+        if (r.changed_at) t += ", changed at " + r.changed_at
+        if (r.losses) t += ", lost " + r.losses + " times"
+        return t
+    }
     
     XsImage {
 
@@ -40,7 +87,7 @@ Item {
 
     XsToolTip {
         id: tooltip
-        text: statusMessage
+        text: [statusMessage, telemetryText, threadScheduling, referenceText].filter(function(t) { return t }).join("\n")
         visible: ma.containsMouse
     }
 
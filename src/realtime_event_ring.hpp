@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    /**
+     *  @brief Fixed size, lock free queue of small events, for passing news
+     *  from the Decklink driver threads to a thread that can deal with it.
+     *
+     *  @details
+     *   The driver's frame and audio callbacks mustn't allocate, throw or
+     *   wait on anything slow, so anything that involves xstudio (status
+     *   messages, errors, frame requests) goes through here instead. All of
+     *   the storage is inside the object. Any number of threads can push (the
+     *   video and audio callbacks both do, and so does preroll), one thread
+     *   pops. If the queue is full the event is dropped and counted.
+     *
+     *   This is the bounded queue from Dmitry Vyukov, where every cell has a
+     *   sequence number that says whose turn it is to use it.
+     */
+    template <typename Event, size_t Capacity> class RealtimeEventRing {
+
+        static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity must be a power of 2");
+
+      public:
+        RealtimeEventRing() {
+            for (size_t i = 0; i < Capacity; ++i) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // Returns false (and drops the event) if the queue is full
+        bool push(const Event &event) {
+
+            size_t pos = push_pos_.load(std::memory_order_relaxed);
+            Cell *cell = nullptr;
+            for (;;) {
+                cell                 = &cells_[pos & mask_];
+                const size_t seq     = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff  = intptr_t(seq) - intptr_t(pos);
+                if (diff == 0) {
+                    if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    pos = push_pos_.load(std::memory_order_relaxed);
+                }
+            }
+            cell->event = event;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side. Returns false if there is nothing waiting.
+        bool pop(Event &event) {
+
+            const size_t pos = pop_pos_.load(std::memory_order_relaxed);
+            Cell *cell       = &cells_[pos & mask_];
+            if (intptr_t(cell->sequence.load(std::memory_order_acquire)) - intptr_t(pos + 1) < 0)
+                return false;
+            event = cell->event;
+            cell->sequence.store(pos + Capacity, std::memory_order_release);
+            pop_pos_.store(pos + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        [[nodiscard]] bool empty() const {
+            return push_pos_.load(std::memory_order_acquire) == pop_pos_.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+      private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            Event event;
+        };
+
+        static constexpr size_t mask_ = Capacity - 1;
+        std::array<Cell, Capacity> cells_;
+        std::atomic<size_t> push_pos_ = {0};
+        std::atomic<size_t> pop_pos_  = {0};
+        std::atomic<size_t> dropped_  = {0};
+    };
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,508 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// The Decklink driver's frame and audio callbacks mustn't allocate (see
+// fill_decklink_video_frame). This drives DecklinkOutput on stub cards, with
+// a mirror and a preview output, with malloc and friends interposed, and
+// fails if anything is allocated on the thread making the callbacks or on the
+// conversion workers they hand work to. operator new comes down to malloc, so
+// it is caught too.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <pthread.h>
+#include <vector>
+
+#include "decklink_output.hpp"
+#include "xstudio/enums.hpp"
+
+namespace {
+
+std::atomic<bool> watching = {false};
+std::atomic<long> allocations = {0};
+pthread_t watched_threads[64];
+std::atomic<int> n_watched_threads = {0};
+
+void note_allocation() {
+    if (!watching.load(std::memory_order_acquire))
+        return;
+    const pthread_t self = pthread_self();
+    const int n          = n_watched_threads.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        if (pthread_equal(self, watched_threads[i])) {
+            allocations++;
+            return;
+        }
+    }
+}
+
+void watch_thread(const pthread_t thread) {
+    const int n = n_watched_threads;
+    if (n < int(sizeof(watched_threads) / sizeof(watched_threads[0]))) {
+        watched_threads[n] = thread;
+        n_watched_threads  = n + 1;
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) noexcept {
+    note_allocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+    note_allocation();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    note_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+    note_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    note_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept {
+    note_allocation();
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+}
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    // The stubs live on the stack for the whole test, so they don't count
+    // references
+    template <typename Interface> class StubUnknown : public Interface {
+
+      public:
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, LPVOID *ppv) override {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+        ULONG STDMETHODCALLTYPE Release() override { return 1; }
+    };
+
+    // all of the stub modes are 50Hz progressive
+    class StubDisplayMode : public StubUnknown<IDeckLinkDisplayMode> {
+
+      public:
+        StubDisplayMode(const BMDDisplayMode mode, const long width, const long height, const char *name)
+            : mode_(mode), width_(width), height_(height), name_(name) {}
+
+        // the caller frees the name
+        HRESULT GetName(const char **name) override {
+            *name = strdup(name_);
+            return S_OK;
+        }
+        BMDDisplayMode GetDisplayMode() override { return mode_; }
+        long GetWidth() override { return width_; }
+        long GetHeight() override { return height_; }
+        HRESULT GetFrameRate(BMDTimeValue *frame_duration, BMDTimeScale *time_scale) override {
+            *frame_duration = 1000;
+            *time_scale     = 50000;
+            return S_OK;
+        }
+        BMDFieldDominance GetFieldDominance() override { return bmdProgressiveFrame; }
+        BMDDisplayModeFlags GetFlags() override { return 0; }
+
+      private:
+        BMDDisplayMode mode_;
+        long width_;
+        long height_;
+        const char *name_;
+    };
+
+    class StubDisplayModeIterator : public StubUnknown<IDeckLinkDisplayModeIterator> {
+
+      public:
+        explicit StubDisplayModeIterator(const std::array<StubDisplayMode, 2> &modes) : modes_(modes) {}
+
+        void reset() { next_ = 0; }
+
+        HRESULT Next(IDeckLinkDisplayMode **mode) override {
+            if (next_ == modes_.size()) {
+                *mode = NULL;
+                return S_FALSE;
+            }
+            *mode = const_cast<StubDisplayMode *>(&modes_[next_++]);
+            return S_OK;
+        }
+
+      private:
+        const std::array<StubDisplayMode, 2> &modes_;
+        size_t next_ = {0};
+    };
+
+    // Plays out what it's given: the test calls display_frame() and
+    // play_audio() in place of the card's clock. Nothing here allocates once
+    // output has started.
+    class StubOutput : public StubUnknown<IDeckLinkOutput> {
+
+      public:
+        HRESULT DoesSupportVideoMode(
+            BMDVideoConnection,
+            BMDDisplayMode mode,
+            BMDPixelFormat,
+            BMDVideoOutputConversionMode,
+            BMDSupportedVideoModeFlags,
+            BMDDisplayMode *actual_mode,
+            bool *supported) override {
+            if (actual_mode)
+                *actual_mode = mode;
+            *supported = find(mode) != nullptr;
+            return S_OK;
+        }
+        HRESULT GetDisplayMode(BMDDisplayMode mode, IDeckLinkDisplayMode **display_mode) override {
+            *display_mode = find(mode);
+            return *display_mode ? S_OK : E_FAIL;
+        }
+        HRESULT GetDisplayModeIterator(IDeckLinkDisplayModeIterator **iterator) override {
+            iterator_.reset();
+            *iterator = &iterator_;
+            return S_OK;
+        }
+        HRESULT SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback *) override { return S_OK; }
+
+        HRESULT EnableVideoOutput(BMDDisplayMode, BMDVideoOutputFlags) override { return S_OK; }
+        HRESULT DisableVideoOutput() override {
+            while (n_scheduled_)
+                display_frame();
+            return S_OK;
+        }
+        HRESULT SetVideoOutputFrameMemoryAllocator(IDeckLinkMemoryAllocator *) override { return E_NOTIMPL; }
+        HRESULT CreateVideoFrame(int32_t, int32_t, int32_t, BMDPixelFormat, BMDFrameFlags, IDeckLinkMutableVideoFrame **) override {
+            return E_NOTIMPL;
+        }
+        HRESULT CreateAncillaryData(BMDPixelFormat, IDeckLinkVideoFrameAncillary **) override { return E_NOTIMPL; }
+        HRESULT DisplayVideoFrameSync(IDeckLinkVideoFrame *) override { return E_NOTIMPL; }
+        HRESULT ScheduleVideoFrame(IDeckLinkVideoFrame *frame, BMDTimeValue, BMDTimeValue, BMDTimeScale) override {
+            if (n_scheduled_ == scheduled_.size())
+                return E_FAIL;
+            frame->AddRef();
+            scheduled_[(first_scheduled_ + n_scheduled_++) % scheduled_.size()] = frame;
+            if (watching) {
+                frames_scheduled_++;
+                // A frame that failed to convert goes out black. The middle
+                // of the frame is inside the image whatever its size.
+                void *bytes = NULL;
+                if (frame->GetBytes(&bytes) == S_OK &&
+                    !*(const uint32_t *)((const uint8_t *)bytes + (frame->GetHeight() / 2) * frame->GetRowBytes() +
+                                         (frame->GetRowBytes() / 2 & ~size_t(3))))
+                    black_frames_++;
+            }
+            return S_OK;
+        }
+        HRESULT SetScheduledFrameCompletionCallback(IDeckLinkVideoOutputCallback *) override { return S_OK; }
+        HRESULT GetBufferedVideoFrameCount(uint32_t *count) override {
+            *count = uint32_t(n_scheduled_);
+            return S_OK;
+        }
+
+        HRESULT EnableAudioOutput(BMDAudioSampleRate, BMDAudioSampleType, uint32_t, BMDAudioOutputStreamType) override {
+            return S_OK;
+        }
+        HRESULT DisableAudioOutput() override {
+            buffered_audio_ = 0;
+            return S_OK;
+        }
+        HRESULT WriteAudioSamplesSync(void *, uint32_t, uint32_t *) override { return E_NOTIMPL; }
+        HRESULT BeginAudioPreroll() override { return S_OK; }
+        HRESULT EndAudioPreroll() override { return S_OK; }
+        HRESULT ScheduleAudioSamples(void *, uint32_t count, BMDTimeValue, BMDTimeScale, uint32_t *written) override {
+            buffered_audio_ += count;
+            audio_scheduled_ += count;
+            if (written)
+                *written = count;
+            return S_OK;
+        }
+        HRESULT GetBufferedAudioSampleFrameCount(uint32_t *count) override {
+            *count = buffered_audio_;
+            return S_OK;
+        }
+        HRESULT FlushBufferedAudioSamples() override {
+            buffered_audio_ = 0;
+            return S_OK;
+        }
+        HRESULT SetAudioCallback(IDeckLinkAudioOutputCallback *) override { return S_OK; }
+
+        HRESULT StartScheduledPlayback(BMDTimeValue, BMDTimeScale, double) override { return S_OK; }
+        HRESULT StopScheduledPlayback(BMDTimeValue, BMDTimeValue *actual_stop_time, BMDTimeScale) override {
+            if (actual_stop_time)
+                *actual_stop_time = 0;
+            return S_OK;
+        }
+        HRESULT IsScheduledPlaybackRunning(bool *active) override {
+            *active = true;
+            return S_OK;
+        }
+        HRESULT GetScheduledStreamTime(BMDTimeScale, BMDTimeValue *stream_time, double *speed) override {
+            *stream_time = 0;
+            *speed       = 1.0;
+            return S_OK;
+        }
+        HRESULT GetReferenceStatus(BMDReferenceStatus *status) override {
+            *status = 0;
+            return S_OK;
+        }
+        HRESULT GetHardwareReferenceClock(BMDTimeScale, BMDTimeValue *time, BMDTimeValue *time_in_frame, BMDTimeValue *ticks_per_frame) override {
+            *time = *time_in_frame = *ticks_per_frame = 0;
+            return S_OK;
+        }
+        HRESULT GetFrameCompletionReferenceTimestamp(IDeckLinkVideoFrame *, BMDTimeScale, BMDTimeValue *) override {
+            return E_NOTIMPL;
+        }
+
+        // the oldest frame goes on screen, and the card lets go of it
+        void display_frame() {
+            if (!n_scheduled_)
+                return;
+            scheduled_[first_scheduled_]->Release();
+            first_scheduled_ = (first_scheduled_ + 1) % scheduled_.size();
+            n_scheduled_--;
+        }
+
+        void play_audio(const uint32_t n) { buffered_audio_ -= std::min(n, buffered_audio_.load()); }
+
+        // counts of what was scheduled by the callbacks
+        [[nodiscard]] long frames_scheduled() const { return frames_scheduled_; }
+        [[nodiscard]] long black_frames() const { return black_frames_; }
+        [[nodiscard]] long audio_scheduled() const { return audio_scheduled_; }
+
+      private:
+        StubDisplayMode *find(const BMDDisplayMode mode) {
+            for (auto &m : modes_) {
+                if (m.GetDisplayMode() == mode)
+                    return &m;
+            }
+            return nullptr;
+        }
+
+        std::array<StubDisplayMode, 2> modes_ = {
+            StubDisplayMode(bmdModeHD1080p50, 1920, 1080, "1080p50"),
+            StubDisplayMode(bmdModeHD720p50, 1280, 720, "720p50")};
+        StubDisplayModeIterator iterator_ = StubDisplayModeIterator(modes_);
+        std::array<IDeckLinkVideoFrame *, 32> scheduled_ = {};
+        size_t first_scheduled_ = {0};
+        size_t n_scheduled_     = {0};
+        long frames_scheduled_  = {0};
+        long black_frames_      = {0};
+        std::atomic<uint32_t> buffered_audio_ = {0};
+        long audio_scheduled_   = {0};
+    };
+
+    class StubCard : public IDeckLink {
+
+      public:
+        explicit StubCard(const char *name) : name_(name) {}
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) override {
+            if (memcmp(&iid, &IID_IDeckLinkOutput, sizeof(REFIID)) == 0) {
+                *ppv = (IDeckLinkOutput *)&output_;
+                return S_OK;
+            }
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+        ULONG STDMETHODCALLTYPE Release() override { return 1; }
+
+        HRESULT GetModelName(const char **name) override {
+            *name = strdup("Stub");
+            return S_OK;
+        }
+        HRESULT GetDisplayName(const char **name) override {
+            *name = strdup(name_);
+            return S_OK;
+        }
+
+        StubOutput &output() { return output_; }
+
+      private:
+        const char *name_;
+        StubOutput output_;
+    };
+
+    // Stands in for the driver's converter, which the output uses for YUV.
+    // Only fills the frame, which is enough for the frame to not be black.
+    class StubConverter : public StubUnknown<IDeckLinkVideoConversion> {
+
+      public:
+        HRESULT ConvertFrame(IDeckLinkVideoFrame *, IDeckLinkVideoFrame *dst) override {
+            void *bytes = NULL;
+            if (dst->GetBytes(&bytes) != S_OK)
+                return E_FAIL;
+            memset(bytes, 0x40, size_t(dst->GetRowBytes()) * size_t(dst->GetHeight()));
+            conversions_++;
+            return S_OK;
+        }
+
+        [[nodiscard]] long conversions() const { return conversions_; }
+
+      private:
+        std::atomic<long> conversions_ = {0};
+    };
+
+    class StubHost : public DecklinkOutputHost {
+
+      public:
+        void send_output_status(const utility::JsonStore &) override {}
+        void start_rendering(const int, const int) override {}
+        void stop_rendering() override {}
+        void request_render(const utility::time_point &) override {}
+        void frame_displayed(const utility::time_point &) override {}
+    };
+
+    // what the test needs from DecklinkOutput's protected interface
+    class StubbedDecklinkOutput : public DecklinkOutput {
+
+      public:
+        using DecklinkOutput::conversion_threads;
+        using DecklinkOutput::DecklinkOutput;
+        using DecklinkOutput::init_without_driver;
+        using DecklinkOutput::request_audio_flush;
+    };
+
+    class CallbackAllocationTest {
+
+      public:
+        int run();
+
+      private:
+        media_reader::ImageBufPtr
+        make_image(const int pixel_format, const int width, const int height, const uint8_t fill);
+
+        StubHost host_;
+        StubConverter converter_;
+        StubCard main_card_    = StubCard("Main");
+        StubCard mirror_card_  = StubCard("Mirror");
+        StubCard preview_card_ = StubCard("Preview");
+    };
+
+    media_reader::ImageBufPtr CallbackAllocationTest::make_image(
+        const int pixel_format, const int width, const int height, const uint8_t fill) {
+
+        utility::JsonStore params;
+        params["pixel_format"] = pixel_format;
+        media_reader::ImageBufPtr image(new media_reader::ImageBuffer(params));
+        const size_t size = size_t(width) * size_t(height) * FrameGeometryAdapter::bytes_per_pixel(pixel_format);
+        memset(image->allocate(size), fill, size);
+        image->set_image_dimensions(Imath::V2i(width, height));
+        return image;
+    }
+
+    int CallbackAllocationTest::run() {
+
+        StubbedDecklinkOutput output(&host_);
+
+        // as DecklinkAudioOutputDevice does when xstudio makes it
+        const int channels = output.audio_device_channels();
+
+        // YUV goes through the frame converter, the mirror converts to 10
+        // bit RGB itself and the preview is downscaled
+        output.set_device("Main");
+        output.set_mirror_outputs({{"Mirror", bmdFormat10BitRGB}});
+        output.set_preview_output({"Preview", "1280 x 720"});
+        DecklinkDeviceDiscovery *discovery = output.init_without_driver(&converter_);
+        discovery->DeckLinkDeviceArrived(&main_card_);
+        discovery->DeckLinkDeviceArrived(&mirror_card_);
+        discovery->DeckLinkDeviceArrived(&preview_card_);
+
+        const auto refresh_rates = output.get_available_refresh_rates("1920 x 1080");
+        output.set_display_mode("1920 x 1080", refresh_rates.front(), bmdFormat8BitYUV);
+        output.StartStop();
+
+        // New images each refresh, in both of the formats xstudio renders in.
+        // Some aren't the size of the output, so they are fitted to it: the
+        // smaller one is centred and the bigger one scaled down.
+        const std::vector<media_reader::ImageBufPtr> images = {
+            make_image(ui::viewport::RGBA_16, 1920, 1080, 0x10),
+            make_image(ui::viewport::RGBA_16, 1280, 720, 0x80),
+            make_image(ui::viewport::RGBA_10_10_10_2, 1920, 1080, 0x40),
+            make_image(ui::viewport::RGBA_16, 2048, 1152, 0x20),
+            make_image(ui::viewport::RGBA_10_10_10_2, 1280, 720, 0x30)};
+        const uint32_t samples_per_frame = 48000 / 50;
+        const std::vector<float> samples(size_t(samples_per_frame) * size_t(channels), 0.25f);
+
+        // this thread stands in for the driver's video and audio threads
+        watch_thread(pthread_self());
+        for (const auto thread : output.conversion_threads())
+            watch_thread(thread);
+
+        const std::array<StubCard *, 3> cards = {&main_card_, &mirror_card_, &preview_card_};
+        const int n_frames = 100;
+        for (int i = 0; i < n_frames; ++i) {
+
+            // what xstudio does on its own threads
+            output.incoming_frame(images[size_t(i) % images.size()]);
+            output.receive_samples_from_xstudio(samples.data(), samples.size());
+            if (i == n_frames / 2)
+                output.request_audio_flush(); // as after a seek
+
+            watching = true;
+            for (auto card : cards)
+                card->output().display_frame();
+            output.fill_decklink_video_frame(bmdOutputFrameCompleted);
+            main_card_.output().play_audio(samples_per_frame);
+            output.copy_audio_samples_to_decklink_buffer(false);
+            watching = false;
+        }
+
+        const char *names[] = {"main", "mirror", "preview"};
+        for (size_t c = 0; c < cards.size(); ++c) {
+            const StubOutput &out = cards[c]->output();
+            if (out.frames_scheduled() < n_frames) {
+                fprintf(stderr, "The %s output didn't run, scheduled %ld frames.\n", names[c], out.frames_scheduled());
+                return 1;
+            }
+            if (out.black_frames()) {
+                fprintf(stderr, "%ld of %d frames on the %s output failed to convert.\n", out.black_frames(), n_frames, names[c]);
+                return 1;
+            }
+        }
+        if (!main_card_.output().audio_scheduled()) {
+            fprintf(stderr, "No audio was scheduled.\n");
+            return 1;
+        }
+        if (converter_.conversions() < n_frames) {
+            fprintf(stderr, "Only %ld frames went through the frame converter.\n", converter_.conversions());
+            return 1;
+        }
+        if (allocations) {
+            fprintf(stderr, "%ld allocations in %d frame and audio callbacks.\n", allocations.load(), n_frames);
+            return 1;
+        }
+        printf("No allocations in %d frame and audio callbacks.\n", n_frames);
+        return 0;
+    }
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
+
+int main() {
+    xstudio::bm_decklink_plugin_1_0::CallbackAllocationTest test;
+    return test.run();
+}
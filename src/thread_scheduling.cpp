@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "thread_scheduling.hpp"
+#include "xstudio/utility/logging.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+namespace {
+
+const char *policy_name(const ThreadPolicy policy) {
+    switch (policy) {
+    case ThreadPolicy::Fifo:
+        return "SCHED_FIFO";
+    case ThreadPolicy::RoundRobin:
+        return "SCHED_RR";
+    default:
+        return "Normal";
+    }
+}
+
+} // namespace
+
+ThreadPriority set_thread_priority(pthread_t thread, const ThreadPriority &requested) {
+
+    if (requested.policy != ThreadPolicy::Normal) {
+
+        const int policy = int(requested.policy);
+        sched_param param{};
+        param.sched_priority = std::clamp(
+            requested.priority, sched_get_priority_min(policy), sched_get_priority_max(policy));
+
+        int err = pthread_setschedparam(thread, policy, &param);
+        if (err == EPERM) {
+            // not privileged, but we may be allowed some realtime priority
+            rlimit limit{};
+            if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur > 0) {
+                param.sched_priority = int(std::min<rlim_t>(rlim_t(param.sched_priority), limit.rlim_cur));
+                err = pthread_setschedparam(thread, policy, &param);
+            }
+        }
+        if (!err)
+            return ThreadPriority{requested.policy, param.sched_priority};
+        return get_thread_priority(thread);
+    }
+
+    // anyone can go back to normal scheduling
+    sched_param param{};
+    pthread_setschedparam(thread, SCHED_OTHER, &param);
+    return ThreadPriority();
+}
+
+ThreadPriority get_thread_priority(pthread_t thread) {
+
+    int policy = SCHED_OTHER;
+    sched_param param{};
+    if (pthread_getschedparam(thread, &policy, &param) != 0)
+        return ThreadPriority();
+#ifdef SCHED_RESET_ON_FORK
+    policy &= ~SCHED_RESET_ON_FORK;
+#endif
+    return ThreadPriority{ThreadPolicy(policy), param.sched_priority};
+}
+
+bool set_thread_affinity(pthread_t thread, const std::vector<int> &cores) {
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (cores.empty()) {
+        const long n = sysconf(_SC_NPROCESSORS_CONF);
+        for (long i = 0; i < n && i < CPU_SETSIZE; ++i)
+            CPU_SET(i, &cpus);
+    } else {
+        for (const int c : cores) {
+            if (c >= 0 && c < CPU_SETSIZE)
+                CPU_SET(c, &cpus);
+        }
+    }
+    return pthread_setaffinity_np(thread, sizeof(cpus), &cpus) == 0;
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<int> &cores) {
+    if (!cores.empty()) {
+        restore_ = pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_) == 0 &&
+                   set_thread_affinity(pthread_self(), cores);
+    }
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+    if (restore_)
+        pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+}
+
+std::vector<int> parse_core_list(const std::string &list) {
+
+    std::vector<int> cores;
+    size_t pos = 0;
+    while (pos < list.size()) {
+
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string item = list.substr(pos, end - pos);
+        pos              = end + 1;
+
+        item.erase(std::remove(item.begin(), item.end(), ' '), item.end());
+        if (item.empty())
+            continue;
+
+        try {
+            const size_t dash = item.find('-');
+            const int first   = std::stoi(item.substr(0, dash));
+            const int last    = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            if (first < 0 || last < first || last >= CPU_SETSIZE)
+                throw std::out_of_range(item);
+            for (int c = first; c <= last; ++c)
+                cores.push_back(c);
+        } catch (std::logic_error &) {
+            throw std::runtime_error(fmt::format("Invalid core list \"{}\", expected something like \"2-5,8\".", list));
+        }
+    }
+
+    std::sort(cores.begin(), cores.end());
+    cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+    return cores;
+}
+
+std::string core_list_string(const std::vector<int> &cores) {
+
+    // back to ranges, e.g. 2-5,8
+    std::string result;
+    for (size_t i = 0; i < cores.size();) {
+        size_t j = i;
+        while (j + 1 < cores.size() && cores[j + 1] == cores[j] + 1)
+            ++j;
+        if (!result.empty())
+            result += ",";
+        result += j == i ? std::to_string(cores[i]) : fmt::format("{}-{}", cores[i], cores[j]);
+        i = j + 1;
+    }
+    return result;
+}
+
+std::string describe_thread_priority(const ThreadPriority &requested, const ThreadPriority &effective) {
+
+    if (effective.policy == ThreadPolicy::Normal) {
+        return requested.policy == ThreadPolicy::Normal
+                   ? std::string("normal")
+                   : fmt::format("normal ({} not permitted)", policy_name(requested.policy));
+    }
+    if (requested.policy == ThreadPolicy::Normal) {
+        // a thread we don't own, left as its owner set it up
+        return fmt::format("{} {} (left as it was)", policy_name(effective.policy), effective.priority);
+    }
+    if (effective.priority != requested.priority) {
+        return fmt::format(
+            "{} {} (limited from {})", policy_name(effective.policy), effective.priority, requested.priority);
+    }
+    return fmt::format("{} {}", policy_name(effective.policy), effective.priority);
+}
+
+ThreadPolicy thread_policy_from_name(const std::string &name) {
+    if (name == policy_name(ThreadPolicy::Fifo))
+        return ThreadPolicy::Fifo;
+    if (name == policy_name(ThreadPolicy::RoundRobin))
+        return ThreadPolicy::RoundRobin;
+    return ThreadPolicy::Normal;
+}
+
+std::vector<std::string> thread_policy_names() {
+    return {
+        policy_name(ThreadPolicy::Normal),
+        policy_name(ThreadPolicy::Fifo),
+        policy_name(ThreadPolicy::RoundRobin)};
+}
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace xstudio {
+namespace bm_decklink_plugin_1_0 {
+
+    enum class ThreadPolicy { Normal = SCHED_OTHER, Fifo = SCHED_FIFO, RoundRobin = SCHED_RR };
+
+    struct ThreadPriority {
+        ThreadPolicy policy = {ThreadPolicy::Normal};
+        int priority        = {0}; // 1 to 99 for the realtime policies
+    };
+
+    /**
+     *  @brief Puts thread on the requested scheduling policy, as far as we
+     *  are allowed to.
+     *
+     *  @details
+     *   Without root (or CAP_SYS_NICE) a realtime policy is only allowed up
+     *   to the RLIMIT_RTPRIO priority (e.g. from /etc/security/limits.conf),
+     *   so we ask again at that priority. If that's zero too the thread is
+     *   left as it was. Returns what the thread actually got. Only system
+     *   calls, so this is safe on the Decklink driver threads.
+     */
+    ThreadPriority set_thread_priority(pthread_t thread, const ThreadPriority &requested);
+
+    // What the thread is running on now, so that it can be put back later
+    ThreadPriority get_thread_priority(pthread_t thread);
+
+    // Confines thread to the given cores, or lets it run anywhere if cores
+    // is empty. Returns false if the system wouldn't allow it.
+    bool set_thread_affinity(pthread_t thread, const std::vector<int> &cores);
+
+    // Moves the calling thread onto the given cores until it goes out of
+    // scope, so that memory it first touches goes on their NUMA node. Does
+    // nothing if cores is empty.
+    class ScopedThreadAffinity {
+
+      public:
+        explicit ScopedThreadAffinity(const std::vector<int> &cores);
+        ~ScopedThreadAffinity();
+
+        ScopedThreadAffinity(const ScopedThreadAffinity &)            = delete;
+        ScopedThreadAffinity &operator=(const ScopedThreadAffinity &) = delete;
+
+      private:
+        cpu_set_t saved_;
+        bool restore_ = {false};
+    };
+
+    // Parses a list of cores like "2-5,8". Throws std::runtime_error if
+    // the list doesn't make sense.
+    std::vector<int> parse_core_list(const std::string &list);
+    std::string core_list_string(const std::vector<int> &cores);
+
+    // e.g. "SCHED_FIFO 80", or "normal (SCHED_FIFO not permitted)"
+    std::string describe_thread_priority(const ThreadPriority &requested, const ThreadPriority &effective);
+
+    // the names used by the "Realtime Scheduling" preference
+    ThreadPolicy thread_policy_from_name(const std::string &name);
+    std::vector<std::string> thread_policy_names();
+
+} // namespace bm_decklink_plugin_1_0
+} // namespace xstudio